@@ -6,18 +6,36 @@
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 #include "meshes.h"
+#include "textures.h"
+#include "headless.h"
+#include "benchmark.h"
+#include "gpuprofiler.h"
+#include "cpuprofiler.h"
+#include "golden.h"
+#include "microbench.h"
+#include "framepacer.h"
+#include "simulation.h"
+#include "renderthread.h"
+#include "jobsystem.h"
+#include "transforms.h"
+#include "drawlist.h"
+#include "lightclusters.h"
+#include "depthprepass.h"
+#include "gbuffer.h"
+#include "shadowmaps.h"
+#include "pointshadows.h"
+#include "dynamicresolution.h"
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 
 // GLM Math Header inclusions
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-//image loader for textures
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
 using namespace std; // Standard namespace
 
 /*Shader program Macro*/
@@ -25,6 +43,11 @@ using namespace std; // Standard namespace
 #define GLSL(Version, Source) "#version " #Version " core \n" #Source
 #endif
 
+/*Shader snippet Macro, appended to a source that already has its #version*/
+#ifndef GLSL_SNIPPET
+#define GLSL_SNIPPET(Source) #Source
+#endif
+
 // Unnamed namespace
 namespace
 {
@@ -41,7 +64,7 @@ namespace
     glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 
     bool firstMouse = true;
-    bool orthoOn = false;
+    atomic<bool> orthoOn(false);    // toggled by input, read by the render thread
     glm::mat4 projection; //move to a global to set from a keystroke
 
     float yaw = -90.0f;	// yaw is initialized to -90.0 degrees since a yaw of 0.0 results in a direction vector pointing to the right so we initially rotate a bit to the left.
@@ -58,15 +81,114 @@ namespace
     // Main GLFW window
     GLFWwindow* gWindow = nullptr;
 
+    // Decides when the interactive loop renders (--render-on-change skips frames while idle)
+    FramePacer framePacer;
+    bool gIdleReport = false;       // print the CPU/frame savings report on exit
+
+    // Camera movement runs in fixed steps; frames draw an interpolation of the last two
+    Simulation simulation;
+
+    // GL submission on its own thread, fed frame packets by the main thread (--render-thread)
+    RenderThread renderThread;
+    bool gRenderThread = false;
+    unsigned int gRenderCommands = 0;   // FramePacket::Command bits for the next packet
+    atomic<bool> gRenderWorkPending(false); // set by the render side while background work still needs frames
+
+    // Offscreen rendering without a window (--headless)
+    Headless headless;
+    bool gHeadless = false;
+    int gHeadlessFrames = 1;                        // frames rendered before the image is written
+    string gHeadlessOutput = "headless.ppm";
+    int gHeadlessWidth = WINDOW_WIDTH;              // size of the offscreen framebuffer
+    int gHeadlessHeight = WINDOW_HEIGHT;
+    const float HEADLESS_FRAME_TIME = 1.0f / 60.0f; // fixed time step so headless runs are repeatable
+
+    // Benchmark runs replay a camera path; live camera movement can be recorded as one
+    Benchmark benchmark;
+    string gRecordPathFile;         // camera path recorded during an interactive run
+    unsigned int gDrawCalls = 0;    // draw calls issued by the current frame
+
+    // GPU time of each section of URender
+    GpuProfiler gpuProfiler;
+
+    // CPU zones are written here as a Chrome trace on exit (--trace)
+    string gTraceFile;
+
+    // Golden-image regression check of the rendered scene (--golden, --update-golden)
+    GoldenImages golden;
+
+    // Microbenchmarks of the hot paths (--microbench)
+    MicroBenchmark microbench;
+    bool gMicrobench = false;
+
+    // Images used by the scene, also timed by the decode benchmarks
+    const vector<string> SCENE_TEXTURE_FILES = { "Wood_Texture.jpg", "NYGlobe_Texture.jpg", "Base_Texture.jpg", "BlackShade_Texture.jpg",
+        "HD_Texture.jpg", "Switch_Texture.jpg", "SwitchBack_Texture.jpg", "WhiteShadow_Texture.jpg" };
+
     //Generic primative shape mesh
     Meshes meshes;
 
     // Shader programs
     GLuint surfaceProgramId;
     GLuint lampProgramId;
-
-    // Texture id
-    GLuint gTexture0, gTexture1, gTexture2, gTexture3, gTexture4, gTexture5, gTexture6, gTexture7;
+    GLuint depthProgramId;
+    GLuint pointShadowProgramId;
+    GLuint upscaleProgramId;
+    GLuint gBufferProgramId;
+    GLuint deferredLightingProgramId;
+
+    // How the scene is lit; switched at run time with R (--renderer)
+    enum RenderPath { RENDER_FORWARD, RENDER_CLUSTERED, RENDER_DEFERRED };
+    const char* const RENDER_PATH_NAMES[] = { "forward", "clustered", "deferred" };
+    const int RENDER_PATH_COUNT = 3;
+    atomic<int> gRenderPath(RENDER_CLUSTERED);  // toggled by input, read by the render thread
+    bool gCompareRenderers = false;             // benchmark every render path in turn (--compare-renderers)
+
+    // Albedo / normal / depth targets of the deferred path; the scene texture keeps unit 0
+    GBuffer gBuffer;
+    const GLuint GBUFFER_TEXTURE_UNIT = 1;
+
+    // Depth-only pass ahead of the surface pass, so each visible pixel is shaded once (--depth-prepass)
+    DepthPrepass depthPrepass;
+    bool gPrepassReport = false;    // print overdraw and pre-pass use on exit (--prepass-report)
+
+    // Cascaded shadow maps of the sun; static casters stay cached until they or the light move (--shadows)
+    ShadowMaps shadowMaps;
+    const GLuint SHADOW_TEXTURE_UNIT = 4;   // after the scene texture and the three G-buffer targets
+    bool gShadowReport = false;     // print shadow cache use on exit (--shadow-report)
+
+    // Cube shadows of the most important point lights, a few re-rendered per frame (--point-shadows)
+    PointShadows pointShadows;
+    const GLuint POINT_SHADOW_TEXTURE_UNIT = 5;
+
+    // Renders below the window resolution when the GPU falls behind its frame time target (--dynamic-resolution)
+    DynamicResolution dynamicResolution;
+    bool gResolutionReport = false; // print where the scale settled on exit (--resolution-report)
+
+    //Scene textures, packed into one texture array
+    Textures textures;
+
+    // Worker threads for per-frame CPU work (--jobs)
+    JobSystem jobs;
+    int gJobThreads = -1;           // -1 for one per spare hardware thread
+    bool gJobStats = false;         // print per-worker utilization on exit (--job-stats)
+
+    // The scene's objects, culled and sorted in parallel every frame, and the transforms they hang from
+    DrawListBuilder drawList;
+    TransformHierarchy sceneTransforms;
+
+    // Per-draw model / normal matrices the surface shader indexes with uDrawIndex
+    const GLuint DRAW_TRANSFORM_BINDING = 1;    // binding 0 is the bindless handle table
+    GLuint gDrawTransformBuffer = 0;
+    vector<DrawListBuilder::DrawTransform> gDrawTransformFallback; // used when the buffer cannot be mapped
+    enum SceneSection { SECTION_DESK, SECTION_GLOBE, SECTION_CUP, SECTION_HARD_DRIVE, SECTION_SWITCH_DOCK, SECTION_STRESS };
+    const char* const SCENE_SECTION_NAMES[] = { "desk", "globe", "cup", "hard drive", "switch dock", "stress objects" };
+    int gStressObjects = 0;         // extra boxes for scaling tests (--stress-objects)
+    const float STRESS_SPACING = 0.25f;
+    const int MICROBENCH_STRESS_OBJECTS = 100000;
+
+    // Texture slots (layer and rectangle inside the texture array)
+    Textures::TextureSlot gTexture0, gTexture1, gTexture2, gTexture3, gTexture4, gTexture5, gTexture6, gTexture7;
     glm::vec2 gUVScale(1.0f, 1.0f);
 
     // Cube and light color
@@ -76,8 +198,8 @@ namespace
     glm::vec3 gLightPosition;
     glm::vec3 gLightScale(0.3f);
 
-    // positions of the point lights
-    glm::vec3 pointLightPositions[] = {
+    // positions of the desk's point lights
+    const glm::vec3 pointLightPositions[] = {
         glm::vec3(0.5f, 8.0f, -2.0f),
         glm::vec3(5.5f, 8.0f, -2.0f),
         glm::vec3(5.5f, 8.0f, 2.0f),
@@ -85,9 +207,17 @@ namespace
         glm::vec3(1.5f, 8.0f, 0.0f),
     };
 
+    // Every point light, assigned to view clusters each frame so fragments only shade the lights near them
+    ClusteredLights pointLights;
+    int gOfficeLamps = 0;           // extra desk lamps around the scene (--office-lamps)
+    const float OFFICE_LAMP_SPACING = 8.0f;
+    const float OFFICE_LAMP_HEIGHT = 3.0f;
+    const int MICROBENCH_LIGHTS = 256;
+
     //make the lighting color global to set multiple places
     glm::vec3 coloredLightColor(0.12f, 0.69f, 0.69f); //teal
     glm::vec3 ambientLightColor(1.0f, 1.0f, 1.0f); //pure white for the Sun
+    const glm::vec3 sunDirection(-6.0f, -4.0f, 0.0f); //shared by the lighting and the shadow maps
     glm::vec3 pointLightColor(1.0f, 0.819f, 0.639f); //~4000k from https://andi-siess.de/rgb-to-color-temperature/
 }
 
@@ -99,14 +229,34 @@ namespace
  */
 bool UInitialize(int, char* [], GLFWwindow** window);
 void UResizeWindow(GLFWwindow* window, int width, int height);
+void URefreshWindow(GLFWwindow* window);
 void UProcessInput(GLFWwindow* window);
+void UStepSimulation(Simulation::State& state, double timeStep);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+void URenderPacket(const FramePacket& packet);
+void UBuildScene();
+TransformHierarchy::Node UAddStressObjects(vector<DrawListBuilder::SceneObject>& objects, TransformHierarchy& nodes, int count);
+void UBuildLights(ClusteredLights& lights, int officeLamps);
+void UUploadDrawTransforms();
+void USubmitDrawList(GLuint programId, GLint drawIndexLoc);
+void USubmitDepthPrepass(const glm::mat4& view);
+void UDrawObjectMesh(const DrawListBuilder::SceneObject& object);
+void URenderShadows(const glm::mat4& view, GLuint programId);
+void UDeferredLighting(const glm::mat4& view, const glm::vec3& cameraPosition);
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId, const char* geomShaderSource = nullptr);
 void UDestroyShaderProgram(GLuint programId);
 
 //textures
-bool UCreateTexture(const char* filename, GLuint& textureId);
-void UDestroyTexture(GLuint textureId);
+bool UCreateTexture(const char* filename, Textures::TextureSlot& slot, int reduction = 0);
+void UDestroyTexture(Textures::TextureSlot& slot);
+void USetTextureSlot(GLuint programId, const Textures::TextureSlot& slot);
+string UBuildSurfaceFragmentSource(const GLchar* mainSource, bool bindless);
+
+//benchmark
+bool URunBenchmark();
+bool URunGoldenImages();
+bool URunMicroBenchmarks();
+void USetCamera(const Benchmark::CameraKey& key);
 
 //add the new prototypes for the keys and mouse controls
 void mouseCallback(GLFWwindow* window, double xpos, double ypos);
@@ -116,7 +266,7 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 
 //lights
 //function to create lights; used to make code more readable
-void CreateLights();
+void CreateLights(const glm::mat4& view, GLuint programId, bool clustered);
 GLint GetUniformLocation(GLuint shader, string name);
 
 
@@ -129,27 +279,166 @@ layout(location = 2) in vec2 textureCoordinate;
 out vec2 vertexTextureCoordinate;
 out vec3 vertexNormal; // For outgoing normals to fragment shader
 out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
+out float vertexViewDepth; // Distance in front of the camera, picks the light cluster's depth slice
 
 //Global variables for the transform matrices
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// Model and normal matrix of every draw of the frame, written by the CPU in draw order
+struct DrawTransform
+{
+    mat4 model;
+    mat3 normal; // inverse transpose of the model matrix, excluding translation
+};
+layout(std430, binding = 1) readonly buffer DrawTransforms
+{
+    DrawTransform draws[];
+};
+uniform int uDrawIndex; // This draw's record
+
+invariant gl_Position; // must match the depth pre-pass bit for bit for its GL_EQUAL test
+
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+    mat4 model = draws[uDrawIndex].model;
+    vec4 viewPos = view * model * vec4(position, 1.0f);
+    gl_Position = projection * viewPos; // Transforms vertices into clip coordinates
 
     vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+    vertexViewDepth = -viewPos.z;
 
-    vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
+    vertexNormal = draws[uDrawIndex].normal * normal; // get normal vectors in world space only and exclude normal translation properties
     vertexTextureCoordinate = textureCoordinate;
 }
 );
 
-/* Cube Fragment Shader Source Code*/
+/* Cube Fragment Shader Source Code: forward shading of each fragment as it is drawn*/
 const GLchar* fragmentShaderSource = GLSL(440,
     out vec4 fragmentColor; // For outgoing cube color to the GPU
 
+in vec3 vertexNormal; // For incoming normals
+in vec3 vertexFragmentPos; // For incoming fragment position
+in float vertexViewDepth; // For the light cluster lookup
+in vec2 vertexTextureCoordinate;
+
+// Uniform / Global variables for object color, light color, light position, and camera/view position
+uniform vec3 objectColor;
+uniform vec3 viewPosition;
+uniform vec2 uvScale;
+
+// function prototypes
+vec3 ShadeFragment(vec3 normal, vec3 fragPos, float viewDepth, vec3 viewDir, vec3 albedo); // defined by the lighting snippet
+vec4 SampleTexture(); // defined by the texture sampling snippet for the active texture path
+
+void main()
+{
+    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
+    vec3 viewDir = normalize(viewPosition - vertexFragmentPos);
+
+    fragmentColor = vec4(ShadeFragment(norm, vertexFragmentPos, vertexViewDepth, viewDir, vec3(SampleTexture())), 1.0); // Send lighting results to GPU
+}
+);
+
+/* Deferred geometry pass: albedo and normal into the G-buffer, depth into its depth texture*/
+const GLchar* gBufferFragmentShaderSource = GLSL(440,
+    layout(location = 0) out vec4 gAlbedo;
+layout(location = 1) out vec4 gNormal;
+
+in vec3 vertexNormal;
+in vec2 vertexTextureCoordinate;
+
+vec4 SampleTexture(); // defined by the texture sampling snippet for the active texture path
+
+void main()
+{
+    gAlbedo = vec4(vec3(SampleTexture()), 1.0);
+    gNormal = vec4(normalize(vertexNormal), 0.0);
+}
+);
+
+/* Deferred lighting pass: one full-screen triangle shading every covered G-buffer pixel*/
+const GLchar* deferredLightingShaderSource = GLSL(440,
+    out vec4 fragmentColor;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection; // G-buffer depth back to world space
+uniform mat4 view;
+uniform vec2 viewportSize;
+uniform vec3 viewPosition;
+
+vec3 ShadeFragment(vec3 normal, vec3 fragPos, float viewDepth, vec3 viewDir, vec3 albedo); // defined by the lighting snippet
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth == 1.0)
+        discard; // nothing drawn here; keep the clear color
+
+    vec4 clip = vec4(gl_FragCoord.xy / viewportSize * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = inverseViewProjection * clip;
+    vec3 fragPos = world.xyz / world.w;
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+
+    vec3 norm = normalize(texelFetch(gNormal, pixel, 0).xyz);
+    vec3 albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+    fragmentColor = vec4(ShadeFragment(norm, fragPos, viewDepth, normalize(viewPosition - fragPos), albedo), 1.0);
+    gl_FragDepth = depth; // the lamps drawn afterwards still depth test against the scene
+}
+);
+
+/* Full-screen triangle, generated from gl_VertexID*/
+const GLchar* fullscreenVertexShaderSource = GLSL(440,
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+);
+
+/* Upscale Shader Source Code: bilinear upscale of the dynamic resolution target, then a contrast-limited sharpen*/
+const GLchar* upscaleFragmentShaderSource = GLSL(440,
+    out vec4 fragmentColor;
+
+uniform sampler2D uScene;
+uniform vec2 uOutputSize; // Size of the output and of the scene texture
+uniform vec2 uRenderSize; // Lower-left part of the texture the scene was rendered into
+uniform float uSharpness; // 0 for a plain bilinear upscale
+
+vec3 Fetch(vec2 renderPixel)
+{
+    // stay half a texel inside the rendered part, so the filter never reads what lies past it
+    renderPixel = clamp(renderPixel, vec2(0.5), uRenderSize - 0.5);
+    return texture(uScene, renderPixel / uOutputSize).rgb;
+}
+
+void main()
+{
+    vec2 renderPixel = gl_FragCoord.xy * (uRenderSize / uOutputSize);
+    vec3 center = Fetch(renderPixel);
+    if (uSharpness <= 0.0)
+    {
+        fragmentColor = vec4(center, 1.0);
+        return;
+    }
+
+    // unsharp mask against the four render-resolution neighbours, clamped to their range so edges do not ring
+    vec3 north = Fetch(renderPixel + vec2(0.0, 1.0));
+    vec3 south = Fetch(renderPixel - vec2(0.0, 1.0));
+    vec3 east = Fetch(renderPixel + vec2(1.0, 0.0));
+    vec3 west = Fetch(renderPixel - vec2(1.0, 0.0));
+    vec3 lowest = min(center, min(min(north, south), min(east, west)));
+    vec3 highest = max(center, max(max(north, south), max(east, west)));
+    vec3 sharpened = center + uSharpness * (4.0 * center - north - south - east - west);
+    fragmentColor = vec4(clamp(sharpened, lowest, highest), 1.0);
+}
+);
+
+/* Lighting shared by the forward and deferred paths: the directional light and the point lights*/
+const GLchar* lightingSource = GLSL_SNIPPET(
 struct DirLight {
     vec3 direction;
 
@@ -158,55 +447,101 @@ struct DirLight {
     vec3 specular;
 };
 
+// std430 layout of ClusteredLights::PointLight
 struct PointLight {
     vec3 position;
-
-    float constant;
-    float linear;
-    float quadratic;
+    float range; // no contribution past this distance
 
     vec3 ambient;
+    float constant;
     vec3 diffuse;
+    float linear;
     vec3 specular;
+    float quadratic;
 };
 
-in vec3 vertexNormal; // For incoming normals
-in vec3 vertexFragmentPos; // For incoming fragment position
-in vec2 vertexTextureCoordinate;
+// Every point light, an (offset, count) pair per cluster and the clusters' light lists, rebuilt each frame
+layout(std430, binding = 2) readonly buffer PointLights
+{
+    PointLight pointLights[];
+};
+layout(std430, binding = 3) readonly buffer LightClusters
+{
+    uvec2 clusters[];
+};
+layout(std430, binding = 4) readonly buffer LightIndices
+{
+    uint lightIndices[];
+};
+uniform ivec3 uClusterCounts; // Screen tiles across, down and depth slices
+uniform vec2 uClusterTileScale; // Tiles per pixel
+uniform vec2 uClusterDepthScaleBias; // Depth slice = log(view depth) * scale + bias
+uniform bool uClusteredLights = true; // false loops over every light, as plain forward shading does
 
-// Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 viewPosition;
-uniform sampler2D uTexture; // Useful when working with multiple textures
-uniform vec2 uvScale;
 uniform float ambientStrength = 0.1f; // Set ambient or global lighting strength
-
 uniform DirLight dirLight;
-uniform PointLight pointLights[5];
-uniform int materialDiffuse = 0;
-uniform int materialSpecular = 1;
 uniform float materialShine = 32.0f;
 
-// function prototypes
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+// Cascaded shadow maps of dirLight, one layer per cascade
+uniform bool uShadows = false;
+uniform sampler2DArrayShadow uShadowMap;
+uniform int uCascadeCount;
+uniform vec4 uCascadeEnds; // View depth where each cascade ends
+uniform mat4 uShadowMatrices[4]; // World to shadow map coordinates and depth
+uniform vec4 uShadowTexelSizes; // World size of one shadow map texel per cascade
 
-void main()
+// fraction of dirLight reaching the fragment, 3x3 PCF in the cascade covering its view depth
+float ShadowFactor(vec3 normal, vec3 fragPos, float viewDepth)
 {
-    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-    vec3 viewDir = normalize(viewPosition - vertexFragmentPos);
-
-    // phase 1: directional lighting
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
+    if (!uShadows)
+        return 1.0;
+
+    int cascade = 0;
+    while (cascade < uCascadeCount && viewDepth > uCascadeEnds[cascade])
+        cascade++;
+    if (cascade == uCascadeCount)
+        return 1.0;
+
+    // push the lookup off the surface by about a texel to keep acne away on grazing surfaces
+    vec3 offsetPos = fragPos + normal * (1.5 * uShadowTexelSizes[cascade]);
+    vec4 shadowCoord = uShadowMatrices[cascade] * vec4(offsetPos, 1.0);
+    if (shadowCoord.z >= 1.0)
+        return 1.0;
+
+    vec2 texel = 1.0 / vec2(textureSize(uShadowMap, 0).xy);
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+            lit += texture(uShadowMap, vec4(shadowCoord.xy + vec2(x, y) * texel, float(cascade), shadowCoord.z));
+    return lit / 9.0;
+}
 
-    //phase 2
-    for (int i = 0; i < 5; i++)
-        result += CalcPointLight(pointLights[i], norm, vertexFragmentPos, viewDir);
+// Cube shadows of the point lights: the atlas slot of every light, -1 for unshadowed
+uniform bool uPointShadows = false;
+uniform samplerCubeArrayShadow uPointShadowMap;
+uniform float uPointShadowTexel; // World size of one cube texel per unit of distance to the light
+layout(std430, binding = 5) readonly buffer PointShadowSlots
+{
+    int pointShadowSlots[];
+};
 
-    fragmentColor = vec4(result, 1.0); // Send lighting results to GPU
+// fraction of a point light reaching the fragment, compared against the distance stored in its cube
+float PointShadowFactor(uint index, PointLight light, vec3 normal, vec3 fragPos)
+{
+    if (!uPointShadows)
+        return 1.0;
+    int slot = pointShadowSlots[index];
+    if (slot < 0)
+        return 1.0;
+
+    // push the lookup off the surface by about a texel, which grows with the distance to the light
+    vec3 offsetPos = fragPos + normal * (1.5 * uPointShadowTexel * distance(fragPos, light.position));
+    vec3 toFragment = offsetPos - light.position;
+    return texture(uPointShadowMap, vec4(toFragment, float(slot)), length(toFragment) / light.range - 0.001);
 }
-// calculates the color when using a directional light.
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+
+// calculates the color when using a directional light; shadow scales its diffuse and specular light
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, float shadow)
 {
     vec3 lightDir = normalize(-light.direction);
 
@@ -218,15 +553,15 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), materialShine);
 
     // combine results
-    vec3 ambient = ambientStrength * light.ambient * vec3(texture(uTexture, vertexTextureCoordinate));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(uTexture, vertexTextureCoordinate));
-    vec3 specular = light.specular * spec * vec3(texture(uTexture, vertexTextureCoordinate));
+    vec3 ambient = ambientStrength * light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * albedo;
 
-    return (ambient + diffuse + specular);
+    return (ambient + shadow * (diffuse + specular));
 }
 
-// calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+// calculates the color when using a point light; shadow scales its diffuse and specular light
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float shadow)
 {
     vec3 lightDir = normalize(light.position - fragPos);
 
@@ -242,15 +577,177 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
 
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(uTexture, vertexTextureCoordinate));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(uTexture, vertexTextureCoordinate));
-    vec3 specular = light.specular * spec * vec3(texture(uTexture, vertexTextureCoordinate));
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * albedo;
 
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
 
-    return (ambient + diffuse + specular);
+    return (ambient + shadow * (diffuse + specular));
+}
+
+vec3 ShadeFragment(vec3 normal, vec3 fragPos, float viewDepth, vec3 viewDir, vec3 albedo)
+{
+    // phase 1: directional lighting
+    vec3 result = CalcDirLight(dirLight, normal, viewDir, albedo, ShadowFactor(normal, fragPos, viewDepth));
+
+    //phase 2: only the point lights assigned to this fragment's cluster
+    uint first = 0u;
+    uint count = uint(pointLights.length());
+    if (uClusteredLights)
+    {
+        ivec2 tile = min(ivec2(gl_FragCoord.xy * uClusterTileScale), uClusterCounts.xy - 1);
+        int slice = clamp(int(log(viewDepth) * uClusterDepthScaleBias.x + uClusterDepthScaleBias.y), 0, uClusterCounts.z - 1);
+        uvec2 cluster = clusters[(slice * uClusterCounts.y + tile.y) * uClusterCounts.x + tile.x];
+        first = cluster.x;
+        count = cluster.y;
+    }
+    for (uint i = 0u; i < count; i++)
+    {
+        uint index = uClusteredLights ? lightIndices[first + i] : i;
+        PointLight light = pointLights[index];
+        if (distance(light.position, fragPos) < light.range)
+            result += CalcPointLight(light, normal, fragPos, viewDir, albedo, PointShadowFactor(index, light, normal, fragPos));
+    }
+    return result;
+}
+);
+
+/* Surface texture sampling: texture array path*/
+const GLchar* arraySamplingSource = GLSL_SNIPPET(
+uniform sampler2DArray uTexture; // Every scene texture lives in one texture array
+uniform int uTextureLayer; // Layer of the array holding this object's texture
+uniform vec4 uTextureRect; // Offset (xy) and size (zw) of the texture inside its layer
+
+// samples this object's rectangle of the texture array; gradients come from the
+// unclamped coordinates so filtering matches a standalone texture
+vec4 SampleTexture()
+{
+    vec2 uv = uTextureRect.xy + clamp(vertexTextureCoordinate, 0.0, 1.0) * uTextureRect.zw;
+    vec2 scaled = vertexTextureCoordinate * uTextureRect.zw;
+    return textureGrad(uTexture, vec3(uv, float(uTextureLayer)), dFdx(scaled), dFdy(scaled));
+}
+);
+
+/* Surface texture sampling: ARB_bindless_texture path*/
+const GLchar* bindlessSamplingSource = GLSL_SNIPPET(
+layout(std430, binding = 0) readonly buffer TextureHandles
+{
+    sampler2D textureHandles[]; // Resident handles, one per texture
+};
+uniform int uTextureIndex; // Entry of the handle table for this draw
+
+vec4 SampleTexture()
+{
+    return texture(textureHandles[uTextureIndex], vertexTextureCoordinate);
+}
+);
+
+/* Depth pre-pass Shader Source Code: positions only, same transform as the surface vertex shader*/
+const GLchar* depthVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec3 position;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+struct DrawTransform
+{
+    mat4 model;
+    mat3 normal;
+};
+layout(std430, binding = 1) readonly buffer DrawTransforms
+{
+    DrawTransform draws[];
+};
+uniform int uDrawIndex;
+
+invariant gl_Position;
+
+void main()
+{
+    mat4 model = draws[uDrawIndex].model;
+    vec4 viewPos = view * model * vec4(position, 1.0f);
+    gl_Position = projection * viewPos;
+}
+);
+
+const GLchar* depthFragmentShaderSource = GLSL(440,
+void main()
+{
+}
+);
+
+/* Point light shadow Shader Source Code: one pass draws all six faces of a cube*/
+const GLchar* pointShadowVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec3 position;
+
+struct DrawTransform
+{
+    mat4 model;
+    mat3 normal;
+};
+layout(std430, binding = 1) readonly buffer DrawTransforms
+{
+    DrawTransform draws[];
+};
+uniform int uDrawIndex;
+
+void main()
+{
+    gl_Position = draws[uDrawIndex].model * vec4(position, 1.0f); // world space; the geometry shader projects per face
+}
+);
+
+const GLchar* pointShadowGeometryShaderSource = GLSL(440,
+    layout(triangles) in;
+layout(triangle_strip, max_vertices = 18) out;
+
+uniform mat4 uFaceMatrices[6]; // View-projection of every cube face
+uniform int uLayerBase; // First layer of this light's cube in the atlas
+
+out vec3 shadowWorldPos;
+
+void main()
+{
+    for (int face = 0; face < 6; face++)
+    {
+        vec4 clip[3];
+        for (int i = 0; i < 3; i++)
+            clip[i] = uFaceMatrices[face] * gl_in[i].gl_Position;
+
+        // skip the faces whose frustum the triangle misses entirely
+        bool outside = false;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            outside = outside || (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w && clip[2][axis] > clip[2].w)
+                || (clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w && clip[2][axis] < -clip[2].w);
+        }
+        if (outside)
+            continue;
+
+        for (int i = 0; i < 3; i++)
+        {
+            gl_Layer = uLayerBase + face;
+            shadowWorldPos = gl_in[i].gl_Position.xyz;
+            gl_Position = clip[i];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
+);
+
+const GLchar* pointShadowFragmentShaderSource = GLSL(440,
+    in vec3 shadowWorldPos;
+
+uniform vec3 uLightPosition;
+uniform float uLightRange;
+
+void main()
+{
+    gl_FragDepth = length(shadowWorldPos - uLightPosition) / uLightRange; // distance to the light, as the lighting compares it
 }
 );
 
@@ -288,41 +785,200 @@ void main()
 }
 );
 
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
+int main(int argc, char* argv[])
 {
-    for (int j = 0; j < height / 2; ++j)
+    // command line options
+    for (int i = 1; i < argc; ++i)
     {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
-
-        for (int i = width * channels; i > 0; --i)
+        string option = argv[i];
+        if (option == "--no-bindless")
+            textures.gAllowBindless = false; // force the texture array path
+        else if (option == "--texture-budget" && i + 1 < argc)
+            textures.gBudgetBytes = (size_t)atoi(argv[++i]) * 1024 * 1024; // texture memory budget in MB
+        else if (option == "--bench-decode")
+        {
+            // time texture decoding on the scene's images; needs no window
+            int iterations = (i + 1 < argc) ? max(atoi(argv[i + 1]), 1) : 5;
+            Textures::BenchmarkDecode(SCENE_TEXTURE_FILES, iterations);
+            return EXIT_SUCCESS;
+        }
+        else if (option == "--headless")
+            gHeadless = true; // render offscreen without a display
+        else if (option == "--frames" && i + 1 < argc)
+            gHeadlessFrames = max(atoi(argv[++i]), 1);
+        else if (option == "--output" && i + 1 < argc)
+            gHeadlessOutput = argv[++i];
+        else if (option == "--benchmark")
+        {
+            // replay a camera path at a fixed time step and report frame times
+            benchmark.gActive = true;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                benchmark.gFrames = atoi(argv[++i]);
+        }
+        else if (option == "--camera-path" && i + 1 < argc)
+            benchmark.gPathFile = argv[++i];
+        else if (option == "--benchmark-output" && i + 1 < argc)
+            benchmark.gOutputFile = argv[++i];
+        else if (option == "--record-camera-path" && i + 1 < argc)
+            gRecordPathFile = argv[++i];
+        else if (option == "--trace" && i + 1 < argc)
+            gTraceFile = argv[++i];
+        else if ((option == "--golden" || option == "--update-golden") && i + 1 < argc)
+        {
+            // compare (or rewrite) the reference images; always headless at the golden image size
+            golden.gDirectory = argv[++i];
+            golden.gUpdate = option == "--update-golden";
+            gHeadless = true;
+            gHeadlessWidth = GoldenImages::IMAGE_WIDTH;
+            gHeadlessHeight = GoldenImages::IMAGE_HEIGHT;
+        }
+        else if (option == "--golden-psnr" && i + 1 < argc)
+            golden.gMinPsnr = atof(argv[++i]);
+        else if (option == "--microbench")
+        {
+            // time mesh generation, texture decoding, matrix math and uniform uploads; needs only a context
+            gMicrobench = true;
+            gHeadless = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                microbench.gFilter = argv[++i];
+        }
+        else if (option == "--microbench-output" && i + 1 < argc)
+            microbench.gOutputFile = argv[++i];
+        else if (option == "--render-on-change")
+            framePacer.gRenderOnChange = true; // only render after input or a window change
+        else if (option == "--idle-report")
+            gIdleReport = true; // report CPU use and skipped frames on exit
+        else if (option == "--present" && i + 1 < argc)
+        {
+            // vsync (default), adaptive (tear when late) or uncapped
+            if (!FramePacer::ParsePresentMode(argv[++i], framePacer.gPresentMode))
+            {
+                std::cout << "Unknown present mode " << argv[i] << "; expected vsync, adaptive or uncapped" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--fps-limit" && i + 1 < argc)
+            framePacer.gTargetFps = atof(argv[++i]); // sleep+spin limiter; 0 turns it off
+        else if (option == "--sim-rate" && i + 1 < argc)
+            simulation.gTimeStep = 1.0 / max(atof(argv[++i]), 1.0); // simulation steps per second
+        else if (option == "--render-thread")
+            gRenderThread = true; // submit GL from a render thread; input stays on the main thread
+        else if (option == "--jobs" && i + 1 < argc)
+            gJobThreads = max(atoi(argv[++i]), 0); // worker threads besides the calling thread
+        else if (option == "--job-stats")
+            gJobStats = true; // jobs run, steals and busy share of every worker
+        else if (option == "--stress-objects" && i + 1 < argc)
+            gStressObjects = max(atoi(argv[++i]), 0); // add a field of boxes to the scene
+        else if (option == "--renderer" && i + 1 < argc)
+        {
+            // forward (every light per fragment), clustered (default) or deferred
+            string name = argv[++i];
+            int path = 0;
+            while (path < RENDER_PATH_COUNT && name != RENDER_PATH_NAMES[path])
+                ++path;
+            if (path == RENDER_PATH_COUNT)
+            {
+                std::cout << "Unknown renderer " << name << "; expected forward, clustered or deferred" << std::endl;
+                return EXIT_FAILURE;
+            }
+            gRenderPath = path;
+        }
+        else if (option == "--compare-renderers")
+            gCompareRenderers = true; // with --benchmark: run the path once per renderer
+        else if (option == "--depth-prepass" && i + 1 < argc)
+        {
+            // off (default), on, or auto: on while the measured overdraw makes it pay off
+            if (!DepthPrepass::ParseMode(argv[++i], depthPrepass.gMode))
+            {
+                std::cout << "Unknown depth pre-pass mode " << argv[i] << "; expected off, on or auto" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--prepass-min-overdraw" && i + 1 < argc)
+            depthPrepass.gMinOverdraw = atof(argv[++i]); // auto mode threshold, shaded / visible fragments
+        else if (option == "--prepass-report")
+            gPrepassReport = true;
+        else if (option == "--shadows" && i + 1 < argc)
+        {
+            string value = argv[++i];
+            if (value != "on" && value != "off")
+            {
+                std::cout << "Unknown shadow mode " << value << "; expected on or off" << std::endl;
+                return EXIT_FAILURE;
+            }
+            shadowMaps.gEnabled = value == "on";
+        }
+        else if (option == "--shadow-cache" && i + 1 < argc)
+            shadowMaps.gCacheStatic = string(argv[++i]) != "off"; // off redraws the static casters every frame
+        else if (option == "--shadow-cascades" && i + 1 < argc)
+            shadowMaps.gCascades = min(max(atoi(argv[++i]), 1), ShadowMaps::MAX_CASCADES);
+        else if (option == "--shadow-resolution" && i + 1 < argc)
+            shadowMaps.gResolution = max(atoi(argv[++i]), 64); // texels per side of every cascade
+        else if (option == "--point-shadows" && i + 1 < argc)
+        {
+            string value = argv[++i];
+            if (value != "on" && value != "off")
+            {
+                std::cout << "Unknown point shadow mode " << value << "; expected on or off" << std::endl;
+                return EXIT_FAILURE;
+            }
+            pointShadows.gEnabled = value == "on";
+        }
+        else if (option == "--point-shadow-slots" && i + 1 < argc)
+            pointShadows.gSlots = max(atoi(argv[++i]), 1); // cubes in the atlas: the most important lights get one
+        else if (option == "--point-shadow-budget" && i + 1 < argc)
+            pointShadows.gUpdateBudget = max(atoi(argv[++i]), 0); // cubes re-rendered per frame at most
+        else if (option == "--point-shadow-resolution" && i + 1 < argc)
+            pointShadows.gResolution = max(atoi(argv[++i]), 16); // texels per side of every cube face
+        else if (option == "--dynamic-resolution" && i + 1 < argc)
         {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
+            string value = argv[++i];
+            if (value != "on" && value != "off")
+            {
+                std::cout << "Unknown dynamic resolution mode " << value << "; expected on or off" << std::endl;
+                return EXIT_FAILURE;
+            }
+            dynamicResolution.gEnabled = value == "on";
         }
+        else if (option == "--target-frame-ms" && i + 1 < argc)
+            dynamicResolution.gTargetMs = (float)max(atof(argv[++i]), 1.0); // GPU frame time the resolution scale holds
+        else if (option == "--resolution-scale-min" && i + 1 < argc)
+            dynamicResolution.gMinScale = (float)atof(argv[++i]); // share of the window width and height, e.g. 0.5
+        else if (option == "--resolution-scale-max" && i + 1 < argc)
+            dynamicResolution.gMaxScale = (float)atof(argv[++i]);
+        else if (option == "--sharpness" && i + 1 < argc)
+            dynamicResolution.gSharpness = (float)max(atof(argv[++i]), 0.0); // upscale sharpening at the lowest scale
+        else if (option == "--resolution-report")
+            gResolutionReport = true;
+        else if (option == "--shadow-report")
+            gShadowReport = true; // sun and point light shadow statistics on exit
+        else if (option == "--office-lamps" && i + 1 < argc)
+            gOfficeLamps = max(atoi(argv[++i]), 0); // add a grid of small point lights around the desk
     }
-}
 
-int main(int argc, char* argv[])
-{
+    PROFILE_THREAD_NAME("main");
 
-    if (!UInitialize(argc, argv, &gWindow))
-        return EXIT_FAILURE;
+    jobs.Start(gJobThreads >= 0 ? gJobThreads : JobSystem::DefaultWorkerThreads());
 
-    // Create the shader programs
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, surfaceProgramId))
+    if (!UInitialize(argc, argv, &gWindow))
         return EXIT_FAILURE;
 
+    // Create the shader programs; the surface program waits for the textures
     if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, lampProgramId))
         return EXIT_FAILURE;
+    if (!UCreateShaderProgram(depthVertexShaderSource, depthFragmentShaderSource, depthProgramId))
+        return EXIT_FAILURE;
+    if (!UCreateShaderProgram(pointShadowVertexShaderSource, pointShadowFragmentShaderSource, pointShadowProgramId, pointShadowGeometryShaderSource))
+        return EXIT_FAILURE;
+    if (!UCreateShaderProgram(fullscreenVertexShaderSource, upscaleFragmentShaderSource, upscaleProgramId))
+        return EXIT_FAILURE;
 
     // Create the mesh
     meshes.CreateMeshes();
 
+    // Decode every scene image at once on the job system; the loads below pick them up
+    textures.PrefetchImages(jobs, SCENE_TEXTURE_FILES);
+
     // Load texture 0
     const char* textureFilename = "Wood_Texture.jpg";
     if (!UCreateTexture(textureFilename, gTexture0))
@@ -381,36 +1037,149 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
+    // Upload the loaded images: bindless handles when available, otherwise the texture array
+    if (!textures.BuildTextures())
+    {
+        cout << "Failed to build the scene textures" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // The surface shader samples through whichever texture path was built
+    string surfaceFragmentSource = UBuildSurfaceFragmentSource(fragmentShaderSource, textures.gBindless);
+    if (!UCreateShaderProgram(vertexShaderSource, surfaceFragmentSource.c_str(), surfaceProgramId))
+        return EXIT_FAILURE;
+
+    // so does the deferred geometry pass; its lighting pass only reads the G-buffer
+    string gBufferFragmentSource = UBuildSurfaceFragmentSource(gBufferFragmentShaderSource, textures.gBindless);
+    if (!UCreateShaderProgram(vertexShaderSource, gBufferFragmentSource.c_str(), gBufferProgramId))
+        return EXIT_FAILURE;
+    string deferredLightingSource = string(deferredLightingShaderSource) + lightingSource;
+    if (!UCreateShaderProgram(fullscreenVertexShaderSource, deferredLightingSource.c_str(), deferredLightingProgramId))
+        return EXIT_FAILURE;
+
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
     glUseProgram(surfaceProgramId);
 
     // We set the texture as texture unit 0
     glUniform1i(glGetUniformLocation(surfaceProgramId, "uTexture"), 0);
+    glProgramUniform1i(gBufferProgramId, glGetUniformLocation(gBufferProgramId, "uTexture"), 0);
+
+    // the G-buffer targets follow it on units 1 to 3
+    glProgramUniform1i(deferredLightingProgramId, glGetUniformLocation(deferredLightingProgramId, "gAlbedo"), GBUFFER_TEXTURE_UNIT);
+    glProgramUniform1i(deferredLightingProgramId, glGetUniformLocation(deferredLightingProgramId, "gNormal"), GBUFFER_TEXTURE_UNIT + 1);
+    glProgramUniform1i(deferredLightingProgramId, glGetUniformLocation(deferredLightingProgramId, "gDepth"), GBUFFER_TEXTURE_UNIT + 2);
+
+    // The object table refers to the meshes and texture slots created above
+    UBuildScene();
+    UBuildLights(pointLights, gOfficeLamps);
+
+    // microbenchmarks: time the hot paths instead of rendering frames
+    if (gMicrobench)
+    {
+        if (!URunMicroBenchmarks())
+            return EXIT_FAILURE;
+    }
+    // golden images: render every pose and compare it with its reference
+    else if (!golden.gDirectory.empty())
+    {
+        if (!URunGoldenImages())
+            return EXIT_FAILURE;
+    }
+    // benchmark: replay the camera path; otherwise headless renders a fixed number of frames
+    else if (benchmark.gActive)
+    {
+        if (!URunBenchmark())
+            return EXIT_FAILURE;
+    }
+    else if (gHeadless)
+    {
+        for (int frame = 0; frame < gHeadlessFrames; ++frame)
+        {
+            deltaTime = HEADLESS_FRAME_TIME;
+            URender();
+        }
+    }
+
+    // headless: write the last frame
+    if (gHeadless && !gMicrobench && golden.gDirectory.empty() && !headless.WriteImage(gHeadlessOutput.c_str()))
+        return EXIT_FAILURE;
 
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(gWindow))
+    simulation.Reset({ cameraPos, yaw, pitch, 0.0 });
+    if (!gHeadless)
+    {
+        lastFrame = static_cast<float>(glfwGetTime()); // setup time is not simulated
+        framePacer.Start();
+    }
+    if (gRenderThread && !gHeadless && !benchmark.gActive)
+        renderThread.Start(gWindow, URenderPacket);
+    while (!gHeadless && !benchmark.gActive && !glfwWindowShouldClose(gWindow))
     {
+        PROFILE_ZONE("frame");
+
+        // hold the frame back to the --fps-limit rate before any input is sampled
+        framePacer.WaitForFrameDeadline();
+
+        // input, sampled as late as possible before rendering
+        // -----
+        glfwPollEvents();
+
         // per-frame time logic
         // --------------------
         float currentFrame = static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        // input
-        // -----
         UProcessInput(gWindow);
 
-        // Render this frame
-        // Turn on wireframe mode
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); //use wireframe for QA GL_FILL for off GL_LINE for on
-        URender();
-
-        glfwPollEvents();
-    }
+        // advance the simulation in whole steps, then place the camera between the last two
+        simulation.Advance(deltaTime, UStepSimulation);
+        Simulation::State state = simulation.Interpolated();
 
-    //delete the meshes
-    meshes.DestroyMeshes();
+        // held movement keys keep the scene rendering until the camera settles, and so does
+        // render work that completes over several frames (texture reloads, deferred shadow cubes)
+        if (simulation.Moving() || gRenderWorkPending)
+            framePacer.MarkDirty();
+
+        // nothing changed: keep the last frame on screen and sleep until an event arrives
+        if (!framePacer.ShouldRender())
+        {
+            framePacer.WaitForEvents();
+            lastFrame = static_cast<float>(glfwGetTime()); // the wait is not part of the next frame's deltaTime
+            continue;
+        }
+
+        // Render this frame: hand it to the render thread, or draw it here
+        FramePacket packet;
+        packet.cameraPosition = state.cameraPosition;
+        packet.yaw = state.yaw;
+        packet.pitch = state.pitch;
+        glfwGetFramebufferSize(gWindow, &packet.framebufferWidth, &packet.framebufferHeight);
+        packet.commands = gRenderCommands;
+        gRenderCommands = 0;
+
+        if (renderThread.Running())
+            renderThread.Submit(packet);
+        else
+            URenderPacket(packet);
+        framePacer.FrameRendered();
+    }
+    renderThread.Stop();
+    framePacer.Stop();
+
+    // report what render-on-change saved
+    if (!gHeadless && !benchmark.gActive && (framePacer.gRenderOnChange || gIdleReport))
+        framePacer.PrintIdleReport();
+
+    // save the recorded camera path
+    if (!gRecordPathFile.empty())
+        benchmark.SavePath(gRecordPathFile.c_str());
+
+    //delete the meshes and the per-draw matrices
+    meshes.DestroyMeshes();
+    glDeleteBuffers(1, &gDrawTransformBuffer);
+    pointLights.Destroy();
 
     // Release textures
     UDestroyTexture(gTexture0);
@@ -421,11 +1190,48 @@ int main(int argc, char* argv[])
     UDestroyTexture(gTexture5);
     UDestroyTexture(gTexture6);
     UDestroyTexture(gTexture7);
-    
+    textures.DestroyTextures();
+
+    // Release the GPU timer and overdraw queries
+    gpuProfiler.Destroy();
+    if (gPrepassReport)
+        depthPrepass.WriteJson(cout);
+    depthPrepass.Destroy();
+    gBuffer.Destroy();
+    if (gShadowReport)
+    {
+        shadowMaps.WriteJson(cout);
+        pointShadows.WriteJson(cout);
+    }
+    shadowMaps.Destroy();
+    pointShadows.Destroy();
+    if (gResolutionReport)
+        dynamicResolution.WriteJson(cout);
+    dynamicResolution.Destroy();
 
     // Release shader program
     UDestroyShaderProgram(surfaceProgramId);
     UDestroyShaderProgram(lampProgramId);
+    UDestroyShaderProgram(depthProgramId);
+    UDestroyShaderProgram(pointShadowProgramId);
+    UDestroyShaderProgram(upscaleProgramId);
+    UDestroyShaderProgram(gBufferProgramId);
+    UDestroyShaderProgram(deferredLightingProgramId);
+
+    // Release the offscreen context
+    if (gHeadless)
+        headless.Destroy();
+
+    if (gJobStats)
+    {
+        jobs.WriteStats(cout);
+        cout << endl;
+    }
+    jobs.Stop();
+
+    // Export the CPU zones recorded during the run
+    if (!gTraceFile.empty() && !PROFILE_WRITE_TRACE(gTraceFile.c_str()))
+        cout << "No CPU trace written; zones are compiled out of release builds unless PROFILE_ZONES is defined" << endl;
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
@@ -434,37 +1240,60 @@ int main(int argc, char* argv[])
 // Initialize GLFW, GLEW, and create a window
 bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 {
-    // GLFW: initialize and configure
-    // ------------------------------
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // Headless: no GLFW, window, callbacks or cursor capture; the scene renders into a framebuffer object
+    if (gHeadless)
+    {
+        *window = nullptr;
+        if (!headless.CreateContext(gHeadlessWidth, gHeadlessHeight))
+            return false;
+    }
+    else
+    {
+        // GLFW: initialize and configure
+        // ------------------------------
+        if (!glfwInit())
+        {
+            std::cout << "Failed to initialize GLFW" << std::endl;
+            return false;
+        }
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
-    // GLFW: window creation
-    // ---------------------
-    * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
-    if (*window == NULL)
-    {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return false;
+        // GLFW: window creation
+        // ---------------------
+        * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+        if (*window == NULL)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return false;
+        }
+        glfwMakeContextCurrent(*window);
+        glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+        glfwSetWindowRefreshCallback(*window, URefreshWindow);
+
+        // vsync, adaptive vsync or uncapped (--present)
+        framePacer.ApplyPresentMode();
+
+        // the rate a continuous loop would render at, for the idle report
+        const GLFWvidmode* videoMode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+        if (videoMode)
+            framePacer.gRefreshRate = videoMode->refreshRate;
+
+        //Register the new callbacks
+        glfwSetCursorPosCallback(*window, mouseCallback);
+        glfwSetScrollCallback(*window, scrollCallback);
+        glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+        glfwSetKeyCallback(*window, keyCallback);
+
+        // tell GLFW to capture our mouse
+        glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     }
-    glfwMakeContextCurrent(*window);
-    glfwSetFramebufferSizeCallback(*window, UResizeWindow);
-
-    //Register the new callbacks
-    glfwSetCursorPosCallback(*window, mouseCallback);
-    glfwSetScrollCallback(*window, scrollCallback);
-    glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
-    glfwSetKeyCallback(*window, keyCallback);
-
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     // GLEW: initialize
     // ----------------
@@ -472,6 +1301,12 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     glewExperimental = GL_TRUE;
     GLenum GlewInitResult = glewInit();
 
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // GLEW built for GLX reports a missing X display under EGL, after it has loaded the GL entry points
+    if (gHeadless && GlewInitResult == GLEW_ERROR_NO_GLX_DISPLAY)
+        GlewInitResult = GLEW_OK;
+#endif
+
     if (GLEW_OK != GlewInitResult)
     {
         std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
@@ -481,6 +1316,9 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     // Displays GPU OpenGL version
     cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
 
+    if (gHeadless && !headless.CreateRenderTarget(gHeadlessWidth, gHeadlessHeight))
+        return false;
+
     return true;
 }
 
@@ -488,35 +1326,49 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 void UProcessInput(GLFWwindow* window)
 {
+    PROFILE_FUNCTION();
+
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
+}
+
+
+// one fixed simulation step: held keys move the camera by the same amount every step
+void UStepSimulation(Simulation::State& state, double timeStep)
+{
+    // the orthographic view looks down -z from the z axis (see URender)
+    if (orthoOn)
+    {
+        state.cameraPosition = glm::vec3(0.0f, 0.0f, state.cameraPosition.z);
+        state.yaw = -90;
+        state.pitch = 0;
+    }
+
     //TODO
     //WASD Keys to pan Left, Tight, forward, back
-    float cameraSpeed = static_cast<float>(25 * deltaTime * sensitivity);
+    float cameraSpeed = static_cast<float>(25 * timeStep * sensitivity);
     glm::vec3 front;
-
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        cameraPos += cameraSpeed * cameraFront;
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        cameraPos -= cameraSpeed * cameraFront;
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
-        pitch += cameraSpeed * 5;
-        front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-        front.y = sin(glm::radians(pitch));
-        front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-        cameraFront = glm::normalize(front);
-    }
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
-        pitch -= cameraSpeed * 5;
-        front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-        front.y = sin(glm::radians(pitch));
-        front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-        cameraFront = glm::normalize(front);
-    }
+    front.x = cos(glm::radians(state.yaw)) * cos(glm::radians(state.pitch));
+    front.y = sin(glm::radians(state.pitch));
+    front.z = sin(glm::radians(state.yaw)) * cos(glm::radians(state.pitch));
+    front = glm::normalize(front);
+
+    if (glfwGetKey(gWindow, GLFW_KEY_W) == GLFW_PRESS)
+        state.cameraPosition += cameraSpeed * front;
+    if (glfwGetKey(gWindow, GLFW_KEY_S) == GLFW_PRESS)
+        state.cameraPosition -= cameraSpeed * front;
+    if (glfwGetKey(gWindow, GLFW_KEY_A) == GLFW_PRESS)
+        state.cameraPosition -= glm::normalize(glm::cross(front, cameraUp)) * cameraSpeed;
+    if (glfwGetKey(gWindow, GLFW_KEY_D) == GLFW_PRESS)
+        state.cameraPosition += glm::normalize(glm::cross(front, cameraUp)) * cameraSpeed;
+    if (glfwGetKey(gWindow, GLFW_KEY_Q) == GLFW_PRESS)
+        state.pitch += cameraSpeed * 5;
+    if (glfwGetKey(gWindow, GLFW_KEY_E) == GLFW_PRESS)
+        state.pitch -= cameraSpeed * 5;
+
+    // record the camera for later benchmark runs, one key per step
+    if (!gRecordPathFile.empty())
+        benchmark.Record({ state.cameraPosition, state.yaw, state.pitch });
 }
 
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -533,6 +1385,29 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
             orthoOn = true;
             cout << "Ortho State: " << orthoOn << endl;
         }
+        framePacer.MarkDirty();
+    }
+
+    //cycle the render path: forward, clustered forward, deferred
+    if (key == GLFW_KEY_R && action == GLFW_PRESS)
+    {
+        gRenderPath = (gRenderPath + 1) % RENDER_PATH_COUNT;
+        cout << "Renderer: " << RENDER_PATH_NAMES[gRenderPath] << endl;
+        framePacer.MarkDirty();
+    }
+
+    //print the texture memory estimate and residency of every texture (where the GL state lives)
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+    {
+        gRenderCommands |= FramePacket::PRINT_TEXTURE_RESIDENCY;
+        framePacer.MarkDirty(); // commands run with the next frame
+    }
+
+    //print the rolling GPU time of every render section
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+    {
+        gRenderCommands |= FramePacket::PRINT_GPU_PROFILE;
+        framePacer.MarkDirty();
     }
 }
 
@@ -574,21 +1449,10 @@ void mouseCallback(GLFWwindow* window, double xposIn, double yposIn)
     xoffset *= sensitivity;
     yoffset *= sensitivity;
 
-    yaw += xoffset;
-    pitch += yoffset;
-
-    // make sure that when pitch is out of bounds, screen doesn't get flipped
-    if (pitch > 89.0f)
-        pitch = 89.0f;
-    if (pitch < -89.0f)
-        pitch = -89.0f;
-
-    glm::vec3 front;
-    front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-    front.y = sin(glm::radians(pitch));
-    front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-    cameraFront = glm::normalize(front);
+    // turn the simulated camera directly; pitch is clamped so the screen doesn't get flipped
+    simulation.Turn(xoffset, yoffset);
 
+    framePacer.MarkDirty();
 }
 
 // glfw: handle mouse button events
@@ -635,686 +1499,516 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
-    glViewport(0, 0, width, height);
+    // the viewport follows the framebuffer size sent with every frame packet
+    framePacer.MarkDirty();
 }
 
-// Functioned called to render a frame
-void URender()
+// glfw: the window contents were damaged (uncovered, restored) and need drawing again
+void URefreshWindow(GLFWwindow* window)
 {
-    glm::mat4 scale;
-    glm::mat4 rotation;
-    glm::mat4 translation;
-    glm::mat4 model;
-    glm::mat4 view;
-    glm::mat4 worldView;
-    GLint modelLoc;
-    GLint viewLoc;
-    GLint projLoc;
-    GLint objectColorLoc;
-
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
-
-    // Clear the frame and z buffers
-    glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    framePacer.MarkDirty();
+}
 
-    // Transforms the camera: move the camera back (z axis)
-    view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+// Fill the scene's object table and transform hierarchy: grouped props hang under one node each, so they move as a whole
+void UBuildScene()
+{
+    using Object = DrawListBuilder::SceneObject;
+    using Node = TransformHierarchy::Node;
+    const Node root = TransformHierarchy::NO_PARENT;
+    const glm::mat4 identity(1.0f);
+    const glm::mat4 standUp = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
+    const glm::mat4 standUpSideways = glm::rotate(standUp, glm::radians(90.0f), glm::vec3(0.0, 0.0f, 1.0f));
+    const glm::vec4 white(1.0f, 1.0f, 1.0f, 1.0f), green(0.0f, 1.0f, 0.0f, 1.0f), black(0.0f, 0.0f, 0.0f, 1.0f), darkGreen(0.0f, 0.5f, 0.0f, 1.0f);
+
+    vector<Object>& objects = drawList.gObjects;
+    TransformHierarchy& nodes = sceneTransforms;
+    objects.clear();
+    nodes.Clear();
 
-    if (orthoOn) {
-        cameraPos = glm::vec3(0.0f, 0.0f, cameraPos.z);
+    //Create a Plane for Desk
+    objects.push_back(Object{ SECTION_DESK, &meshes.gPlaneMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture0, glm::vec4(gObjectColor, 1.0f),
+        nodes.AddNode(root, glm::vec3(0.0f, 0.0f, 0.0f), identity, glm::vec3(7.5f, 1.0f, 6.0f)), false });
+
+    //Below 2 shapes will be creating a globe: tapered cylinder stand and sphere
+    Node globe = nodes.AddNode(root, glm::vec3(5.5f, 0.0f, -2.0f));
+    objects.push_back(Object{ SECTION_GLOBE, &meshes.gTaperedCylinderMesh, DrawListBuilder::DRAW_CYLINDER, &gTexture2, white,
+        nodes.AddNode(globe, glm::vec3(0.0f, 0.0f, 0.0f)), false });
+    objects.push_back(Object{ SECTION_GLOBE, &meshes.gSphereMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture1, green,
+        nodes.AddNode(globe, glm::vec3(0.0f, 1.2f, 0.0f)), false });
+
+    //Below shape is for creating a decorative cup: cylinder and another cylinder for its top
+    Node cup = nodes.AddNode(root, glm::vec3(-4.5f, 0.0f, -1.5f));
+    objects.push_back(Object{ SECTION_CUP, &meshes.gCylinderMesh, DrawListBuilder::DRAW_CYLINDER, &gTexture3, black,
+        nodes.AddNode(cup, glm::vec3(0.0f, 0.0f, 0.0f), identity, glm::vec3(1.0f, 4.0f, 1.0f)), false });
+    objects.push_back(Object{ SECTION_CUP, &meshes.gCylinderMesh, DrawListBuilder::DRAW_CYLINDER, &gTexture3, black,
+        nodes.AddNode(cup, glm::vec3(0.0f, 4.0f, 0.0f), identity, glm::vec3(1.1f, 0.5f, 1.1f)), false });
+
+    //Below shape is for creating Hard Drive: plane for the cover and a cube
+    Node hardDrive = nodes.AddNode(root, glm::vec3(-4.2f, 0.0f, 4.5f));
+    objects.push_back(Object{ SECTION_HARD_DRIVE, &meshes.gPlaneMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture4, black,
+        nodes.AddNode(hardDrive, glm::vec3(0.0f, 0.56f, 0.0f), identity, glm::vec3(1.0f, 0.5f, 1.5f)), false });
+    objects.push_back(Object{ SECTION_HARD_DRIVE, &meshes.gBoxMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture3, darkGreen,
+        nodes.AddNode(hardDrive, glm::vec3(0.0f, 0.3f, 0.0f), identity, glm::vec3(2.0f, 0.5f, 3.0f)), false });
+
+    //Below shapes are for Nintendo Switch Dock: base, front and back cubes
+    Node dock = nodes.AddNode(root, glm::vec3(1.0f, 0.0f, -2.5f));
+    objects.push_back(Object{ SECTION_SWITCH_DOCK, &meshes.gBoxMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture3, darkGreen,
+        nodes.AddNode(dock, glm::vec3(0.0f, 0.3f, 0.0f), identity, glm::vec3(4.5f, 0.5f, 2.0f)), false });
+    objects.push_back(Object{ SECTION_SWITCH_DOCK, &meshes.gBoxMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture7, darkGreen,
+        nodes.AddNode(dock, glm::vec3(0.0f, 1.8f, 0.9f), identity, glm::vec3(4.5f, 2.5f, 0.2f)), false });
+    objects.push_back(Object{ SECTION_SWITCH_DOCK, &meshes.gBoxMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture7, darkGreen,
+        nodes.AddNode(dock, glm::vec3(0.0f, 1.8f, -0.6f), identity, glm::vec3(4.5f, 2.5f, 0.8f)), false });
+
+    //Planes for the Switch front and back covers
+    objects.push_back(Object{ SECTION_SWITCH_DOCK, &meshes.gPlaneMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture5, darkGreen,
+        nodes.AddNode(dock, glm::vec3(0.0f, 1.55f, 1.01f), standUp, glm::vec3(2.25f, 0.5f, 1.5f)), false });
+    objects.push_back(Object{ SECTION_SWITCH_DOCK, &meshes.gPlaneMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture6, darkGreen,
+        nodes.AddNode(dock, glm::vec3(0.0f, 1.55f, -1.02f), standUp, glm::vec3(2.25f, 0.5f, 1.5f)), false });
+
+    //Planes for the Switch sides cover, relative to the dock
+    const glm::vec3 sideScales[] = { glm::vec3(0.4f, 0.5f, 1.5f), glm::vec3(0.4f, 0.5f, 1.5f), glm::vec3(0.1f, 0.5f, 1.5f),
+        glm::vec3(0.1f, 0.5f, 1.5f), glm::vec3(0.7f, 0.1f, 0.3f), glm::vec3(0.7f, 0.1f, 0.3f) };
+    const glm::vec3 sidePositions[] = { glm::vec3(-2.26f, 1.55f, -0.6f), glm::vec3(2.26f, 1.55f, -0.6f), glm::vec3(-2.26f, 1.55f, 0.9f),
+        glm::vec3(2.26f, 1.55f, 0.9f), glm::vec3(2.26f, 0.3f, 0.2f), glm::vec3(-2.254f, 0.3f, 0.2f) };
+    for (int i = 0; i < 6; ++i)
+        objects.push_back(Object{ SECTION_SWITCH_DOCK, &meshes.gPlaneMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture7, darkGreen,
+            nodes.AddNode(dock, sidePositions[i], standUpSideways, sideScales[i]), false });
+
+    //stress test: a field of small boxes under the desk (--stress-objects)
+    UAddStressObjects(objects, nodes, gStressObjects);
+}
 
-        glm::vec3 front;
-        yaw = -90;
-        pitch = 0;
 
-        front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-        front.y = sin(glm::radians(pitch));
-        front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-        cameraFront = glm::normalize(front);
+// A grid of small boxes under one field node, for scaling tests; moving the field dirties every box; returns the field node (NO_PARENT without boxes)
+TransformHierarchy::Node UAddStressObjects(vector<DrawListBuilder::SceneObject>& objects, TransformHierarchy& nodes, int count)
+{
+    if (count <= 0)
+        return TransformHierarchy::NO_PARENT;
 
-        projection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 0.1f, 100.0f); //use the orthographic projection for QA
+    TransformHierarchy::Node field = nodes.AddNode(TransformHierarchy::NO_PARENT, glm::vec3(0.0f, -2.0f, 0.0f));
+    int side = max(1, (int)ceil(sqrt((double)count)));
+    for (int i = 0; i < count; ++i)
+    {
+        glm::vec3 position(((i % side) - side * 0.5f) * STRESS_SPACING, 0.0f, ((i / side) - side * 0.5f) * STRESS_SPACING);
+        objects.push_back(DrawListBuilder::SceneObject{ SECTION_STRESS, &meshes.gBoxMesh, DrawListBuilder::DRAW_ELEMENTS, &gTexture3,
+            glm::vec4(0.0f, 0.5f, 0.0f, 1.0f), nodes.AddNode(field, position, glm::mat4(1.0f), glm::vec3(STRESS_SPACING * 0.5f)), true });
     }
-    else
-        projection = glm::perspective(glm::radians(fov), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    return field;
+}
 
-    // Set the shader to be used
-    glUseProgram(surfaceProgramId);
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(surfaceProgramId, "model");
-    viewLoc = glGetUniformLocation(surfaceProgramId, "view");
-    projLoc = glGetUniformLocation(surfaceProgramId, "projection");
-    objectColorLoc = glGetUniformLocation(surfaceProgramId, "uObjectColor");
+// Write the sorted draws' matrices into the per-draw buffer, orphaning last frame's copy so mapping never waits
+void UUploadDrawTransforms()
+{
+    PROFILE_FUNCTION();
 
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    size_t size = max<size_t>(drawList.Items().size(), 1) * sizeof(DrawListBuilder::DrawTransform);
 
-    //Create a Plane for Desk
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
+    if (gDrawTransformBuffer == 0)
+        glGenBuffers(1, &gDrawTransformBuffer);
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(7.5f, 1.0f, 6.0f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(0.0f, 0.0f, 0.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gDrawTransformBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped)
+        drawList.WriteTransforms(jobs, sceneTransforms, (DrawListBuilder::DrawTransform*)mapped);
+    if (!mapped || !glUnmapBuffer(GL_SHADER_STORAGE_BUFFER))
+    {
+        gDrawTransformFallback.resize(drawList.Items().size());
+        drawList.WriteTransforms(jobs, sceneTransforms, gDrawTransformFallback.data());
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gDrawTransformFallback.size() * sizeof(DrawListBuilder::DrawTransform), gDrawTransformFallback.data());
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_TRANSFORM_BINDING, gDrawTransformBuffer);
+}
 
-    //set camera position
-    glGetUniformLocation(surfaceProgramId, "cameraPos");
 
-    //camera
-    GLint viewPositionLoc = glGetUniformLocation(surfaceProgramId, "viewPosition");
+// Issue the sorted draw list; VAO and texture are only rebound when they change
+void USubmitDrawList(GLuint programId, GLint drawIndexLoc)
+{
+    PROFILE_FUNCTION();
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
+    int section = -1;
+    const Meshes::GLMesh* boundMesh = nullptr;
+    const Textures::TextureSlot* boundTexture = nullptr;
 
-    const glm::vec3 cameraPosition = cameraPos;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    const vector<DrawListBuilder::DrawItem>& items = drawList.Items();
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const DrawListBuilder::SceneObject& object = *items[i].object;
 
-    GLint UVScaleLoc = glGetUniformLocation(surfaceProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+        if (object.section != section)
+        {
+            section = object.section;
+            gpuProfiler.Begin(SCENE_SECTION_NAMES[section]);
+        }
+        // Activate the VBOs contained within the mesh's VAO
+        if (object.mesh != boundMesh)
+        {
+            glBindVertexArray(object.mesh->vao);
+            boundMesh = object.mesh;
+        }
+        // select the texture inside the texture array
+        if (object.texture != boundTexture)
+        {
+            USetTextureSlot(programId, *object.texture);
+            boundTexture = object.texture;
+        }
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture0);
+        glUniform1i(drawIndexLoc, (GLint)i);
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+        // Draws the triangles
+        UDrawObjectMesh(object);
+    }
 
     // Deactivate the Vertex Array Object
     glBindVertexArray(0);
+}
 
-    
-    //Below 2 shapes will be creating a globe
-    //Create Tapered Cylinder
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gTaperedCylinderMesh.vao);
-
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(1.0f, 1.0f, 1.0f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(5.5f, 0.0f, -2.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-    glProgramUniform4f(surfaceProgramId, objectColorLoc, 1.0f, 1.0f, 1.0f, 1.0f);
+// Draws the triangles of one object with whichever of its mesh's VAOs is bound
+void UDrawObjectMesh(const DrawListBuilder::SceneObject& object)
+{
+    if (object.kind == DrawListBuilder::DRAW_CYLINDER)
+    {
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
+        glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
+        glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+        gDrawCalls += 3;
+    }
+    else
+    {
+        glDrawElements(GL_TRIANGLES, object.mesh->nIndices, GL_UNSIGNED_INT, (void*)0);
+        gDrawCalls++;
+    }
+}
 
-    //camera
-    viewPositionLoc = glGetUniformLocation(surfaceProgramId, "viewPosition");
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture2);
+// Depth-only pass over the sorted draw list through the meshes' position-only streams
+void USubmitDepthPrepass(const glm::mat4& view)
+{
+    PROFILE_FUNCTION();
+
+    gpuProfiler.Begin("depth prepass");
+    glUseProgram(depthProgramId);
+    glUniformMatrix4fv(glGetUniformLocation(depthProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(depthProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    GLint drawIndexLoc = glGetUniformLocation(depthProgramId, "uDrawIndex");
+
+    depthPrepass.BeginDepthPass();
+    const Meshes::GLMesh* boundMesh = nullptr;
+    const vector<DrawListBuilder::DrawItem>& items = drawList.Items();
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const DrawListBuilder::SceneObject& object = *items[i].object;
+        if (object.mesh != boundMesh)
+        {
+            glBindVertexArray(object.mesh->depthVao);
+            boundMesh = object.mesh;
+        }
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-    glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-    glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+        glUniform1i(drawIndexLoc, (GLint)i);
+        UDrawObjectMesh(object);
+    }
+    depthPrepass.EndDepthPass();
 
-    // Deactivate the Vertex Array Object
     glBindVertexArray(0);
+    gpuProfiler.End();
+}
 
-    //Create Sphere
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gSphereMesh.vao);
-
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(1.0f, 1.0f, 1.0f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(5.5f, 1.2f, -2.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    glProgramUniform4f(surfaceProgramId, objectColorLoc, 0.0f, 1.0f, 0.0f, 1.0f);
-
-    //camera
-    viewPositionLoc = glGetUniformLocation(surfaceProgramId, "viewPosition");
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture1);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
 
-    //Below shape is for creating a decorative cup
-    //Creates a Cylinder
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gCylinderMesh.vao);
+// Shadow passes through the position-only streams: the sun's stale cascades, then the cubes of the point lights
+// the scheduler picks; both are then bound to the program that shades the frame
+void URenderShadows(const glm::mat4& view, GLuint programId)
+{
+    PROFILE_FUNCTION();
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(1.0f, 4.0f, 1.0f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(-4.5f, 0.0f, -1.5f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    auto drawCaster = [](const DrawListBuilder::SceneObject& object)
+    {
+        glBindVertexArray(object.mesh->depthVao);
+        UDrawObjectMesh(object);
+    };
 
-    glProgramUniform4f(surfaceProgramId, objectColorLoc, 0.0f, 0.0f, 0.0f, 1.0f);
+    gpuProfiler.Begin("shadows");
+    shadowMaps.Render(drawList.gObjects, sceneTransforms, sunDirection, view, projection, 0.1f, depthProgramId, DRAW_TRANSFORM_BINDING, drawCaster);
+    gpuProfiler.Begin("point shadows");
+    pointShadows.Render(pointLights.gLights, drawList.gObjects, sceneTransforms, view, projection, pointShadowProgramId, DRAW_TRANSFORM_BINDING, drawCaster);
+    gpuProfiler.End();
 
-    //camera
-    viewPositionLoc = glGetUniformLocation(surfaceProgramId, "viewPosition");
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    shadowMaps.Bind(programId, SHADOW_TEXTURE_UNIT);
+    pointShadows.Bind(programId, POINT_SHADOW_TEXTURE_UNIT);
+}
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture3);
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-    glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-    glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+// Lights every covered G-buffer pixel in one full-screen pass and writes its depth for the lamps drawn next
+void UDeferredLighting(const glm::mat4& view, const glm::vec3& cameraPosition)
+{
+    PROFILE_FUNCTION();
+
+    gpuProfiler.Begin("deferred lighting");
+    glUseProgram(deferredLightingProgramId);
+    glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+    glUniformMatrix4fv(glGetUniformLocation(deferredLightingProgramId, "inverseViewProjection"), 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+    glUniformMatrix4fv(glGetUniformLocation(deferredLightingProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniform2f(glGetUniformLocation(deferredLightingProgramId, "viewportSize"), (GLfloat)gBuffer.gWidth, (GLfloat)gBuffer.gHeight);
+    glUniform3f(glGetUniformLocation(deferredLightingProgramId, "viewPosition"), cameraPosition.x, cameraPosition.y, cameraPosition.z);
+
+    // every pixel is written once, with its G-buffer depth
+    gBuffer.BindTextures(GBUFFER_TEXTURE_UNIT);
+    glDepthFunc(GL_ALWAYS);
+    gBuffer.DrawFullscreen();
+    glDepthFunc(GL_LESS);
+    gDrawCalls++;
+    gpuProfiler.End();
+}
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
 
-    //Another Cylinder for top of the cup
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gCylinderMesh.vao);
+// Draw one interactive frame from its packet; runs on the render thread when there is one
+void URenderPacket(const FramePacket& packet)
+{
+    PROFILE_FUNCTION();
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(1.1f, 0.5f, 1.1f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(-4.5f, 4.0f, -1.5f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    static int viewportWidth = 0, viewportHeight = 0;
+    if (packet.framebufferWidth != viewportWidth || packet.framebufferHeight != viewportHeight)
+    {
+        viewportWidth = packet.framebufferWidth;
+        viewportHeight = packet.framebufferHeight;
+        glViewport(0, 0, viewportWidth, viewportHeight);
+    }
 
-    glProgramUniform4f(surfaceProgramId, objectColorLoc, 0.0f, 0.0f, 0.0f, 1.0f);
+    if (packet.commands & FramePacket::PRINT_TEXTURE_RESIDENCY)
+        textures.PrintResidency();
+    if (packet.commands & FramePacket::PRINT_GPU_PROFILE)
+        gpuProfiler.Print();
 
-    //camera
-    viewPositionLoc = glGetUniformLocation(surfaceProgramId, "viewPosition");
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    USetCamera({ packet.cameraPosition, packet.yaw, packet.pitch });
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture3);
+    // Turn on wireframe mode
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); //use wireframe for QA GL_FILL for off GL_LINE for on
+    URender();
+}
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-    glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-    glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+// Functioned called to render a frame
+void URender()
+{
+    PROFILE_FUNCTION();
 
-    //Below shape is for creating Hard Drive
-    // //Create a Plane for HD Cover
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
+    glm::mat4 model;
+    glm::mat4 view;
+    glm::mat4 worldView;
+    GLint modelLoc;
+    GLint drawIndexLoc;
+    GLint viewLoc;
+    GLint projLoc;
+    GLint objectColorLoc;
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(1.0f, 0.5f, 1.5f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(-4.2f, 0.56f, 4.5f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
+    // start a new frame for texture LRU tracking, draw-call counting and GPU timing
+    textures.BeginFrame();
+    gDrawCalls = 0;
+    gpuProfiler.BeginFrame();
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    // headless frames render into the offscreen framebuffer
+    if (gHeadless)
+        headless.BindRenderTarget();
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture4);
+    // below full resolution when the GPU is behind its frame time target; upscaled before the swap
+    dynamicResolution.BeginFrame();
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-    //Creates a Cube
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gBoxMesh.vao);
+    // Clear the frame and z buffers
+    gpuProfiler.Begin("clear");
+    glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(2.0f, 0.5f, 3.0f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(-4.2f, 0.3f, 4.5f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    // Transforms the camera: move the camera back (z axis)
+    view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
 
-    glProgramUniform4f(surfaceProgramId, objectColorLoc, 0.0f, 0.5f, 0.0f, 1.0f);
+    if (orthoOn) {
+        cameraPos = glm::vec3(0.0f, 0.0f, cameraPos.z);
 
-    //camera
-    viewPositionLoc = glGetUniformLocation(surfaceProgramId, "viewPosition");
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+        glm::vec3 front;
+        yaw = -90;
+        pitch = 0;
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture3);
+        front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+        front.y = sin(glm::radians(pitch));
+        front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+        cameraFront = glm::normalize(front);
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+        projection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 0.1f, 100.0f); //use the orthographic projection for QA
+    }
+    else
+        projection = glm::perspective(glm::radians(fov), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    // Set the shader to be used: the deferred path draws the objects into the G-buffer instead of shading them
+    const RenderPath renderPath = (RenderPath)gRenderPath.load();
+    const bool deferred = renderPath == RENDER_DEFERRED;
+    GLuint drawProgramId = deferred ? gBufferProgramId : surfaceProgramId;
+    glUseProgram(drawProgramId);
 
-    //Below shapes are for Nintendo Switch Dock
-    //Creates a Cube for base dock
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gBoxMesh.vao);
+    // Retrieves and passes transform matrices to the Shader program
+    drawIndexLoc = glGetUniformLocation(drawProgramId, "uDrawIndex");
+    viewLoc = glGetUniformLocation(drawProgramId, "view");
+    projLoc = glGetUniformLocation(drawProgramId, "projection");
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(4.5f, 0.5f, 2.0f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 2.5f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(1.0f, 0.3f, -2.5f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-    glProgramUniform4f(surfaceProgramId, objectColorLoc, 0.0f, 0.5f, 0.0f, 1.0f);
+    // one texture bind for the whole scene (none in bindless mode); objects pick their texture through uniforms
+    textures.BindTextures(0);
 
     //camera
-    viewPositionLoc = glGetUniformLocation(surfaceProgramId, "viewPosition");
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture3);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    //Creates a Cube for Front dock
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gBoxMesh.vao);
+    GLint viewPositionLoc = glGetUniformLocation(surfaceProgramId, "viewPosition");
+    const glm::vec3 cameraPosition = cameraPos;
+    glProgramUniform3f(surfaceProgramId, viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(4.5f, 2.5f, 0.2f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(1.0f, 1.8f, -1.6f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    GLint UVScaleLoc = glGetUniformLocation(drawProgramId, "uvScale");
+    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
 
-    glProgramUniform4f(surfaceProgramId, objectColorLoc, 0.0f, 0.5f, 0.0f, 1.0f);
+    // update moved transforms, cull and sort the objects on the job workers, then draw them here
+    sceneTransforms.Update(jobs);
+    drawList.Build(jobs, sceneTransforms, projection * view);
 
-    //camera
-    viewPositionLoc = glGetUniformLocation(surfaceProgramId, "viewPosition");
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    //create the light casters: bin the point lights into clusters before any surface is shaded
+    const GLuint shadingProgramId = deferred ? deferredLightingProgramId : surfaceProgramId;
+    CreateLights(view, shadingProgramId, renderPath != RENDER_FORWARD);
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture7);
+    // redraw the stale shadow maps of the sun and the point lights; this borrows the per-draw matrix binding
+    URenderShadows(view, shadingProgramId);
+    glUseProgram(drawProgramId);
+    UUploadDrawTransforms();
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    if (deferred)
+    {
+        // geometry pass into the G-buffer, then one full-screen lighting pass into the frame
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        if (gBuffer.BeginGeometryPass(viewport[2], viewport[3]))
+        {
+            USubmitDrawList(gBufferProgramId, drawIndexLoc);
+            gBuffer.EndGeometryPass();
+            UDeferredLighting(view, cameraPosition);
+        }
+    }
+    else
+    {
+        // lay down the final depth first when the pre-pass runs this frame; the surface pass then shades visible pixels only
+        if (depthPrepass.BeginFrame())
+        {
+            USubmitDepthPrepass(view);
+            glUseProgram(surfaceProgramId);
+        }
+        depthPrepass.BeginColorPass();
+        USubmitDrawList(surfaceProgramId, drawIndexLoc);
+        depthPrepass.EndColorPass();
+    }
 
-    //Creates a Cube for Back dock
-    // Activate the VBOs contained within the mesh's VAO
+    //loop to draw the lamps, each in its light's diffuse color
+    gpuProfiler.Begin("lamps");
+    glUseProgram(lampProgramId);
     glBindVertexArray(meshes.gBoxMesh.vao);
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(4.5f, 2.5f, 0.8f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(1.0f, 1.8f, -3.1f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    glProgramUniform4f(surfaceProgramId, objectColorLoc, 0.0f, 0.5f, 0.0f, 1.0f);
-
-    //camera
-    viewPositionLoc = glGetUniformLocation(surfaceProgramId, "viewPosition");
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture7);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    // //Create a Plane for Switch Front Cover
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
-
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(2.25f, 0.5f, 1.5f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(1.0f, 1.55f, -1.49f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture5);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    // //Create a Plane for Switch Back Cover
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
-
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(2.25f, 0.5f, 1.5f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(1.0f, 1.55f, -3.52f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture6);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    // //Create a Plane for Switch Sides
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
-
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(0.4f, 0.5f, 1.5f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
-    rotation = glm::rotate(rotation, glm::radians(90.0f), glm::vec3(0.0, 0.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(-1.26f, 1.55f, -3.1f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    // Reference matrix uniforms from the Lamp Shader program
+    modelLoc = glGetUniformLocation(lampProgramId, "model");
+    viewLoc = glGetUniformLocation(lampProgramId, "view");
+    projLoc = glGetUniformLocation(lampProgramId, "projection");
+    objectColorLoc = glGetUniformLocation(lampProgramId, "uObjectColor");
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture7);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
-
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(0.4f, 0.5f, 1.5f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
-    rotation = glm::rotate(rotation, glm::radians(90.0f), glm::vec3(0.0, 0.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(3.26f, 1.55f, -3.1f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture7);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
-
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(0.1f, 0.5f, 1.5f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
-    rotation = glm::rotate(rotation, glm::radians(90.0f), glm::vec3(0.0, 0.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(-1.26f, 1.55f, -1.6f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture7);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
-
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(0.1f, 0.5f, 1.5f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
-    rotation = glm::rotate(rotation, glm::radians(90.0f), glm::vec3(0.0, 0.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(3.26f, 1.55f, -1.6f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture7);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
-
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(0.7f, 0.1f, 0.3f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
-    rotation = glm::rotate(rotation, glm::radians(90.0f), glm::vec3(0.0, 0.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(3.26f, 0.3f, -2.3f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture7);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
-
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(0.7f, 0.1f, 0.3f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
-    rotation = glm::rotate(rotation, glm::radians(90.0f), glm::vec3(0.0, 0.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(-1.254f, 0.3f, -2.3f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexture7);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    //End of creating Switch's sides cover
-    
-
-    //create the light casters
-    CreateLights();
-
-    //loop to draw the lamps
-    int numElements = sizeof(pointLightPositions) / sizeof(pointLightPositions[0]);
-
-    for (unsigned int i = 0; i < numElements; i++) {
+    // Pass matrix data to the Lamp Shader program's matrix uniforms
+    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-        glUseProgram(lampProgramId);
-        glBindVertexArray(meshes.gBoxMesh.vao);
+    for (const ClusteredLights::PointLight& light : pointLights.gLights) {
 
         //Transform the smaller cube used as a visual que for the light source
-        gLightPosition = pointLightPositions[i];
+        gLightPosition = light.position;
         model = glm::translate(gLightPosition) * glm::scale(gLightScale);
-
-        // Reference matrix uniforms from the Lamp Shader program
-        modelLoc = glGetUniformLocation(lampProgramId, "model");
-        viewLoc = glGetUniformLocation(lampProgramId, "view");
-        projLoc = glGetUniformLocation(lampProgramId, "projection");
-        objectColorLoc = glGetUniformLocation(lampProgramId, "uObjectColor");
-
-        // Pass matrix data to the Lamp Shader program's matrix uniforms
         glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-        //for the first 4 lights set to the point light color
-        //for the 5th light set to the colored light
-        if (i != 4) {
-            glProgramUniform4f(lampProgramId, objectColorLoc, pointLightColor.r, pointLightColor.g, pointLightColor.b, 1.0f);
-        }
-        else {
-            glProgramUniform4f(lampProgramId, objectColorLoc, coloredLightColor.r, coloredLightColor.g, coloredLightColor.b, 1.0f);
-        }
+        glProgramUniform4f(lampProgramId, objectColorLoc, light.diffuse.r, light.diffuse.g, light.diffuse.b, 1.0f);
 
         // Draws the triangles
         glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+        gDrawCalls++;
     }
 
     // Deactivate the Vertex Array Object and shader program
     glBindVertexArray(0);
     glUseProgram(0);
 
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
-}
+    // sharpened upscale of the scaled frame to the window (or headless target)
+    gpuProfiler.Begin("upscale");
+    dynamicResolution.Resolve(upscaleProgramId);
+    gpuProfiler.End();
 
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint& textureId)
-{
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
-    {
-        flipImageVertically(image, width, height, channels);
+    // upload the textures that finished reloading, start decoding the ones drawn while evicted,
+    // then reduce or evict textures that were not drawn this frame if over the memory budget
+    textures.StreamReloads(jobs);
+    textures.EnforceBudget();
 
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
+    // finishing a reload or a cube update the budget deferred takes another frame; wake the main loop in case it waits for events
+    gRenderWorkPending = textures.ReloadsPending() || pointShadows.Pending();
+    if (gRenderWorkPending && !gHeadless)
+        glfwPostEmptyEvent();
 
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+    gpuProfiler.Begin("swap");
+    if (!gHeadless)
+        glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+    else
+        glFlush();                   // submit the frame like a swap would
+    gpuProfiler.End();
+}
 
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
-        {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
-        }
+/*Decode the texture (optionally downsampled to 1/2 or 1/4 size) and queue it for the texture array*/
+bool UCreateTexture(const char* filename, Textures::TextureSlot& slot, int reduction)
+{
+    PROFILE_FUNCTION();
+    return textures.UCreateTexture(filename, slot, reduction);
+}
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+// Release a reference to a texture; the texture is deleted with the last reference
+void UDestroyTexture(Textures::TextureSlot& slot)
+{
+    textures.UDestroyTexture(slot);
+}
 
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+// Point the surface shader at a texture inside the texture array or the bindless handle table
+void USetTextureSlot(GLuint programId, const Textures::TextureSlot& slot)
+{
+    // mark the texture as drawn this frame; an evicted one is reloaded in the background
+    textures.Touch(slot);
 
-        return true;
+    if (textures.gBindless)
+    {
+        glUniform1i(glGetUniformLocation(programId, "uTextureIndex"), slot.index);
+        return;
     }
 
-    // Error loading the image
-    return false;
+    glUniform1i(glGetUniformLocation(programId, "uTextureLayer"), slot.layer);
+    glUniform4fv(glGetUniformLocation(programId, "uTextureRect"), 1, glm::value_ptr(slot.rect));
 }
 
-void UDestroyTexture(GLuint textureId)
+// Assemble a surface fragment shader (forward or G-buffer) with the lighting and the sampling code for the active texture path
+string UBuildSurfaceFragmentSource(const GLchar* mainSource, bool bindless)
 {
-    glGenTextures(1, &textureId);
+    string source = string(mainSource) + lightingSource;
+
+    // extension directives have to follow #version and precede everything else
+    if (bindless)
+        source.insert(source.find('\n') + 1, "#extension GL_ARB_bindless_texture : require\n");
+
+    return source + (bindless ? bindlessSamplingSource : arraySamplingSource);
 }
 
 // Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId, const char* geomShaderSource)
 {
+    PROFILE_FUNCTION();
+
     // Compilation and linkage error reporting
     int success = 0;
     char infoLog[512];
@@ -1353,6 +2047,23 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
         return false;
     }
 
+    // Compile the optional geometry shader, and print compilation errors (if any)
+    if (geomShaderSource)
+    {
+        GLuint geometryShaderId = glCreateShader(GL_GEOMETRY_SHADER);
+        glShaderSource(geometryShaderId, 1, &geomShaderSource, NULL);
+        glCompileShader(geometryShaderId);
+        glGetShaderiv(geometryShaderId, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(geometryShaderId, sizeof(infoLog), NULL, infoLog);
+            std::cout << "ERROR::SHADER::GEOMETRY::COMPILATION_FAILED\n" << infoLog << std::endl;
+
+            return false;
+        }
+        glAttachShader(programId, geometryShaderId);
+    }
+
     // Attached compiled shaders to the shader program
     glAttachShader(programId, vertexShaderId);
     glAttachShader(programId, fragmentShaderId);
@@ -1386,46 +2097,277 @@ GLint GetUniformLocation(GLuint shader, string name)
     return glGetUniformLocation(shader, name.c_str());
 }
 
-void CreateLights()
+// The desk's five point lights, then a grid of --office-lamps small warm lamps centred on the desk
+void UBuildLights(ClusteredLights& lights, int officeLamps)
 {
-    //ambient light
-    glm::vec3 ambientLightPos(-6.0f, -4.0f, 0.0f);
-
-    glUniform3f(glGetUniformLocation(surfaceProgramId, "dirLight.direction"), ambientLightPos.x, ambientLightPos.y, ambientLightPos.z);
-    glUniform3f(glGetUniformLocation(surfaceProgramId, "dirLight.ambient"), ambientLightColor.r, ambientLightColor.g, ambientLightColor.b);
-    glUniform3f(glGetUniformLocation(surfaceProgramId, "dirLight.diffuse"), ambientLightColor.r, ambientLightColor.g, ambientLightColor.b);
-    glUniform3f(glGetUniformLocation(surfaceProgramId, "dirLight.specular"), ambientLightColor.r, ambientLightColor.g, ambientLightColor.b);
+    lights.gLights.clear();
 
-
-    //loop throught the pointLights and give them a definition
     int numElements = sizeof(pointLightPositions) / sizeof(pointLightPositions[0]);
-    for (unsigned int i = 0; i < numElements; i++) {
-
-        glUniform3f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].position"), pointLightPositions[i].x, pointLightPositions[i].y, pointLightPositions[i].z);
+    for (int i = 0; i < numElements; i++) {
+        ClusteredLights::PointLight light = {};
+        light.position = pointLightPositions[i];
 
         //make the 5th light in the array colored
         if (i != 4) {
-            glUniform3f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].ambient"), pointLightColor.r, pointLightColor.g, pointLightColor.b);
-            glUniform3f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].diffuse"), pointLightColor.r, pointLightColor.g, pointLightColor.b);
-            glUniform3f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].specular"), pointLightColor.r, pointLightColor.g, ambientLightColor.b);
+            light.ambient = pointLightColor;
+            light.diffuse = pointLightColor;
+            light.specular = glm::vec3(pointLightColor.r, pointLightColor.g, ambientLightColor.b);
 
             //set the attenuation components to ~20 units
             //from: https://wiki.ogre3d.org/tiki-index.php?page=-Point+Light+Attenuation
-            glUniform1f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].constant"), 1.0f);
-            glUniform1f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].linear"), 0.22f);
-            glUniform1f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].quadratic"), 0.20f);
+            light.constant = 1.0f;
+            light.linear = 0.22f;
+            light.quadratic = 0.20f;
         }
         else {
-            glUniform3f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].ambient"), coloredLightColor.r, coloredLightColor.g, coloredLightColor.b);
-            glUniform3f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].diffuse"), coloredLightColor.r, coloredLightColor.g, coloredLightColor.b);
-            glUniform3f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].specular"), coloredLightColor.r, coloredLightColor.g, coloredLightColor.b);
+            light.ambient = coloredLightColor;
+            light.diffuse = coloredLightColor;
+            light.specular = coloredLightColor;
 
             //set the attenuation components to ~50 units to make the color cast stronger
             //from: https://wiki.ogre3d.org/tiki-index.php?page=-Point+Light+Attenuation
-            glUniform1f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].constant"), 1.0f);
-            glUniform1f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].linear"), 0.09f);
-            glUniform1f(GetUniformLocation(surfaceProgramId, "pointLights[" + std::to_string(i) + "].quadratic"), 0.032f);
+            light.constant = 1.0f;
+            light.linear = 0.09f;
+            light.quadratic = 0.032f;
         }
+        lights.gLights.push_back(light);
+    }
+
+    // dim lamps with a ~7 unit falloff, so each cluster only sees the few around it
+    int side = max(1, (int)ceil(sqrt((double)officeLamps)));
+    for (int i = 0; i < officeLamps; i++) {
+        ClusteredLights::PointLight light = {};
+        light.position = glm::vec3(((i % side) - (side - 1) * 0.5f) * OFFICE_LAMP_SPACING, OFFICE_LAMP_HEIGHT,
+            ((i / side) - (side - 1) * 0.5f) * OFFICE_LAMP_SPACING);
+        light.ambient = pointLightColor * 0.05f;
+        light.diffuse = pointLightColor * 0.6f;
+        light.specular = pointLightColor * 0.3f;
+        light.constant = 1.0f;
+        light.linear = 0.7f;
+        light.quadratic = 1.8f;
+        lights.gLights.push_back(light);
+    }
+}
 
+
+// Directional light uniforms of the program that shades this frame, then the point lights binned into its view clusters
+void CreateLights(const glm::mat4& view, GLuint programId, bool clustered)
+{
+    PROFILE_FUNCTION();
+
+    //ambient light
+    glProgramUniform3f(programId, glGetUniformLocation(programId, "dirLight.direction"), sunDirection.x, sunDirection.y, sunDirection.z);
+    glProgramUniform3f(programId, glGetUniformLocation(programId, "dirLight.ambient"), ambientLightColor.r, ambientLightColor.g, ambientLightColor.b);
+    glProgramUniform3f(programId, glGetUniformLocation(programId, "dirLight.diffuse"), ambientLightColor.r, ambientLightColor.g, ambientLightColor.b);
+    glProgramUniform3f(programId, glGetUniformLocation(programId, "dirLight.specular"), ambientLightColor.r, ambientLightColor.g, ambientLightColor.b);
+
+    // the shader maps gl_FragCoord to cluster tiles, so it needs the viewport size
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    pointLights.Build(jobs, view, projection, 0.1f, 100.0f);
+    pointLights.Upload();
+    pointLights.SetUniforms(programId, viewport[2], viewport[3]);
+    glProgramUniform1i(programId, glGetUniformLocation(programId, "uClusteredLights"), clustered);
+}
+
+
+// Render the benchmark: warm-up frames, then the measured frames along the camera path
+bool URunBenchmark()
+{
+    if (!benchmark.gPathFile.empty())
+    {
+        if (!benchmark.LoadPath(benchmark.gPathFile.c_str()))
+            return false;
     }
+    else
+        benchmark.ScriptedPath(glm::vec3(2.5f, 1.0f, 0.0f), 16.0f, 4.0f); // orbit the table
+
+    // measure the renderer, not the display refresh
+    if (!gHeadless)
+    {
+        framePacer.gPresentMode = FramePacer::PRESENT_UNCAPPED;
+        framePacer.ApplyPresentMode();
+    }
+
+    // one run with the current render path, or one per path, each with its own report
+    int firstPath = gCompareRenderers ? 0 : gRenderPath.load();
+    int lastPath = gCompareRenderers ? RENDER_PATH_COUNT - 1 : firstPath;
+    const string outputFile = benchmark.gOutputFile;
+    bool passed = true;
+    for (int path = firstPath; path <= lastPath; ++path)
+    {
+        gRenderPath = path;
+        if (gCompareRenderers)
+        {
+            benchmark.gVariant = RENDER_PATH_NAMES[path];
+            if (!outputFile.empty())
+            {
+                // report.json -> report.deferred.json
+                size_t extension = min(outputFile.rfind('.'), outputFile.size());
+                benchmark.gOutputFile = outputFile.substr(0, extension) + "." + RENDER_PATH_NAMES[path] + outputFile.substr(extension);
+            }
+        }
+
+        benchmark.Start();
+        for (int frame = -benchmark.gWarmupFrames; frame < benchmark.gFrames; ++frame)
+        {
+            // section timings only cover the measured frames
+            if (frame == 0)
+            {
+                gpuProfiler.Flush();
+                gpuProfiler.Reset();
+            }
+
+            PROFILE_ZONE("benchmark frame");
+            USetCamera(benchmark.Sample(max(frame, 0)));
+            deltaTime = benchmark.gTimeStep;
+
+            benchmark.BeginFrame();
+            URender();
+            benchmark.EndFrame(gDrawCalls);
+
+            if (!gHeadless)
+                glfwPollEvents();
+        }
+
+        gpuProfiler.Flush();
+        if (!benchmark.Finish(&gpuProfiler))
+            passed = false;
+    }
+    benchmark.gOutputFile = outputFile;
+    return passed;
+}
+
+
+// Render the golden-image poses headless and compare (or update) their references
+bool URunGoldenImages()
+{
+    Benchmark::CameraKey defaultCamera = { cameraPos, yaw, pitch };
+    vector<GoldenImages::Pose> poses = GoldenImages::Poses(defaultCamera);
+
+    bool passed = true;
+    for (const GoldenImages::Pose& pose : poses)
+    {
+        orthoOn = pose.ortho;
+        USetCamera(pose.camera);
+        deltaTime = HEADLESS_FRAME_TIME;
+        URender();
+
+        vector<unsigned char> pixels;
+        if (!headless.ReadPixels(pixels) || !golden.Check(pose, pixels, headless.gWidth, headless.gHeight))
+            passed = false;
+    }
+    orthoOn = false;
+
+    return golden.Report() && passed;
+}
+
+
+// Time the hot paths: mesh generation, texture decode + flip, the per-object
+// matrix chain of URender and its uniform uploads
+bool URunMicroBenchmarks()
+{
+    Meshes benchmarkMeshes; // the scene's own meshes stay untouched
+    benchmarkMeshes.BenchmarkMeshes(microbench);
+
+    Textures::BenchmarkTextures(microbench, SCENE_TEXTURE_FILES);
+
+    // batched TRS composition into world and normal matrices, per SIMD level
+    TransformHierarchy::BenchmarkCompose(microbench);
+
+    // the scale / rotate / translate chain every object in URender used before batching
+    float angle = 0.0f;
+    microbench.Run("Math/ModelMatrix", [&]()
+    {
+        glm::mat4 scale = glm::scale(glm::vec3(1.0f, 1.0f, 1.0f));
+        glm::mat4 rotation = glm::rotate(angle, glm::vec3(1.0, 1.0f, 1.0f));
+        glm::mat4 translation = glm::translate(glm::vec3(5.5f, 0.0f, -2.0f));
+        glm::mat4 model = translation * rotation * scale;
+        MicroBenchmark::DoNotOptimize(model);
+        angle += 0.001f;
+    });
+
+    // uniform uploads of one draw, as USubmitDrawList issues them: locations are looked up once
+    // per frame, the view position is set once per frame and the texture only when it changes
+    glUseProgram(surfaceProgramId);
+    GLint drawIndexLoc = glGetUniformLocation(surfaceProgramId, "uDrawIndex");
+    GLint drawIndex = 0;
+    microbench.Run("Uniforms/PerObject", [&]()
+    {
+        glUniform1i(drawIndexLoc, drawIndex++ & 1023);
+    });
+    microbench.Run("Uniforms/TextureChange", [&]()
+    {
+        USetTextureSlot(surfaceProgramId, gTexture0);
+    });
+    microbench.Run("Uniforms/GetUniformLocation", [&]()
+    {
+        MicroBenchmark::DoNotOptimize(glGetUniformLocation(surfaceProgramId, "viewPosition"));
+    });
+    glUseProgram(0);
+
+    // frame build (cull, compose, sort) of a 100k-object scene on one thread and on every job worker
+    DrawListBuilder stressList;
+    TransformHierarchy stressTransforms;
+    const TransformHierarchy::Node stressField = UAddStressObjects(stressList.gObjects, stressTransforms, MICROBENCH_STRESS_OBJECTS);
+    stressTransforms.Update(jobs);
+    glm::mat4 stressView = glm::lookAt(glm::vec3(0.0f, 20.0f, 40.0f), glm::vec3(0.0f, -2.0f, 0.0f), cameraUp);
+    glm::mat4 stressViewProjection = glm::perspective(glm::radians(fov), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f) * stressView;
+    JobSystem serialJobs;
+    microbench.Run("DrawList/Build/100k/threads:1", [&]()
+    {
+        stressList.Build(serialJobs, stressTransforms, stressViewProjection);
+        MicroBenchmark::DoNotOptimize(stressList.Items().size());
+    });
+    microbench.Run("DrawList/Build/100k/threads:" + to_string(jobs.WorkerCount()), [&]()
+    {
+        stressList.Build(jobs, stressTransforms, stressViewProjection);
+        MicroBenchmark::DoNotOptimize(stressList.Items().size());
+    });
+
+    // moving the field node dirties all 100k boxes under it; an unchanged hierarchy is skipped
+    const glm::vec3 fieldPosition = stressTransforms.Translation(stressField);
+    microbench.Run("Transforms/Update/100k/threads:1", [&]()
+    {
+        stressTransforms.SetTranslation(stressField, fieldPosition);
+        stressTransforms.Update(serialJobs);
+    });
+    microbench.Run("Transforms/Update/100k/threads:" + to_string(jobs.WorkerCount()), [&]()
+    {
+        stressTransforms.SetTranslation(stressField, fieldPosition);
+        stressTransforms.Update(jobs);
+    });
+    microbench.Run("Transforms/Update/100k/clean", [&]()
+    {
+        stressTransforms.Update(jobs);
+    });
+
+    // binning the desk lights plus a grid of office lamps into the view clusters
+    ClusteredLights benchLights;
+    UBuildLights(benchLights, MICROBENCH_LIGHTS - (int)(sizeof(pointLightPositions) / sizeof(pointLightPositions[0])));
+    glm::mat4 benchProjection = glm::perspective(glm::radians(fov), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 benchView = glm::lookAt(glm::vec3(0.0f, 6.0f, 30.0f), glm::vec3(0.0f), cameraUp);
+    microbench.Run("Lights/Cluster/" + to_string(MICROBENCH_LIGHTS), [&]()
+    {
+        benchLights.Build(jobs, benchView, benchProjection, 0.1f, 100.0f);
+        MicroBenchmark::DoNotOptimize(benchLights.AssignedLights());
+    });
+
+    return microbench.Report();
+}
+
+
+// Place the camera from a benchmark path key
+void USetCamera(const Benchmark::CameraKey& key)
+{
+    cameraPos = key.position;
+    yaw = key.yaw;
+    pitch = key.pitch;
+
+    glm::vec3 front;
+    front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+    front.y = sin(glm::radians(pitch));
+    front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+    cameraFront = glm::normalize(front);
 }
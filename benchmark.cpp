@@ -0,0 +1,250 @@
+///////////////////////////////////////////////////////////////////////////////
+// benchmark.cpp
+// ========
+// deterministic benchmark runs: the camera replays a recorded or scripted
+// path (position, yaw and pitch per key) at a fixed time step, and every
+// frame's CPU time, GPU time (timestamp queries) and draw-call count is
+// collected and reported as JSON with mean, median, p95 and p99, along with
+// the GPU time of each render section when a profiler is passed in.
+//
+// Camera path files hold one key per line, "x y z yaw pitch"; lines starting
+// with # are comments. Keys are spread evenly over the benchmark's frames.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "benchmark.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// Keys of the scripted orbit, one every 5 degrees
+	const int SCRIPTED_PATH_KEYS = 73;
+
+	// Summary of one per-frame measurement
+	struct FrameStats
+	{
+		double mean;
+		double median;
+		double p95;
+		double p99;
+		double min;
+		double max;
+	};
+
+	// Nearest-rank percentile of sorted values
+	double Percentile(const std::vector<double>& sorted, double percent)
+	{
+		size_t rank = (size_t)std::ceil(percent / 100.0 * sorted.size());
+		return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+	}
+
+	FrameStats Summarize(std::vector<double> values)
+	{
+		FrameStats stats = {};
+		if (values.empty())
+			return stats;
+
+		std::sort(values.begin(), values.end());
+		double sum = 0.0;
+		for (double value : values)
+			sum += value;
+
+		stats.mean = sum / values.size();
+		stats.median = Percentile(values, 50.0);
+		stats.p95 = Percentile(values, 95.0);
+		stats.p99 = Percentile(values, 99.0);
+		stats.min = values.front();
+		stats.max = values.back();
+		return stats;
+	}
+
+	void WriteStats(std::ostream& out, const char* name, const FrameStats& stats)
+	{
+		out << "  \"" << name << "\": { \"mean\": " << stats.mean << ", \"median\": " << stats.median
+			<< ", \"p95\": " << stats.p95 << ", \"p99\": " << stats.p99
+			<< ", \"min\": " << stats.min << ", \"max\": " << stats.max << " }";
+	}
+}
+
+
+// Reads a camera path written by SavePath (or by hand)
+bool Benchmark::LoadPath(const char* filename)
+{
+	std::ifstream file(filename);
+	if (!file)
+	{
+		std::cout << "Failed to open camera path " << filename << std::endl;
+		return false;
+	}
+
+	mPath.clear();
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream fields(line);
+		CameraKey key;
+		if (fields >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)
+			mPath.push_back(key);
+	}
+
+	if (mPath.empty())
+	{
+		std::cout << "Camera path " << filename << " has no keys" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+// Orbits once around center at the given radius and height, always facing the center
+void Benchmark::ScriptedPath(const glm::vec3& center, float radius, float height)
+{
+	mPath.clear();
+	float pitch = -glm::degrees(std::atan2(height, radius));
+	for (int i = 0; i < SCRIPTED_PATH_KEYS; ++i)
+	{
+		// yaw keeps growing past 360 so interpolation never wraps the wrong way
+		float angle = 90.0f + 360.0f * i / (SCRIPTED_PATH_KEYS - 1);
+		CameraKey key;
+		key.position = center + glm::vec3(radius * std::cos(glm::radians(angle)), height, radius * std::sin(glm::radians(angle)));
+		key.yaw = angle + 180.0f;
+		key.pitch = pitch;
+		mPath.push_back(key);
+	}
+}
+
+
+bool Benchmark::SavePath(const char* filename) const
+{
+	std::ofstream file(filename);
+	if (!file)
+	{
+		std::cout << "Failed to open " << filename << " for writing" << std::endl;
+		return false;
+	}
+
+	file << "# x y z yaw pitch\n";
+	for (const CameraKey& key : mPath)
+		file << key.position.x << " " << key.position.y << " " << key.position.z << " " << key.yaw << " " << key.pitch << "\n";
+
+	std::cout << "Recorded " << mPath.size() << " camera keys to " << filename << std::endl;
+	return bool(file);
+}
+
+
+// Appends the live camera to the path, once per frame while recording
+void Benchmark::Record(const CameraKey& key)
+{
+	mPath.push_back(key);
+}
+
+
+// Camera for a measured frame, interpolated between the path keys
+Benchmark::CameraKey Benchmark::Sample(int frame) const
+{
+	if (mPath.size() == 1 || gFrames <= 1)
+		return mPath.front();
+
+	float t = (float)std::min(std::max(frame, 0), gFrames - 1) * (mPath.size() - 1) / (gFrames - 1);
+	size_t first = std::min((size_t)t, mPath.size() - 2);
+	float blend = t - first;
+
+	const CameraKey& a = mPath[first];
+	const CameraKey& b = mPath[first + 1];
+	CameraKey key;
+	key.position = glm::mix(a.position, b.position, blend);
+	key.yaw = glm::mix(a.yaw, b.yaw, blend);
+	key.pitch = glm::mix(a.pitch, b.pitch, blend);
+	return key;
+}
+
+
+// Allocates the timestamp queries; needs a current context
+void Benchmark::Start()
+{
+	mCpuMs.clear();
+	mDrawCalls.clear();
+	mQueries.assign(size_t(gFrames) * 2, 0);
+	glGenQueries((GLsizei)mQueries.size(), mQueries.data());
+	mFrame = 0;
+}
+
+
+void Benchmark::BeginFrame()
+{
+	int measured = mFrame - gWarmupFrames;
+	if (measured >= 0)
+		glQueryCounter(mQueries[measured * 2], GL_TIMESTAMP);
+	mFrameStart = std::chrono::steady_clock::now();
+}
+
+
+void Benchmark::EndFrame(unsigned int drawCalls)
+{
+	int measured = mFrame - gWarmupFrames;
+	if (measured >= 0)
+	{
+		glQueryCounter(mQueries[measured * 2 + 1], GL_TIMESTAMP);
+		mCpuMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mFrameStart).count());
+		mDrawCalls.push_back(drawCalls);
+	}
+	++mFrame;
+}
+
+
+// Waits for the GPU timings and prints (and optionally writes) the JSON report
+bool Benchmark::Finish(const GpuProfiler* sections)
+{
+	// The run is over, so blocking on the query results costs nothing
+	std::vector<double> gpuMs;
+	for (size_t frame = 0; frame < mCpuMs.size(); ++frame)
+	{
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(mQueries[frame * 2], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(mQueries[frame * 2 + 1], GL_QUERY_RESULT, &end);
+		gpuMs.push_back((end - begin) / 1.0e6);
+	}
+	glDeleteQueries((GLsizei)mQueries.size(), mQueries.data());
+	mQueries.clear();
+
+	std::vector<double> drawCalls(mDrawCalls.begin(), mDrawCalls.end());
+
+	std::ostringstream report;
+	report << "{\n  \"renderer\": \"" << (const char*)glGetString(GL_RENDERER) << "\",\n"
+		<< "  \"path\": \"" << (gPathFile.empty() ? "scripted" : gPathFile) << "\",\n"
+		<< (gVariant.empty() ? "" : "  \"variant\": \"" + gVariant + "\",\n")
+		<< "  \"frames\": " << mCpuMs.size() << ",\n"
+		<< "  \"warmup_frames\": " << gWarmupFrames << ",\n"
+		<< "  \"timestep_ms\": " << gTimeStep * 1000.0f << ",\n";
+	WriteStats(report, "cpu_ms", Summarize(mCpuMs));
+	report << ",\n";
+	WriteStats(report, "gpu_ms", Summarize(gpuMs));
+	report << ",\n";
+	WriteStats(report, "draw_calls", Summarize(drawCalls));
+	if (sections)
+	{
+		report << ",\n  \"gpu_sections_ms\": ";
+		sections->WriteJson(report);
+	}
+	report << "\n}";
+
+	std::cout << report.str() << std::endl;
+
+	if (!gOutputFile.empty())
+	{
+		std::ofstream file(gOutputFile);
+		if (!file || !(file << report.str() << "\n"))
+		{
+			std::cout << "Failed to write " << gOutputFile << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
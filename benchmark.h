@@ -0,0 +1,65 @@
+///////////////////////////////////////////////////////////////////////////////
+// benchmark.h
+// ========
+// deterministic benchmark runs: the camera replays a recorded or scripted
+// path (position, yaw and pitch per key) at a fixed time step, and every
+// frame's CPU time, GPU time (timestamp queries) and draw-call count is
+// collected and reported as JSON with mean, median, p95 and p99, along with
+// the GPU time of each render section when a profiler is passed in.
+//
+// Camera path files hold one key per line, "x y z yaw pitch"; lines starting
+// with # are comments. Keys are spread evenly over the benchmark's frames.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include "gpuprofiler.h"
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+class Benchmark
+{
+public:
+	// Camera placement for one key of a path
+	struct CameraKey
+	{
+		glm::vec3 position;
+		float yaw;
+		float pitch;
+	};
+
+public:
+	bool gActive = false;			// Replay the camera path instead of live input
+	int gFrames = 600;				// Measured frames
+	int gWarmupFrames = 10;			// Frames rendered before measuring starts
+	float gTimeStep = 1.0f / 60.0f;	// Fixed deltaTime of every benchmark frame
+	std::string gPathFile;			// Camera path to replay; empty for the scripted orbit
+	std::string gOutputFile;		// JSON report file; the report is always printed too
+	std::string gVariant;			// Renderer configuration the report is labelled with, if any
+
+public:
+	bool LoadPath(const char* filename);
+	void ScriptedPath(const glm::vec3& center, float radius, float height);
+	bool SavePath(const char* filename) const;
+	void Record(const CameraKey& key);
+	CameraKey Sample(int frame) const;
+
+	void Start();
+	void BeginFrame();
+	void EndFrame(unsigned int drawCalls);
+	bool Finish(const GpuProfiler* sections = nullptr);
+
+private:
+	std::vector<CameraKey> mPath;
+	std::vector<double> mCpuMs;
+	std::vector<unsigned int> mDrawCalls;
+	std::vector<GLuint> mQueries;		// Begin and end timestamp for every measured frame
+	int mFrame = 0;						// Frames rendered so far, warm-up included
+	std::chrono::steady_clock::time_point mFrameStart;
+};
@@ -0,0 +1,152 @@
+///////////////////////////////////////////////////////////////////////////////
+// cpuprofiler.cpp
+// ========
+// scoped CPU timing zones: PROFILE_ZONE("name") or PROFILE_FUNCTION() times
+// the enclosing scope with steady_clock and records it into a ring buffer
+// owned by the calling thread, so recording takes no lock. The recorded
+// events are exported in the Chrome trace event format, which loads in
+// chrome://tracing and Perfetto as a per-frame, per-thread timeline.
+//
+// Zones are compiled in for debug builds and compiled out completely when
+// NDEBUG is defined, unless PROFILE_ZONES is defined to keep them in a
+// release build.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "cpuprofiler.h"
+
+#ifdef PROFILER_ENABLED
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+const size_t CpuProfiler::RING_EVENTS;
+
+namespace
+{
+	// One finished zone
+	struct ZoneEvent
+	{
+		const char* name;
+		uint64_t start;
+		uint64_t end;
+	};
+
+	// Ring buffer written only by its own thread
+	struct ThreadEvents
+	{
+		std::vector<ZoneEvent> events;
+		uint64_t recorded = 0;		// Events ever recorded; the ring holds the last RING_EVENTS
+		unsigned int threadId = 0;
+		std::string threadName;
+	};
+
+	// Buffers stay registered after their thread exits so its events can still be exported
+	std::mutex gRegistryMutex;
+	std::vector<std::unique_ptr<ThreadEvents>> gRegistry;
+
+	thread_local ThreadEvents* tThreadEvents = nullptr;
+
+	ThreadEvents& GetThreadEvents()
+	{
+		if (!tThreadEvents)
+		{
+			std::unique_ptr<ThreadEvents> events(new ThreadEvents());
+			events->events.resize(CpuProfiler::RING_EVENTS);
+
+			std::lock_guard<std::mutex> lock(gRegistryMutex);
+			events->threadId = (unsigned int)gRegistry.size() + 1;
+			events->threadName = events->threadId == 1 ? "main" : "thread " + std::to_string(events->threadId);
+			tThreadEvents = events.get();
+			gRegistry.push_back(std::move(events));
+		}
+		return *tThreadEvents;
+	}
+
+	void WriteJsonString(std::ostream& out, const char* text)
+	{
+		out << '"';
+		for (; *text; ++text)
+		{
+			if (*text == '"' || *text == '\\')
+				out << '\\';
+			out << *text;
+		}
+		out << '"';
+	}
+}
+
+
+void CpuProfiler::Record(const char* name, uint64_t start, uint64_t end)
+{
+	ThreadEvents& thread = GetThreadEvents();
+	thread.events[thread.recorded % RING_EVENTS] = { name, start, end };
+	++thread.recorded;
+}
+
+
+// Names the calling thread's track in the exported trace
+void CpuProfiler::SetThreadName(const char* name)
+{
+	ThreadEvents& thread = GetThreadEvents();
+	std::lock_guard<std::mutex> lock(gRegistryMutex);
+	thread.threadName = name;
+}
+
+
+// Writes every thread's buffered zones as Chrome trace "complete" events; call
+// it once the other threads have stopped recording (at shutdown)
+bool CpuProfiler::WriteChromeTrace(const char* filename)
+{
+	std::ofstream file(filename);
+	if (!file)
+	{
+		std::cout << "Failed to open " << filename << " for writing" << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(gRegistryMutex);
+
+	// timestamps are written relative to the earliest buffered event
+	uint64_t origin = UINT64_MAX;
+	for (const std::unique_ptr<ThreadEvents>& thread : gRegistry)
+	{
+		uint64_t count = std::min<uint64_t>(thread->recorded, RING_EVENTS);
+		for (uint64_t i = thread->recorded - count; i < thread->recorded; ++i)
+			origin = std::min(origin, thread->events[i % RING_EVENTS].start);
+	}
+
+	size_t written = 0;
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	for (const std::unique_ptr<ThreadEvents>& thread : gRegistry)
+	{
+		file << (written++ ? ",\n" : "\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->threadId
+			<< ",\"args\":{\"name\":";
+		WriteJsonString(file, thread->threadName.c_str());
+		file << "}}";
+
+		uint64_t count = std::min<uint64_t>(thread->recorded, RING_EVENTS);
+		for (uint64_t i = thread->recorded - count; i < thread->recorded; ++i)
+		{
+			const ZoneEvent& event = thread->events[i % RING_EVENTS];
+			file << ",\n{\"name\":";
+			WriteJsonString(file, event.name);
+			file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->threadId
+				<< ",\"ts\":" << (event.start - origin) / 1000.0
+				<< ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+			++written;
+		}
+	}
+	file << "\n]}\n";
+
+	std::cout << "Wrote CPU trace " << filename << " (" << written - gRegistry.size() << " zones)" << std::endl;
+	return bool(file);
+}
+
+#endif
@@ -0,0 +1,73 @@
+///////////////////////////////////////////////////////////////////////////////
+// cpuprofiler.h
+// ========
+// scoped CPU timing zones: PROFILE_ZONE("name") or PROFILE_FUNCTION() times
+// the enclosing scope with steady_clock and records it into a ring buffer
+// owned by the calling thread, so recording takes no lock. The recorded
+// events are exported in the Chrome trace event format, which loads in
+// chrome://tracing and Perfetto as a per-frame, per-thread timeline.
+//
+// Zones are compiled in for debug builds and compiled out completely when
+// NDEBUG is defined, unless PROFILE_ZONES is defined to keep them in a
+// release build.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#if !defined(NDEBUG) || defined(PROFILE_ZONES)
+#define PROFILER_ENABLED 1
+#endif
+
+#ifdef PROFILER_ENABLED
+
+#include <chrono>
+#include <cstdint>
+
+class CpuProfiler
+{
+public:
+	static const size_t RING_EVENTS = 1 << 16;	// Events kept per thread; older ones are overwritten
+
+public:
+	// Nanoseconds on the steady clock
+	static uint64_t Now()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static void Record(const char* name, uint64_t start, uint64_t end);
+	static void SetThreadName(const char* name);
+	static bool WriteChromeTrace(const char* filename);
+};
+
+// Records the time between its construction and destruction
+class ProfileZone
+{
+public:
+	explicit ProfileZone(const char* name) : mName(name), mStart(CpuProfiler::Now()) {}
+	~ProfileZone() { CpuProfiler::Record(mName, mStart, CpuProfiler::Now()); }
+
+	ProfileZone(const ProfileZone&) = delete;
+	ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+	const char* mName;		// Must outlive the export: string literals or __FUNCTION__
+	uint64_t mStart;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__FUNCTION__)
+#define PROFILE_THREAD_NAME(name) CpuProfiler::SetThreadName(name)
+#define PROFILE_WRITE_TRACE(filename) CpuProfiler::WriteChromeTrace(filename)
+
+#else
+
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_FUNCTION() ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+#define PROFILE_WRITE_TRACE(filename) (false)
+
+#endif
@@ -0,0 +1,166 @@
+///////////////////////////////////////////////////////////////////////////////
+// depthprepass.cpp
+// ========
+// optional depth-only pre-pass. The opaque draws are first rendered with a
+// position-only shader and colour writes off, then drawn again with
+// GL_EQUAL and depth writes off, so the expensive surface shader runs once
+// per visible pixel instead of once per overlapping fragment.
+//
+// Overdraw is measured with GL_SAMPLES_PASSED queries: in a pre-pass frame
+// the depth pass counts the fragments a plain pass would have shaded and
+// the colour pass counts the visible ones. In auto mode the pre-pass stays
+// on while that ratio is above gMinOverdraw; while it is off a measuring
+// frame is run every gProbeInterval frames. Queries are read back
+// FRAME_LATENCY frames later, so they never stall the pipeline.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "depthprepass.h"
+
+#include <cstring>
+
+const int DepthPrepass::FRAME_LATENCY;
+
+
+// Reads a --depth-prepass value: off, on or auto
+bool DepthPrepass::ParseMode(const char* name, Mode& mode)
+{
+	if (strcmp(name, "off") == 0)
+		mode = PREPASS_OFF;
+	else if (strcmp(name, "on") == 0)
+		mode = PREPASS_ON;
+	else if (strcmp(name, "auto") == 0)
+		mode = PREPASS_AUTO;
+	else
+		return false;
+	return true;
+}
+
+
+// Reads back the query set this frame reuses, then decides whether the frame runs the pre-pass
+bool DepthPrepass::BeginFrame()
+{
+	++mFrame;
+	FrameQueries& frame = mFrames[mFrame % FRAME_LATENCY];
+	if (frame.depthQuery == 0)
+	{
+		glGenQueries(1, &frame.depthQuery);
+		glGenQueries(1, &frame.colorQuery);
+	}
+	if (frame.issued)
+		Collect(frame);
+
+	if (gMode == PREPASS_ON)
+		mPrepass = true;
+	else if (gMode == PREPASS_OFF)
+		mPrepass = false;
+	else if (mOverdraw == 0.0 || mOverdraw >= gMinOverdraw)
+		mPrepass = true;	// not measured yet, or paying off: every pre-pass frame measures again
+	else
+		mPrepass = ++mFramesSinceProbe >= gProbeInterval;
+
+	if (mPrepass)
+	{
+		mFramesSinceProbe = 0;
+		++mPrepassFrames;
+	}
+	frame.prepass = mPrepass;
+	frame.issued = false;
+	return mPrepass;
+}
+
+
+// Depth only: colour writes off, the queries count every fragment that passes GL_LESS
+void DepthPrepass::BeginDepthPass()
+{
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glBeginQuery(GL_SAMPLES_PASSED, mFrames[mFrame % FRAME_LATENCY].depthQuery);
+}
+
+
+void DepthPrepass::EndDepthPass()
+{
+	glEndQuery(GL_SAMPLES_PASSED);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+
+// After a pre-pass only the fragments that wrote the final depth are shaded, and depth stays as it is
+void DepthPrepass::BeginColorPass()
+{
+	if (mPrepass)
+	{
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+	glBeginQuery(GL_SAMPLES_PASSED, mFrames[mFrame % FRAME_LATENCY].colorQuery);
+}
+
+
+void DepthPrepass::EndColorPass()
+{
+	glEndQuery(GL_SAMPLES_PASSED);
+	mFrames[mFrame % FRAME_LATENCY].issued = true;
+
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+}
+
+
+// Takes a frame's sample counts if the GPU has finished with them; results not ready are dropped
+void DepthPrepass::Collect(FrameQueries& frame)
+{
+	frame.issued = false;
+
+	GLint available = GL_FALSE;
+	glGetQueryObjectiv(frame.colorQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+	{
+		++mDroppedResults;
+		return;
+	}
+
+	GLuint64 colorSamples = 0;
+	glGetQueryObjectui64v(frame.colorQuery, GL_QUERY_RESULT, &colorSamples);
+	if (!frame.prepass)
+	{
+		mShadedSamples += colorSamples;
+		return;
+	}
+
+	// the depth query ended before the colour query, so it is ready too
+	GLuint64 depthSamples = 0;
+	glGetQueryObjectui64v(frame.depthQuery, GL_QUERY_RESULT, &depthSamples);
+	mShadedSamples += colorSamples;
+	if (colorSamples > 0)
+	{
+		mOverdraw = (double)depthSamples / (double)colorSamples;
+		++mMeasurements;
+	}
+}
+
+
+void DepthPrepass::Destroy()
+{
+	for (FrameQueries& frame : mFrames)
+	{
+		glDeleteQueries(1, &frame.depthQuery);
+		glDeleteQueries(1, &frame.colorQuery);
+		frame = FrameQueries();
+	}
+}
+
+
+// Mode, how often the pre-pass ran and the last overdraw it measured
+void DepthPrepass::WriteJson(std::ostream& out) const
+{
+	const char* const modeNames[] = { "off", "on", "auto" };
+	out << "{\n  \"mode\": \"" << modeNames[gMode] << "\""
+		<< ",\n  \"frames\": " << mFrame
+		<< ",\n  \"prepass_frames\": " << mPrepassFrames
+		<< ",\n  \"overdraw\": " << mOverdraw
+		<< ",\n  \"min_overdraw\": " << gMinOverdraw
+		<< ",\n  \"measurements\": " << mMeasurements
+		<< ",\n  \"dropped_results\": " << mDroppedResults
+		<< ",\n  \"shaded_samples\": " << mShadedSamples
+		<< "\n}" << std::endl;
+}
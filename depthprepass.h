@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////////////
+// depthprepass.h
+// ========
+// optional depth-only pre-pass. The opaque draws are first rendered with a
+// position-only shader and colour writes off, then drawn again with
+// GL_EQUAL and depth writes off, so the expensive surface shader runs once
+// per visible pixel instead of once per overlapping fragment.
+//
+// Overdraw is measured with GL_SAMPLES_PASSED queries: in a pre-pass frame
+// the depth pass counts the fragments a plain pass would have shaded and
+// the colour pass counts the visible ones. In auto mode the pre-pass stays
+// on while that ratio is above gMinOverdraw; while it is off a measuring
+// frame is run every gProbeInterval frames. Queries are read back
+// FRAME_LATENCY frames later, so they never stall the pipeline.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <ostream>
+
+class DepthPrepass
+{
+public:
+	enum Mode
+	{
+		PREPASS_OFF,
+		PREPASS_ON,
+		PREPASS_AUTO		// On while the measured overdraw makes it pay off
+	};
+
+	static const int FRAME_LATENCY = 3;		// Query sets in flight
+
+private:
+	// Sample counts issued during one frame
+	struct FrameQueries
+	{
+		GLuint depthQuery;		// Fragments passing GL_LESS in the pre-pass
+		GLuint colorQuery;		// Fragments shaded by the colour pass
+		bool prepass;			// The frame ran the pre-pass
+		bool issued;			// The colour query was ended and awaits readback
+	};
+
+public:
+	Mode gMode = PREPASS_OFF;
+	double gMinOverdraw = 1.3;	// Auto: shaded / visible fragments above which the pre-pass runs
+	int gProbeInterval = 60;	// Auto: frames between measuring frames while the pre-pass is off
+
+public:
+	static bool ParseMode(const char* name, Mode& mode);
+
+	bool BeginFrame();
+	bool Active() const { return mPrepass; }
+	void BeginDepthPass();
+	void EndDepthPass();
+	void BeginColorPass();
+	void EndColorPass();
+	void Destroy();
+
+	double Overdraw() const { return mOverdraw; }
+	void WriteJson(std::ostream& out) const;
+
+private:
+	void Collect(FrameQueries& frame);
+
+	FrameQueries mFrames[FRAME_LATENCY] = {};
+	unsigned long long mFrame = 0;
+	bool mPrepass = false;				// This frame runs the pre-pass
+	int mFramesSinceProbe = 0;
+
+	double mOverdraw = 0.0;				// Last measured shaded / visible fragments, 0 before the first measurement
+	unsigned long long mPrepassFrames = 0;
+	unsigned long long mMeasurements = 0;
+	unsigned long long mDroppedResults = 0;	// Frames whose queries were not ready in time
+	unsigned long long mShadedSamples = 0;	// Surface shader fragments over all collected frames
+};
@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////////////
+// drawlist.cpp
+// ========
+// builds the frame's draws from the scene's object table in parallel. The
+// objects are split into chunks that run on the job system; each chunk culls
+// its objects against the view frustum, using the world matrices of the
+// scene's transform hierarchy, and makes a sort key, appending to the draw
+// list of the worker it runs on. The per-worker lists are then merged and
+// sorted by key (render section, mesh, texture, object) for a single-threaded
+// GL submission that only rebinds what changes between draws. The model and
+// normal matrices of the sorted draws are written, in parallel, straight into
+// the mapped per-draw buffer the surface shader reads them from.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "drawlist.h"
+#include "cpuprofiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+const int DrawListBuilder::SECTION_SHIFT;
+const int DrawListBuilder::MESH_SHIFT;
+const int DrawListBuilder::TEXTURE_SHIFT;
+
+static_assert(sizeof(DrawListBuilder::DrawTransform) == 112, "DrawTransform must match the shader's std430 mat4 + mat3 layout");
+
+namespace
+{
+	const int FRUSTUM_PLANES = 6;
+
+	// The six clip planes (left, right, bottom, top, near, far) of a view-projection matrix, normalized
+	void ExtractFrustum(const glm::mat4& m, glm::vec4* planes)
+	{
+		glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		planes[0] = row3 + row0;
+		planes[1] = row3 - row0;
+		planes[2] = row3 + row1;
+		planes[3] = row3 - row1;
+		planes[4] = row3 + row2;
+		planes[5] = row3 - row2;
+		for (int i = 0; i < FRUSTUM_PLANES; ++i)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	bool SphereVisible(const glm::vec4* planes, const glm::vec3& center, float radius)
+	{
+		for (int i = 0; i < FRUSTUM_PLANES; ++i)
+		{
+			if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+				return false;
+		}
+		return true;
+	}
+}
+
+
+// Culls and sorts every object for this frame's view; transforms must be updated first
+void DrawListBuilder::Build(JobSystem& jobs, const TransformHierarchy& transforms, const glm::mat4& viewProjection)
+{
+	PROFILE_FUNCTION();
+
+	glm::vec4 planes[FRUSTUM_PLANES];
+	ExtractFrustum(viewProjection, planes);
+
+	mWorkerItems.resize(jobs.WorkerCount());
+	for (std::vector<DrawItem>& items : mWorkerItems)
+		items.clear();
+
+	jobs.ParallelFor(gObjects.size(), gChunkSize, [&](size_t begin, size_t end, unsigned int worker)
+	{
+		BuildChunk(begin, end, worker, transforms, planes);
+	});
+
+	// merge the worker lists, then order the draws by key
+	{
+		PROFILE_ZONE("merge and sort");
+
+		mMerged.clear();
+		for (const std::vector<DrawItem>& items : mWorkerItems)
+			mMerged.insert(mMerged.end(), items.begin(), items.end());
+		std::sort(mMerged.begin(), mMerged.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+	}
+}
+
+
+void DrawListBuilder::BuildChunk(size_t begin, size_t end, unsigned int worker, const TransformHierarchy& transforms, const glm::vec4* planes)
+{
+	std::vector<DrawItem>& items = mWorkerItems[worker];
+	for (size_t i = begin; i < end; ++i)
+	{
+		const SceneObject& object = gObjects[i];
+		const glm::mat4& world = transforms.World(object.transform);
+		if (!SphereVisible(planes, glm::vec3(world[3]), WorldRadius(object, world)))
+			continue;
+
+		DrawItem item;
+		item.key = ((unsigned long long)object.section << SECTION_SHIFT)
+			| ((unsigned long long)(object.mesh->vao & 0xFFFF) << MESH_SHIFT)
+			| ((unsigned long long)(object.texture->index & 0xFFFF) << TEXTURE_SHIFT)
+			| (i & 0xFFFFFF);
+		item.object = &object;
+		items.push_back(item);
+	}
+}
+
+
+// The mesh's bounding sphere grown by the longest scaled axis
+float DrawListBuilder::WorldRadius(const SceneObject& object, const glm::mat4& world)
+{
+	float scale = std::sqrt(std::max(glm::dot(glm::vec3(world[0]), glm::vec3(world[0])),
+		std::max(glm::dot(glm::vec3(world[1]), glm::vec3(world[1])), glm::dot(glm::vec3(world[2]), glm::vec3(world[2])))));
+	return object.mesh->radius * scale;
+}
+
+
+// Copies the records into buffer, created on first use, and binds it to the shader storage binding
+void DrawListBuilder::UploadTransformBuffer(const std::vector<DrawTransform>& records, GLuint& buffer, GLuint binding)
+{
+	if (buffer == 0)
+		glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(DrawTransform), records.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+}
+
+
+// Fills one DrawTransform per draw, in draw order; destination holds Items().size() records
+void DrawListBuilder::WriteTransforms(JobSystem& jobs, const TransformHierarchy& transforms, DrawTransform* destination) const
+{
+	PROFILE_FUNCTION();
+
+	jobs.ParallelFor(mMerged.size(), gChunkSize, [&](size_t begin, size_t end, unsigned int)
+	{
+		// sequential whole-record writes suit write-combined buffer memory
+		for (size_t i = begin; i < end; ++i)
+		{
+			TransformHierarchy::Node node = mMerged[i].object->transform;
+			DrawTransform& record = destination[i];
+			record.model = transforms.World(node);
+			record.normal = transforms.Normal(node);
+		}
+	});
+}
@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////////////
+// drawlist.h
+// ========
+// builds the frame's draws from the scene's object table in parallel. The
+// objects are split into chunks that run on the job system; each chunk culls
+// its objects against the view frustum, using the world matrices of the
+// scene's transform hierarchy, and makes a sort key, appending to the draw
+// list of the worker it runs on. The per-worker lists are then merged and
+// sorted by key (render section, mesh, texture, object) for a single-threaded
+// GL submission that only rebinds what changes between draws. The model and
+// normal matrices of the sorted draws are written, in parallel, straight into
+// the mapped per-draw buffer the surface shader reads them from.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "meshes.h"
+#include "textures.h"
+#include "jobsystem.h"
+#include "transforms.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+class DrawListBuilder
+{
+public:
+	// How an object's mesh is drawn
+	enum DrawKind
+	{
+		DRAW_ELEMENTS,		// Indexed triangles
+		DRAW_CYLINDER		// Bottom fan, top fan and side strip of the cylinder meshes
+	};
+
+	// One entry of the scene's object table
+	struct SceneObject
+	{
+		int section;							// Render section (GPU profiler range) it is drawn in
+		const Meshes::GLMesh* mesh;
+		DrawKind kind;
+		const Textures::TextureSlot* texture;
+		glm::vec4 color;
+		TransformHierarchy::Node transform;
+		bool dynamic;							// Moves at run time; static objects cast shadows from a cached map
+	};
+
+	// A draw that survived culling and its sort key
+	struct DrawItem
+	{
+		unsigned long long key;
+		const SceneObject* object;
+	};
+
+	// One record of the per-draw buffer, laid out as the shader's std430 struct { mat4 model; mat3 normal; }
+	struct DrawTransform
+	{
+		glm::mat4 model;
+		TransformHierarchy::NormalMatrix normal;
+	};
+
+public:
+	std::vector<SceneObject> gObjects;
+	size_t gChunkSize = 1024;		// Objects per job
+
+public:
+	void Build(JobSystem& jobs, const TransformHierarchy& transforms, const glm::mat4& viewProjection);
+	void WriteTransforms(JobSystem& jobs, const TransformHierarchy& transforms, DrawTransform* destination) const;
+
+	const std::vector<DrawItem>& Items() const { return mMerged; }	// In draw order
+
+	// Radius of an object's bounding sphere under its world matrix; the sphere is centred on world[3]
+	static float WorldRadius(const SceneObject& object, const glm::mat4& world);
+
+	// Matrices of a pass's own draw list (entries with an object member), in its order, bound where the shader reads them
+	template <typename Draw>
+	static void UploadTransforms(const std::vector<Draw>& draws, const TransformHierarchy& transforms, std::vector<DrawTransform>& records,
+		GLuint& buffer, GLuint binding)
+	{
+		records.resize(std::max<size_t>(draws.size(), 1));
+		for (size_t i = 0; i < draws.size(); ++i)
+		{
+			records[i].model = transforms.World(draws[i].object->transform);
+			records[i].normal = transforms.Normal(draws[i].object->transform);
+		}
+		UploadTransformBuffer(records, buffer, binding);
+	}
+	static void UploadTransformBuffer(const std::vector<DrawTransform>& records, GLuint& buffer, GLuint binding);
+
+private:
+	static const int SECTION_SHIFT = 56;
+	static const int MESH_SHIFT = 40;
+	static const int TEXTURE_SHIFT = 24;
+
+	void BuildChunk(size_t begin, size_t end, unsigned int worker, const TransformHierarchy& transforms, const glm::vec4* planes);
+
+	std::vector<std::vector<DrawItem>> mWorkerItems;	// One list per job worker
+	std::vector<DrawItem> mMerged;						// Every worker's draws, sorted by key
+};
@@ -0,0 +1,248 @@
+///////////////////////////////////////////////////////////////////////////////
+// dynamicresolution.cpp
+// ========
+// dynamic resolution scaling. The scene is rendered into the lower-left
+// corner of an offscreen target the size of the output, covering between
+// gMinScale and gMaxScale of its width and height, and then upscaled to the
+// output with a bilinear fetch and a contrast-limited sharpening filter.
+//
+// The scale is steered by the GPU time of whole frames, measured with
+// GL_TIME_ELAPSED queries that are read back FRAME_LATENCY frames later so
+// the controller never stalls the pipeline. Frame cost is taken to grow
+// with the pixel count, so the scale moves by the square root of the ratio
+// between the target and the smoothed frame time, in bounded steps and
+// only after a frame rendered at the current scale has been measured.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "dynamicresolution.h"
+#include "cpuprofiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+const int DynamicResolution::FRAME_LATENCY;
+
+namespace
+{
+	// Weight of a new frame time in the smoothed one
+	const double SMOOTHING = 0.25;
+
+	// No change while the smoothed time is within this share of the target
+	const double DEADBAND = 0.08;
+
+	// Largest change of the scale per adjustment
+	const float MAX_STEP = 0.1f;
+
+	// Scales are multiples of this, so the targets sized from them are not reallocated for noise
+	const float SCALE_QUANTUM = 1.0f / 32.0f;
+}
+
+
+// Reads back the oldest frame's time, adjusts the scale and redirects the frame into the scaled offscreen target
+void DynamicResolution::BeginFrame()
+{
+	mFrameActive = false;
+	if (!gEnabled)
+		return;
+
+	PROFILE_FUNCTION();
+
+	// the output is whatever the viewport covers now; Resolve restores it every frame
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	if ((viewport[2] != mTargetWidth || viewport[3] != mTargetHeight || mFramebuffer == 0) && !Resize(viewport[2], viewport[3]))
+	{
+		gEnabled = false;
+		return;
+	}
+
+	++mFrames;
+	Collect();
+
+	float minScale = std::min(std::max(gMinScale, SCALE_QUANTUM), 1.0f);
+	float maxScale = std::min(std::max(gMaxScale, minScale), 1.0f);
+	mScale = std::min(std::max(mScale, minScale), maxScale);
+	mRenderWidth = std::max(1, (GLint)std::lround(mTargetWidth * mScale));
+	mRenderHeight = std::max(1, (GLint)std::lround(mTargetHeight * mScale));
+	mScaleSum += mScale;
+	mLowestScale = std::min(mLowestScale, mScale);
+
+	int index = (int)(mFrames % FRAME_LATENCY);
+	if (mQueries[index] == 0)
+		glGenQueries(1, &mQueries[index]);
+	glBeginQuery(GL_TIME_ELAPSED, mQueries[index]);
+	mQueryScales[index] = mScale;
+	mQueryIssued[index] = true;
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &mTarget);
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glViewport(0, 0, mRenderWidth, mRenderHeight);
+	mFrameActive = true;
+}
+
+
+// Upscales the rendered corner to the output with the given program and ends the frame's timer query
+void DynamicResolution::Resolve(GLuint upscaleProgram)
+{
+	if (!mFrameActive)
+		return;
+
+	PROFILE_FUNCTION();
+	mFrameActive = false;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mTarget);
+	glViewport(0, 0, mTargetWidth, mTargetHeight);
+
+	// sharpening makes up for the blur of the upscale, so it fades out as the scale nears 1
+	float minScale = std::min(std::max(gMinScale, SCALE_QUANTUM), 1.0f);
+	float sharpness = minScale < 1.0f ? gSharpness * std::min((1.0f - mScale) / (1.0f - minScale), 1.0f) : 0.0f;
+
+	glUseProgram(upscaleProgram);
+	glUniform1i(glGetUniformLocation(upscaleProgram, "uScene"), 0);
+	glUniform2f(glGetUniformLocation(upscaleProgram, "uOutputSize"), (GLfloat)mTargetWidth, (GLfloat)mTargetHeight);
+	glUniform2f(glGetUniformLocation(upscaleProgram, "uRenderSize"), (GLfloat)mRenderWidth, (GLfloat)mRenderHeight);
+	glUniform1f(glGetUniformLocation(upscaleProgram, "uSharpness"), sharpness);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, mColor);
+
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+	if (mFullscreenVao == 0)
+		glGenVertexArrays(1, &mFullscreenVao);
+	glBindVertexArray(mFullscreenVao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	if (depthTest)
+		glEnable(GL_DEPTH_TEST);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+
+// Takes the result of the query issued FRAME_LATENCY frames ago, if it is ready and was rendered at the current scale
+void DynamicResolution::Collect()
+{
+	int index = (int)(mFrames % FRAME_LATENCY);
+	if (!mQueryIssued[index])
+		return;
+	mQueryIssued[index] = false;
+
+	GLint available = GL_FALSE;
+	glGetQueryObjectiv(mQueries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(mQueries[index], GL_QUERY_RESULT, &elapsed);
+	++mMeasuredFrames;
+
+	// frames from before the last change say nothing about the current scale
+	if (mQueryScales[index] == mScale)
+		Adjust(elapsed * 1e-6);
+}
+
+
+// Moves the scale towards the one whose pixel count would take gTargetMs
+void DynamicResolution::Adjust(double frameMs)
+{
+	mSmoothedMs = mSmoothedMs == 0.0 ? frameMs : mSmoothedMs + (frameMs - mSmoothedMs) * SMOOTHING;
+	if (mSmoothedMs <= 0.0)
+		return;
+
+	double ratio = gTargetMs / mSmoothedMs;
+	if (std::abs(ratio - 1.0) <= DEADBAND)
+		return;
+
+	float wanted = mScale * (float)std::sqrt(ratio);
+	wanted = std::min(std::max(wanted, mScale - MAX_STEP), mScale + MAX_STEP);
+	wanted = std::round(wanted / SCALE_QUANTUM) * SCALE_QUANTUM;
+
+	float minScale = std::min(std::max(gMinScale, SCALE_QUANTUM), 1.0f);
+	float maxScale = std::min(std::max(gMaxScale, minScale), 1.0f);
+	wanted = std::min(std::max(wanted, minScale), maxScale);
+	if (wanted != mScale)
+	{
+		mScale = wanted;
+		mSmoothedMs = 0.0;	// start over from the first frame measured at the new scale
+		++mAdjustments;
+	}
+}
+
+
+// Colour texture and depth buffer the size of the output; the scene uses their lower-left corner
+bool DynamicResolution::Resize(GLint width, GLint height)
+{
+	glDeleteFramebuffers(1, &mFramebuffer);
+	glDeleteTextures(1, &mColor);
+	glDeleteRenderbuffers(1, &mDepth);
+	mTargetWidth = width;
+	mTargetHeight = height;
+
+	glGenTextures(1, &mColor);
+	glBindTexture(GL_TEXTURE_2D, mColor);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers(1, &mDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, mDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	GLint previous = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+	glGenFramebuffers(1, &mFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mColor, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, mDepth);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Dynamic resolution framebuffer incomplete: 0x" << std::hex << status << std::dec << "; rendering at full resolution" << std::endl;
+		Destroy();
+		return false;
+	}
+	return true;
+}
+
+
+void DynamicResolution::Destroy()
+{
+	glDeleteFramebuffers(1, &mFramebuffer);
+	glDeleteTextures(1, &mColor);
+	glDeleteRenderbuffers(1, &mDepth);
+	glDeleteVertexArrays(1, &mFullscreenVao);
+	glDeleteQueries(FRAME_LATENCY, mQueries);
+	mFramebuffer = mColor = mDepth = mFullscreenVao = 0;
+	mTargetWidth = mTargetHeight = 0;
+	for (int i = 0; i < FRAME_LATENCY; ++i)
+	{
+		mQueries[i] = 0;
+		mQueryIssued[i] = false;
+	}
+}
+
+
+// Where the controller settled and how often it moved
+void DynamicResolution::WriteJson(std::ostream& out) const
+{
+	out << "{\n  \"enabled\": " << (gEnabled ? "true" : "false")
+		<< ",\n  \"target_ms\": " << gTargetMs
+		<< ",\n  \"smoothed_frame_ms\": " << mSmoothedMs
+		<< ",\n  \"scale\": " << mScale
+		<< ",\n  \"mean_scale\": " << (mFrames > 0 ? mScaleSum / mFrames : 1.0)
+		<< ",\n  \"lowest_scale\": " << mLowestScale
+		<< ",\n  \"frames\": " << mFrames
+		<< ",\n  \"measured_frames\": " << mMeasuredFrames
+		<< ",\n  \"adjustments\": " << mAdjustments
+		<< "\n}" << std::endl;
+}
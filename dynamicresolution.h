@@ -0,0 +1,70 @@
+///////////////////////////////////////////////////////////////////////////////
+// dynamicresolution.h
+// ========
+// dynamic resolution scaling. The scene is rendered into the lower-left
+// corner of an offscreen target the size of the output, covering between
+// gMinScale and gMaxScale of its width and height, and then upscaled to the
+// output with a bilinear fetch and a contrast-limited sharpening filter.
+//
+// The scale is steered by the GPU time of whole frames, measured with
+// GL_TIME_ELAPSED queries that are read back FRAME_LATENCY frames later so
+// the controller never stalls the pipeline. Frame cost is taken to grow
+// with the pixel count, so the scale moves by the square root of the ratio
+// between the target and the smoothed frame time, in bounded steps and
+// only after a frame rendered at the current scale has been measured.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <ostream>
+
+class DynamicResolution
+{
+public:
+	static const int FRAME_LATENCY = 3;		// Timer queries in flight
+
+public:
+	bool gEnabled = false;
+	float gTargetMs = 16.7f;		// GPU frame time the controller holds
+	float gMinScale = 0.5f;			// Share of the output width and height rendered, at least
+	float gMaxScale = 1.0f;
+	float gSharpness = 0.5f;		// Sharpening at gMinScale; it fades out towards full resolution
+
+public:
+	void BeginFrame();
+	void Resolve(GLuint upscaleProgram);
+	void Destroy();
+
+	float Scale() const { return mScale; }
+	void WriteJson(std::ostream& out) const;
+
+private:
+	bool Resize(GLint width, GLint height);
+	void Collect();
+	void Adjust(double frameMs);
+
+	GLuint mFramebuffer = 0;
+	GLuint mColor = 0;				// RGBA8, sampled by the upscale pass
+	GLuint mDepth = 0;
+	GLuint mFullscreenVao = 0;		// Attribute-less VAO; the vertex shader builds the triangle from gl_VertexID
+	GLint mTarget = 0;				// Framebuffer the upscale pass writes to
+	GLint mTargetWidth = 0;			// Size of the offscreen target, the output size
+	GLint mTargetHeight = 0;
+	GLint mRenderWidth = 0;			// Part of it the scene covers this frame
+	GLint mRenderHeight = 0;
+
+	GLuint mQueries[FRAME_LATENCY] = {};
+	float mQueryScales[FRAME_LATENCY] = {};	// Scale each query's frame was rendered at
+	bool mQueryIssued[FRAME_LATENCY] = {};
+	bool mFrameActive = false;		// BeginFrame redirected this frame
+
+	float mScale = 1.0f;
+	double mSmoothedMs = 0.0;
+	unsigned long long mFrames = 0;
+	unsigned long long mMeasuredFrames = 0;
+	unsigned long long mAdjustments = 0;
+	double mScaleSum = 0.0;
+	float mLowestScale = 1.0f;
+};
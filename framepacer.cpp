@@ -0,0 +1,215 @@
+///////////////////////////////////////////////////////////////////////////////
+// framepacer.cpp
+// ========
+// decides when the interactive loop renders. In render-on-change mode a
+// frame is only drawn after something marked the scene dirty (input that
+// moves the camera, a view toggle, a resize or an expose); otherwise the
+// last frame stays on screen and the loop blocks in glfwWaitEventsTimeout
+// instead of spinning. CPU time and skipped frames are tracked so the
+// savings can be reported.
+//
+// It also sets the presentation mode (vsync, adaptive vsync through
+// swap-control-tear, or uncapped) and runs an optional frame limiter that
+// sleeps most of the way to each frame deadline and spins the rest, so the
+// frame rate is even without oversleeping by a scheduler tick.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "framepacer.h"
+
+#include <iostream>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <timeapi.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+#include "cpuprofiler.h"
+
+namespace
+{
+	// The limiter stops sleeping this long before a deadline and spins the rest,
+	// which covers the wake-up latency of a 1 ms scheduler tick
+	const double LIMITER_SPIN_SECONDS = 0.002;
+
+	double SteadySeconds()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+
+// Reads a --present value: vsync, adaptive or uncapped
+bool FramePacer::ParsePresentMode(const char* name, PresentMode& mode)
+{
+	if (strcmp(name, "vsync") == 0)
+		mode = PRESENT_VSYNC;
+	else if (strcmp(name, "adaptive") == 0)
+		mode = PRESENT_ADAPTIVE;
+	else if (strcmp(name, "uncapped") == 0)
+		mode = PRESENT_UNCAPPED;
+	else
+		return false;
+	return true;
+}
+
+
+// Sets the swap interval for the current context; adaptive vsync falls back to vsync without swap-control-tear
+void FramePacer::ApplyPresentMode()
+{
+	int interval = 1;
+	if (gPresentMode == PRESENT_UNCAPPED)
+		interval = 0;
+	else if (gPresentMode == PRESENT_ADAPTIVE)
+	{
+		if (glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+			interval = -1;
+		else
+			std::cout << "Adaptive vsync needs swap-control-tear; using vsync" << std::endl;
+	}
+	glfwSwapInterval(interval);
+}
+
+
+// Starts the wall-clock and CPU-time accounting of the interactive loop
+void FramePacer::Start()
+{
+	mStartTime = glfwGetTime();
+	mStartCpu = ProcessCpuSeconds();
+	mIdleSeconds = 0.0;
+	mRenderedFrames = 0;
+	mIdleWaits = 0;
+	mDirty = true;
+
+	mNextDeadline = SteadySeconds();
+	mLimiterSleepSeconds = 0.0;
+	mLimiterSpinSeconds = 0.0;
+
+#ifdef _WIN32
+	// 1 ms sleep granularity instead of the default 15.6 ms tick
+	if (gTargetFps > 0.0)
+		timeBeginPeriod(1);
+#endif
+}
+
+
+// Releases the timer resolution Start requested
+void FramePacer::Stop()
+{
+#ifdef _WIN32
+	if (gTargetFps > 0.0)
+		timeEndPeriod(1);
+#endif
+}
+
+
+// Frame limiter: sleeps, then spins, until the next frame deadline. Deadlines advance by
+// whole periods so the rate does not drift; after a long stall they restart from now
+void FramePacer::WaitForFrameDeadline()
+{
+	if (gTargetFps <= 0.0)
+		return;
+
+	PROFILE_ZONE("frame limiter");
+
+	double period = 1.0 / gTargetFps;
+	double now = SteadySeconds();
+	if (now - mNextDeadline > period)
+		mNextDeadline = now;
+
+	double sleepSeconds = mNextDeadline - now - LIMITER_SPIN_SECONDS;
+	if (sleepSeconds > 0.0)
+	{
+		std::this_thread::sleep_for(std::chrono::duration<double>(sleepSeconds));
+		mLimiterSleepSeconds += SteadySeconds() - now;
+	}
+
+	double spinStart = SteadySeconds();
+	while (SteadySeconds() < mNextDeadline)
+		std::this_thread::yield();
+	mLimiterSpinSeconds += SteadySeconds() - spinStart;
+
+	mNextDeadline += period;
+}
+
+
+// Something visible changed; the next loop iteration renders
+void FramePacer::MarkDirty()
+{
+	mDirty = true;
+}
+
+
+bool FramePacer::ShouldRender() const
+{
+	return !gRenderOnChange || mDirty;
+}
+
+
+void FramePacer::FrameRendered()
+{
+	mDirty = false;
+	++mRenderedFrames;
+}
+
+
+// Blocks until an event arrives or the timeout passes; the last frame stays on screen
+void FramePacer::WaitForEvents()
+{
+	PROFILE_ZONE("idle wait");
+
+	double start = glfwGetTime();
+	glfwWaitEventsTimeout(gIdleTimeout);
+	mIdleSeconds += glfwGetTime() - start;
+	++mIdleWaits;
+}
+
+
+// Prints how much rendering and CPU time render-on-change saved against a continuous loop
+void FramePacer::PrintIdleReport() const
+{
+	double wallSeconds = glfwGetTime() - mStartTime;
+	double cpuSeconds = ProcessCpuSeconds() - mStartCpu;
+	double continuousFrames = wallSeconds * gRefreshRate;
+	double skippedFrames = continuousFrames > mRenderedFrames ? continuousFrames - mRenderedFrames : 0.0;
+
+	std::cout << "{\n  \"render_on_change\": " << (gRenderOnChange ? "true" : "false")
+		<< ",\n  \"wall_s\": " << wallSeconds
+		<< ",\n  \"idle_s\": " << mIdleSeconds
+		<< ",\n  \"idle_share\": " << (wallSeconds > 0.0 ? mIdleSeconds / wallSeconds : 0.0)
+		<< ",\n  \"rendered_frames\": " << mRenderedFrames
+		<< ",\n  \"frames_skipped_vs_continuous\": " << (unsigned long long)skippedFrames
+		<< ",\n  \"process_cpu_s\": " << cpuSeconds
+		<< ",\n  \"cpu_utilization\": " << (wallSeconds > 0.0 ? cpuSeconds / wallSeconds : 0.0)
+		<< ",\n  \"target_fps\": " << gTargetFps
+		<< ",\n  \"limiter_sleep_s\": " << mLimiterSleepSeconds
+		<< ",\n  \"limiter_spin_s\": " << mLimiterSpinSeconds
+		<< "\n}" << std::endl;
+}
+
+
+// CPU time used by the whole process (all threads), in seconds
+double FramePacer::ProcessCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0.0;
+
+	ULARGE_INTEGER kernelTime, userTime;
+	kernelTime.LowPart = kernel.dwLowDateTime;
+	kernelTime.HighPart = kernel.dwHighDateTime;
+	userTime.LowPart = user.dwLowDateTime;
+	userTime.HighPart = user.dwHighDateTime;
+	return (kernelTime.QuadPart + userTime.QuadPart) * 100e-9;
+#else
+	// clock() is process CPU time on POSIX systems (it is wall time on Windows)
+	return (double)std::clock() / CLOCKS_PER_SEC;
+#endif
+}
@@ -0,0 +1,63 @@
+///////////////////////////////////////////////////////////////////////////////
+// framepacer.h
+// ========
+// decides when the interactive loop renders. In render-on-change mode a
+// frame is only drawn after something marked the scene dirty (input that
+// moves the camera, a view toggle, a resize or an expose); otherwise the
+// last frame stays on screen and the loop blocks in glfwWaitEventsTimeout
+// instead of spinning. CPU time and skipped frames are tracked so the
+// savings can be reported.
+//
+// It also sets the presentation mode (vsync, adaptive vsync through
+// swap-control-tear, or uncapped) and runs an optional frame limiter that
+// sleeps most of the way to each frame deadline and spins the rest, so the
+// frame rate is even without oversleeping by a scheduler tick.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLFW/glfw3.h>
+
+class FramePacer
+{
+public:
+	// How swaps are synchronised with the display
+	enum PresentMode
+	{
+		PRESENT_VSYNC,			// Swap interval 1
+		PRESENT_ADAPTIVE,		// Swap interval -1: tear instead of waiting a whole refresh when late
+		PRESENT_UNCAPPED		// Swap interval 0, for benchmarking
+	};
+
+public:
+	PresentMode gPresentMode = PRESENT_VSYNC;
+	double gTargetFps = 0.0;		// Frame limiter target, 0 for no limiter
+	bool gRenderOnChange = false;	// Skip frames while nothing changes
+	double gIdleTimeout = 0.5;		// Longest blocking wait (seconds) before the loop runs again
+	double gRefreshRate = 60.0;		// Display rate a continuous loop would render at
+
+public:
+	static bool ParsePresentMode(const char* name, PresentMode& mode);
+	void ApplyPresentMode();
+	void Start();
+	void Stop();
+	void WaitForFrameDeadline();
+	void MarkDirty();
+	bool ShouldRender() const;
+	void FrameRendered();
+	void WaitForEvents();
+	void PrintIdleReport() const;
+
+private:
+	static double ProcessCpuSeconds();
+
+	bool mDirty = true;				// First frame always renders
+	double mStartTime = 0.0;		// glfwGetTime when the loop started
+	double mStartCpu = 0.0;			// Process CPU seconds when the loop started
+	double mIdleSeconds = 0.0;		// Time spent blocked waiting for events
+	unsigned long long mRenderedFrames = 0;
+	unsigned long long mIdleWaits = 0;
+	double mNextDeadline = 0.0;		// Frame limiter: steady-clock seconds the next frame may start at
+	double mLimiterSleepSeconds = 0.0;
+	double mLimiterSpinSeconds = 0.0;
+};
@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////////////
+// gbuffer.cpp
+// ========
+// render targets of the deferred path. The geometry pass writes albedo
+// (RGBA8), the world-space normal (RGBA16F) and depth (32-bit float) into
+// an offscreen framebuffer; the lighting pass then reads them back with
+// texelFetch in a single full-screen triangle and writes the lit colour
+// and the scene depth into whatever framebuffer was bound before the
+// geometry pass, so later forward draws still depth test against the scene.
+// The targets follow the viewport size and are reallocated when it changes.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "gbuffer.h"
+
+#include <iostream>
+
+namespace
+{
+	GLuint CreateTarget(GLenum internalFormat, GLint width, GLint height)
+	{
+		GLuint texture = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+}
+
+
+// Binds and clears the G-buffer, remembering the framebuffer the lighting pass returns to
+bool GBuffer::BeginGeometryPass(GLint width, GLint height)
+{
+	if ((width != gWidth || height != gHeight || mFramebuffer == 0) && !Resize(width, height))
+		return false;
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &mTarget);
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+
+	const GLfloat zero[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const GLfloat farDepth = 1.0f;
+	glClearBufferfv(GL_COLOR, 0, zero);
+	glClearBufferfv(GL_COLOR, 1, zero);
+	glClearBufferfv(GL_DEPTH, 0, &farDepth);
+	return true;
+}
+
+
+void GBuffer::EndGeometryPass()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mTarget);
+}
+
+
+// Albedo, normal and depth on three consecutive texture units
+void GBuffer::BindTextures(GLuint firstUnit)
+{
+	const GLuint targets[] = { mAlbedo, mNormal, mDepth };
+	for (GLuint i = 0; i < 3; ++i)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, targets[i]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+
+// One triangle covering the viewport; the lighting program has no vertex inputs
+void GBuffer::DrawFullscreen()
+{
+	if (mFullscreenVao == 0)
+		glGenVertexArrays(1, &mFullscreenVao);
+	glBindVertexArray(mFullscreenVao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+}
+
+
+// (Re)allocates the three targets at the viewport size
+bool GBuffer::Resize(GLint width, GLint height)
+{
+	Destroy();
+	gWidth = width;
+	gHeight = height;
+
+	mAlbedo = CreateTarget(GL_RGBA8, width, height);
+	mNormal = CreateTarget(GL_RGBA16F, width, height);
+	mDepth = CreateTarget(GL_DEPTH_COMPONENT32F, width, height);
+
+	GLint previous = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+	glGenFramebuffers(1, &mFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mAlbedo, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mNormal, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mDepth, 0);
+	const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "G-buffer framebuffer incomplete: 0x" << std::hex << status << std::dec << std::endl;
+		Destroy();
+		return false;
+	}
+	return true;
+}
+
+
+void GBuffer::Destroy()
+{
+	glDeleteFramebuffers(1, &mFramebuffer);
+	glDeleteTextures(1, &mAlbedo);
+	glDeleteTextures(1, &mNormal);
+	glDeleteTextures(1, &mDepth);
+	glDeleteVertexArrays(1, &mFullscreenVao);
+	mFramebuffer = mAlbedo = mNormal = mDepth = mFullscreenVao = 0;
+	gWidth = gHeight = 0;
+}
@@ -0,0 +1,39 @@
+///////////////////////////////////////////////////////////////////////////////
+// gbuffer.h
+// ========
+// render targets of the deferred path. The geometry pass writes albedo
+// (RGBA8), the world-space normal (RGBA16F) and depth (32-bit float) into
+// an offscreen framebuffer; the lighting pass then reads them back with
+// texelFetch in a single full-screen triangle and writes the lit colour
+// and the scene depth into whatever framebuffer was bound before the
+// geometry pass, so later forward draws still depth test against the scene.
+// The targets follow the viewport size and are reallocated when it changes.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+class GBuffer
+{
+public:
+	GLint gWidth = 0;
+	GLint gHeight = 0;
+
+public:
+	bool BeginGeometryPass(GLint width, GLint height);
+	void EndGeometryPass();
+	void BindTextures(GLuint firstUnit);
+	void DrawFullscreen();
+	void Destroy();
+
+private:
+	bool Resize(GLint width, GLint height);
+
+	GLuint mFramebuffer = 0;
+	GLuint mAlbedo = 0;
+	GLuint mNormal = 0;
+	GLuint mDepth = 0;
+	GLuint mFullscreenVao = 0;		// Attribute-less VAO; the vertex shader builds the triangle from gl_VertexID
+	GLint mTarget = 0;				// Framebuffer the lighting pass writes to
+};
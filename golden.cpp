@@ -0,0 +1,202 @@
+///////////////////////////////////////////////////////////////////////////////
+// golden.cpp
+// ========
+// golden-image regression checks: the scene is rendered headless from a
+// fixed set of camera poses and every frame is compared against a stored
+// reference image. A pose passes when its PSNR is above the threshold and
+// few enough pixels differ visibly, so driver rounding is tolerated but a
+// changed image is not. Failing poses leave the actual image and an
+// amplified difference image next to the reference for inspection.
+//
+// References are binary PPMs named after the pose; they are regenerated with
+// --update-golden after an intended change to the image. Frames that are
+// black, uniform or made of a handful of flat colours (nothing lit or
+// textured) fail without being compared and are never written as references.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "golden.h"
+#include "headless.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "stb_image.h"
+
+const int GoldenImages::IMAGE_WIDTH;
+const int GoldenImages::IMAGE_HEIGHT;
+
+namespace
+{
+	// Rendered frames are RGBA8, bottom row first
+	const int PIXEL_CHANNELS = 4;
+
+	// A channel difference above this is visible rather than rounding
+	const int VISIBLE_DIFFERENCE = 16;
+
+	// Difference images are amplified so small errors show up
+	const int DIFFERENCE_GAIN = 4;
+
+	// PSNR reported for identical images
+	const double IDENTICAL_PSNR = 100.0;
+
+	// A frame darker than this mean luminance, flatter than this deviation or
+	// with fewer distinct colours than this is blank, not a rendered scene
+	const double MIN_MEAN_LUMINANCE = 8.0;
+	const double MIN_LUMINANCE_DEVIATION = 4.0;
+	const size_t MIN_DISTINCT_COLOURS = 64;
+
+	// Orbit the table is viewed from, matching the scripted benchmark path
+	const glm::vec3 ORBIT_CENTER(2.5f, 1.0f, 0.0f);
+	const float ORBIT_RADIUS = 16.0f;
+	const float ORBIT_HEIGHT = 4.0f;
+}
+
+
+// The default camera, the orthographic view and four views around the table
+std::vector<GoldenImages::Pose> GoldenImages::Poses(const Benchmark::CameraKey& defaultCamera)
+{
+	std::vector<Pose> poses;
+	poses.push_back({ "default", defaultCamera, false });
+	poses.push_back({ "ortho", defaultCamera, true });
+
+	for (int angle = 45; angle < 360; angle += 90)
+	{
+		float radians = glm::radians((float)angle);
+		Pose pose;
+		pose.name = "orbit_" + std::to_string(angle);
+		pose.camera.position = ORBIT_CENTER + glm::vec3(ORBIT_RADIUS * std::cos(radians), ORBIT_HEIGHT, ORBIT_RADIUS * std::sin(radians));
+		pose.camera.yaw = angle + 180.0f;
+		pose.camera.pitch = -glm::degrees(std::atan2(ORBIT_HEIGHT, ORBIT_RADIUS));
+		pose.ortho = false;
+		poses.push_back(pose);
+	}
+	return poses;
+}
+
+
+// Compares a rendered frame with the pose's reference, or replaces the reference when updating
+bool GoldenImages::Check(const Pose& pose, const std::vector<unsigned char>& pixels, int width, int height)
+{
+	std::string referencePath = ImagePath(pose.name, "");
+
+	// a broken render must neither pass nor become the reference
+	if (IsBlank(pixels, width, height))
+	{
+		std::cout << "Pose " << pose.name << " rendered a blank frame; see " << ImagePath(pose.name, ".actual") << std::endl;
+		Headless::WritePPM(ImagePath(pose.name, ".actual").c_str(), pixels, width, height);
+		mResults.push_back({ pose.name, 0.0, 1.0, true, false });
+		return false;
+	}
+
+	if (gUpdate)
+	{
+		bool written = Headless::WritePPM(referencePath.c_str(), pixels, width, height);
+		mResults.push_back({ pose.name, IDENTICAL_PSNR, 0.0, false, written });
+		return written;
+	}
+
+	int referenceWidth, referenceHeight, channels;
+	unsigned char* reference = stbi_load(referencePath.c_str(), &referenceWidth, &referenceHeight, &channels, 3);
+	if (!reference || referenceWidth != width || referenceHeight != height)
+	{
+		std::cout << "Missing or mismatched reference " << referencePath << "; run --update-golden first" << std::endl;
+		stbi_image_free(reference);
+		mResults.push_back({ pose.name, 0.0, 1.0, false, false });
+		return false;
+	}
+
+	// the reference is stored top row first, the frame bottom row first
+	double squaredError = 0.0;
+	size_t visible = 0;
+	std::vector<unsigned char> difference(pixels.size(), 255);
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char* referenceRow = reference + size_t(height - 1 - y) * width * 3;
+		for (int x = 0; x < width; ++x)
+		{
+			size_t index = (size_t(y) * width + x) * PIXEL_CHANNELS;
+			int largest = 0;
+			for (int c = 0; c < 3; ++c)
+			{
+				int delta = std::abs(int(pixels[index + c]) - int(referenceRow[x * 3 + c]));
+				squaredError += double(delta) * delta;
+				largest = std::max(largest, delta);
+				difference[index + c] = (unsigned char)std::min(delta * DIFFERENCE_GAIN, 255);
+			}
+			if (largest > VISIBLE_DIFFERENCE)
+				++visible;
+		}
+	}
+	stbi_image_free(reference);
+
+	double meanSquaredError = squaredError / (double(width) * height * 3);
+	Result result;
+	result.name = pose.name;
+	result.psnr = meanSquaredError > 0.0 ? std::min(10.0 * std::log10(255.0 * 255.0 / meanSquaredError), IDENTICAL_PSNR) : IDENTICAL_PSNR;
+	result.badPixels = double(visible) / (double(width) * height);
+	result.blank = false;
+	result.passed = result.psnr >= gMinPsnr && result.badPixels <= gMaxBadPixels;
+	mResults.push_back(result);
+
+	if (!result.passed)
+	{
+		Headless::WritePPM(ImagePath(pose.name, ".actual").c_str(), pixels, width, height);
+		Headless::WritePPM(ImagePath(pose.name, ".diff").c_str(), difference, width, height);
+	}
+	return result.passed;
+}
+
+
+// Prints the JSON summary; true when every pose passed
+bool GoldenImages::Report() const
+{
+	bool passed = !mResults.empty();
+	std::cout << "{\n  \"mode\": \"" << (gUpdate ? "update" : "compare") << "\",\n  \"min_psnr\": " << gMinPsnr
+		<< ",\n  \"max_bad_pixels\": " << gMaxBadPixels << ",\n  \"poses\": [";
+	for (size_t i = 0; i < mResults.size(); ++i)
+	{
+		const Result& result = mResults[i];
+		std::cout << (i ? "," : "") << "\n    { \"name\": \"" << result.name << "\", \"psnr\": " << result.psnr
+			<< ", \"bad_pixels\": " << result.badPixels << ", \"blank\": " << (result.blank ? "true" : "false") << ", \"passed\": " << (result.passed ? "true" : "false") << " }";
+		passed = passed && result.passed;
+	}
+	std::cout << "\n  ],\n  \"passed\": " << (passed ? "true" : "false") << "\n}" << std::endl;
+	return passed;
+}
+
+
+// True for a black or uniform frame, or one of a few flat colours as when nothing is lit or textured
+bool GoldenImages::IsBlank(const std::vector<unsigned char>& pixels, int width, int height)
+{
+	size_t count = size_t(width) * height;
+	if (count == 0 || pixels.size() < count * PIXEL_CHANNELS)
+		return true;
+
+	double sum = 0.0, squaredSum = 0.0;
+	std::vector<unsigned int> colours(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const unsigned char* pixel = &pixels[i * PIXEL_CHANNELS];
+		double luminance = 0.2126 * pixel[0] + 0.7152 * pixel[1] + 0.0722 * pixel[2];
+		sum += luminance;
+		squaredSum += luminance * luminance;
+		colours[i] = (unsigned int)pixel[0] << 16 | (unsigned int)pixel[1] << 8 | pixel[2];
+	}
+	std::sort(colours.begin(), colours.end());
+	size_t distinct = std::unique(colours.begin(), colours.end()) - colours.begin();
+
+	double mean = sum / count;
+	double deviation = std::sqrt(std::max(squaredSum / count - mean * mean, 0.0));
+	return mean < MIN_MEAN_LUMINANCE || deviation < MIN_LUMINANCE_DEVIATION || distinct < MIN_DISTINCT_COLOURS;
+}
+
+
+std::string GoldenImages::ImagePath(const std::string& name, const char* suffix) const
+{
+	std::string path = gDirectory;
+	if (!path.empty() && path.back() != '/' && path.back() != '\\')
+		path += '/';
+	return path + name + suffix + ".ppm";
+}
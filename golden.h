@@ -0,0 +1,65 @@
+///////////////////////////////////////////////////////////////////////////////
+// golden.h
+// ========
+// golden-image regression checks: the scene is rendered headless from a
+// fixed set of camera poses and every frame is compared against a stored
+// reference image. A pose passes when its PSNR is above the threshold and
+// few enough pixels differ visibly, so driver rounding is tolerated but a
+// changed image is not. Failing poses leave the actual image and an
+// amplified difference image next to the reference for inspection.
+//
+// References are binary PPMs named after the pose; they are regenerated with
+// --update-golden after an intended change to the image. Frames that are
+// black, uniform or made of a handful of flat colours (nothing lit or
+// textured) fail without being compared and are never written as references.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "benchmark.h"
+
+#include <string>
+#include <vector>
+
+class GoldenImages
+{
+public:
+	// One camera placement the scene is checked from
+	struct Pose
+	{
+		std::string name;
+		Benchmark::CameraKey camera;
+		bool ortho;				// Rendered with the 'P' orthographic view
+	};
+
+private:
+	// Outcome of one pose
+	struct Result
+	{
+		std::string name;
+		double psnr;
+		double badPixels;		// Fraction of pixels with a visible difference
+		bool blank;				// Rejected as black, uniform or flat before any comparison
+		bool passed;
+	};
+
+public:
+	std::string gDirectory;			// Folder holding the reference images
+	bool gUpdate = false;			// Write the references instead of comparing
+	double gMinPsnr = 35.0;			// dB
+	double gMaxBadPixels = 0.01;	// Fraction of the image
+
+	static const int IMAGE_WIDTH = 320;		// Golden images are rendered small to keep references light
+	static const int IMAGE_HEIGHT = 240;
+
+public:
+	static std::vector<Pose> Poses(const Benchmark::CameraKey& defaultCamera);
+	bool Check(const Pose& pose, const std::vector<unsigned char>& pixels, int width, int height);
+	bool Report() const;
+
+private:
+	std::string ImagePath(const std::string& name, const char* suffix) const;
+	static bool IsBlank(const std::vector<unsigned char>& pixels, int width, int height);
+
+	std::vector<Result> mResults;
+};
@@ -0,0 +1,209 @@
+///////////////////////////////////////////////////////////////////////////////
+// gpuprofiler.cpp
+// ========
+// GPU time per render section: a GL_TIMESTAMP query is issued at the start
+// and end of every section. Each frame uses its own set of queries out of
+// FRAME_LATENCY sets, and a set is only read back when it comes round again,
+// so reading results never stalls the pipeline (results not ready by then
+// are dropped). Times are kept in a rolling window per section and as
+// running totals for benchmark reports.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "gpuprofiler.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+const int GpuProfiler::FRAME_LATENCY;
+const int GpuProfiler::ROLLING_FRAMES;
+
+
+// Moves on to the next query set, reading back the frame that used it last
+void GpuProfiler::BeginFrame()
+{
+	if (mOpen)
+		End();
+
+	++mFrame;
+	Collect(mFrames[mFrame % FRAME_LATENCY], false);
+}
+
+
+// Starts timing a section; an unfinished section is ended first
+void GpuProfiler::Begin(const char* name)
+{
+	if (!gEnabled)
+		return;
+	if (mOpen)
+		End();
+
+	FrameQueries& frame = mFrames[mFrame % FRAME_LATENCY];
+	if (frame.queries.size() < (frame.used + 1) * 2)
+	{
+		GLuint pair[2];
+		glGenQueries(2, pair);
+		frame.queries.push_back(pair[0]);
+		frame.queries.push_back(pair[1]);
+		frame.sections.push_back(0);
+	}
+
+	frame.sections[frame.used] = FindSection(name);
+	glQueryCounter(frame.queries[frame.used * 2], GL_TIMESTAMP);
+	mOpen = true;
+}
+
+
+void GpuProfiler::End()
+{
+	if (!mOpen)
+		return;
+
+	FrameQueries& frame = mFrames[mFrame % FRAME_LATENCY];
+	glQueryCounter(frame.queries[frame.used * 2 + 1], GL_TIMESTAMP);
+	++frame.used;
+	mOpen = false;
+}
+
+
+// Waits for every frame still in flight; used once a benchmark run is over
+void GpuProfiler::Flush()
+{
+	if (mOpen)
+		End();
+
+	for (int i = 1; i <= FRAME_LATENCY; ++i)
+		Collect(mFrames[(mFrame + i) % FRAME_LATENCY], true);
+}
+
+
+// Clears the collected timings, keeping the sections and their order
+void GpuProfiler::Reset()
+{
+	for (Section& section : mSections)
+	{
+		section.samples.clear();
+		section.nextSample = 0;
+		section.totalMs = 0.0;
+		section.maxMs = 0.0;
+		section.count = 0;
+	}
+	gDroppedFrames = 0;
+}
+
+
+void GpuProfiler::Destroy()
+{
+	for (FrameQueries& frame : mFrames)
+	{
+		if (!frame.queries.empty())
+			glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+		frame.queries.clear();
+		frame.sections.clear();
+		frame.used = 0;
+	}
+	mOpen = false;
+}
+
+
+// Prints the rolling profile, one line per section in render order
+void GpuProfiler::Print() const
+{
+	double frameMs = 0.0;
+	std::vector<double> averages;
+	for (const Section& section : mSections)
+	{
+		double sum = 0.0;
+		for (double sample : section.samples)
+			sum += sample;
+		averages.push_back(section.samples.empty() ? 0.0 : sum / section.samples.size());
+		frameMs += averages.back();
+	}
+
+	std::cout << "GPU profile over the last " << ROLLING_FRAMES << " frames (" << gDroppedFrames << " dropped)" << std::endl;
+	for (size_t i = 0; i < mSections.size(); ++i)
+	{
+		const Section& section = mSections[i];
+		double windowMax = section.samples.empty() ? 0.0 : *std::max_element(section.samples.begin(), section.samples.end());
+		std::cout << "  " << std::left << std::setw(14) << section.name << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(9) << averages[i] << " ms avg" << std::setw(9) << windowMax << " ms max"
+			<< std::setprecision(1) << std::setw(7) << (frameMs > 0.0 ? 100.0 * averages[i] / frameMs : 0.0) << " %" << std::endl;
+	}
+	std::cout << "  " << std::left << std::setw(14) << "total" << std::right << std::setprecision(3)
+		<< std::setw(9) << frameMs << " ms avg" << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+}
+
+
+// Writes the running totals as a JSON object keyed by section name
+void GpuProfiler::WriteJson(std::ostream& out) const
+{
+	out << "{";
+	for (size_t i = 0; i < mSections.size(); ++i)
+	{
+		const Section& section = mSections[i];
+		out << (i ? "," : "") << "\n    \"" << section.name << "\": { \"mean\": "
+			<< (section.count ? section.totalMs / section.count : 0.0)
+			<< ", \"max\": " << section.maxMs << ", \"samples\": " << section.count << " }";
+	}
+	out << "\n  }";
+}
+
+
+size_t GpuProfiler::FindSection(const char* name)
+{
+	for (size_t i = 0; i < mSections.size(); ++i)
+	{
+		if (mSections[i].name == name)
+			return i;
+	}
+
+	Section section = {};
+	section.name = name;
+	mSections.push_back(section);
+	return mSections.size() - 1;
+}
+
+
+// Reads back one frame's queries; without wait, a frame that is not finished is dropped
+bool GpuProfiler::Collect(FrameQueries& frame, bool wait)
+{
+	if (frame.used == 0)
+		return true;
+
+	if (!wait)
+	{
+		// the last timestamp of the frame completes after all the others
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(frame.queries[frame.used * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			++gDroppedFrames;
+			frame.used = 0;
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < frame.used; ++i)
+	{
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(frame.queries[i * 2], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(frame.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+		double ms = (end - begin) / 1.0e6;
+
+		Section& section = mSections[frame.sections[i]];
+		if (section.samples.size() < (size_t)ROLLING_FRAMES)
+			section.samples.push_back(ms);
+		else
+			section.samples[section.nextSample] = ms;
+		section.nextSample = (section.nextSample + 1) % ROLLING_FRAMES;
+
+		section.totalMs += ms;
+		section.maxMs = std::max(section.maxMs, ms);
+		++section.count;
+	}
+
+	frame.used = 0;
+	return true;
+}
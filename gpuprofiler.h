@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+// gpuprofiler.h
+// ========
+// GPU time per render section: a GL_TIMESTAMP query is issued at the start
+// and end of every section. Each frame uses its own set of queries out of
+// FRAME_LATENCY sets, and a set is only read back when it comes round again,
+// so reading results never stalls the pipeline (results not ready by then
+// are dropped). Times are kept in a rolling window per section and as
+// running totals for benchmark reports.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+class GpuProfiler
+{
+public:
+	static const int FRAME_LATENCY = 3;		// Query sets in flight
+	static const int ROLLING_FRAMES = 120;	// Samples kept per section for the rolling profile
+
+private:
+	// Timings collected for one named section
+	struct Section
+	{
+		std::string name;
+		std::vector<double> samples;	// Rolling window of GPU times (ms)
+		size_t nextSample;
+		double totalMs;					// Running totals since the last Reset
+		double maxMs;
+		unsigned long long count;
+	};
+
+	// Queries issued during one frame
+	struct FrameQueries
+	{
+		std::vector<GLuint> queries;	// Begin/end timestamp pairs
+		std::vector<size_t> sections;	// Section of each pair
+		size_t used;
+	};
+
+public:
+	bool gEnabled = true;
+	unsigned long long gDroppedFrames = 0;	// Frames whose results were not ready in time
+
+public:
+	void BeginFrame();
+	void Begin(const char* name);
+	void End();
+	void Flush();
+	void Reset();
+	void Destroy();
+
+	void Print() const;
+	void WriteJson(std::ostream& out) const;
+
+private:
+	size_t FindSection(const char* name);
+	bool Collect(FrameQueries& frame, bool wait);
+
+	std::vector<Section> mSections;
+	FrameQueries mFrames[FRAME_LATENCY] = {};
+	unsigned long long mFrame = 0;
+	bool mOpen = false;					// A section has begun and not ended
+};
@@ -0,0 +1,294 @@
+///////////////////////////////////////////////////////////////////////////////
+// headless.cpp
+// ========
+// offscreen rendering without a window system: an EGL context (surfaceless,
+// or a pbuffer when surfaceless contexts are not supported) on Linux, so it
+// runs on Mesa llvmpipe, or a hidden GLFW window elsewhere. The scene is
+// rendered into a framebuffer object and read back to write images.
+//
+// Linux builds link against libEGL for this module and never initialize
+// GLFW, so they run where no display is available.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "headless.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+
+#if defined(__linux__)
+#define HEADLESS_EGL 1
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
+#include <GLFW/glfw3.h>
+#endif
+
+namespace
+{
+	// Every headless frame is read back as RGBA8
+	const int PIXEL_CHANNELS = 4;
+
+#ifdef HEADLESS_EGL
+	// Picks the surfaceless Mesa platform when the client supports it, so no
+	// X or Wayland connection is ever attempted
+	EGLDisplay GetHeadlessDisplay()
+	{
+		const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		if (clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless"))
+		{
+			PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+				(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+			if (getPlatformDisplay)
+			{
+				EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+				if (display != EGL_NO_DISPLAY)
+					return display;
+			}
+		}
+		return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+#endif
+}
+
+
+// Creates a current OpenGL 4.4 core context that needs no display
+bool Headless::CreateContext(int width, int height)
+{
+#ifdef HEADLESS_EGL
+	// the frame size only matters to the framebuffer object; EGL needs no surface of that size
+	(void)width;
+	(void)height;
+
+	EGLDisplay display = GetHeadlessDisplay();
+	EGLint major, minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+	{
+		std::cout << "Failed to initialize an EGL display" << std::endl;
+		return false;
+	}
+	mDisplay = display;
+
+	const char* displayExtensions = eglQueryString(display, EGL_EXTENSIONS);
+	bool surfaceless = displayExtensions && strstr(displayExtensions, "EGL_KHR_surfaceless_context");
+
+	const EGLint configAttributes[] = {
+		EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint configCount = 0;
+	if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+	{
+		std::cout << "No EGL config supports desktop OpenGL" << std::endl;
+		Destroy();
+		return false;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		std::cout << "EGL cannot bind the desktop OpenGL API" << std::endl;
+		Destroy();
+		return false;
+	}
+
+	const EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 4,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+	if (context == EGL_NO_CONTEXT)
+	{
+		std::cout << "Failed to create an OpenGL 4.4 core EGL context" << std::endl;
+		Destroy();
+		return false;
+	}
+	mContext = context;
+
+	// Without surfaceless contexts a small pbuffer only serves to make the
+	// context current; the scene itself still renders into the framebuffer object
+	EGLSurface surface = EGL_NO_SURFACE;
+	if (!surfaceless)
+	{
+		const EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+		if (surface == EGL_NO_SURFACE)
+		{
+			std::cout << "Failed to create an EGL pbuffer" << std::endl;
+			Destroy();
+			return false;
+		}
+		mSurface = surface;
+	}
+
+	if (!eglMakeCurrent(display, surface, surface, context))
+	{
+		std::cout << "Failed to make the EGL context current" << std::endl;
+		Destroy();
+		return false;
+	}
+
+	std::cout << "Headless EGL " << major << "." << minor << (surfaceless ? " (surfaceless)" : " (pbuffer)") << std::endl;
+#else
+	// Other platforms keep GLFW but never show the window
+	if (!glfwInit())
+	{
+		std::cout << "Failed to initialize GLFW" << std::endl;
+		return false;
+	}
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow* window = glfwCreateWindow(width, height, "Headless", NULL, NULL);
+	if (window == NULL)
+	{
+		std::cout << "Failed to create a hidden GLFW window" << std::endl;
+		glfwTerminate();
+		return false;
+	}
+	glfwMakeContextCurrent(window);
+	mDisplay = window;
+#endif
+
+	return true;
+}
+
+
+// Creates the framebuffer object the scene renders into; needs GLEW to be initialized
+bool Headless::CreateRenderTarget(int width, int height)
+{
+	gWidth = width;
+	gHeight = height;
+
+	glGenRenderbuffers(1, &gColorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, gColorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	glGenRenderbuffers(1, &gDepthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, gDepthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &gFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, gFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, gColorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gDepthBuffer);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Offscreen framebuffer incomplete: 0x" << std::hex << status << std::dec << std::endl;
+		return false;
+	}
+
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+
+void Headless::BindRenderTarget()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, gFramebuffer);
+	glViewport(0, 0, gWidth, gHeight);
+}
+
+
+// Reads the finished frame back as RGBA8, bottom row first
+bool Headless::ReadPixels(std::vector<unsigned char>& pixels)
+{
+	if (gFramebuffer == 0)
+		return false;
+
+	pixels.resize(size_t(gWidth) * gHeight * PIXEL_CHANNELS);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, gFramebuffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, gWidth, gHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	return glGetError() == GL_NO_ERROR;
+}
+
+
+bool Headless::WriteImage(const char* filename)
+{
+	std::vector<unsigned char> pixels;
+	if (!ReadPixels(pixels))
+	{
+		std::cout << "Failed to read back the offscreen frame" << std::endl;
+		return false;
+	}
+	return WritePPM(filename, pixels, gWidth, gHeight);
+}
+
+
+// Writes RGBA8 pixels (bottom row first, as read back from GL) as a binary PPM
+bool Headless::WritePPM(const char* filename, const std::vector<unsigned char>& pixels, int width, int height)
+{
+	std::ofstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		std::cout << "Failed to open " << filename << " for writing" << std::endl;
+		return false;
+	}
+
+	file << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<unsigned char> row(size_t(width) * 3);
+	for (int y = height - 1; y >= 0; --y)
+	{
+		const unsigned char* source = &pixels[size_t(y) * width * PIXEL_CHANNELS];
+		for (int x = 0; x < width; ++x)
+		{
+			row[x * 3 + 0] = source[x * PIXEL_CHANNELS + 0];
+			row[x * 3 + 1] = source[x * PIXEL_CHANNELS + 1];
+			row[x * 3 + 2] = source[x * PIXEL_CHANNELS + 2];
+		}
+		file.write((const char*)row.data(), row.size());
+	}
+
+	std::cout << "Wrote " << filename << " (" << width << "x" << height << ")" << std::endl;
+	return bool(file);
+}
+
+
+void Headless::Destroy()
+{
+	if (mContext || mDisplay)
+	{
+		if (gFramebuffer)
+			glDeleteFramebuffers(1, &gFramebuffer);
+		if (gColorBuffer)
+			glDeleteRenderbuffers(1, &gColorBuffer);
+		if (gDepthBuffer)
+			glDeleteRenderbuffers(1, &gDepthBuffer);
+	}
+	gFramebuffer = gColorBuffer = gDepthBuffer = 0;
+
+#ifdef HEADLESS_EGL
+	if (mDisplay)
+	{
+		EGLDisplay display = (EGLDisplay)mDisplay;
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (mSurface)
+			eglDestroySurface(display, (EGLSurface)mSurface);
+		if (mContext)
+			eglDestroyContext(display, (EGLContext)mContext);
+		eglTerminate(display);
+	}
+#else
+	if (mDisplay)
+	{
+		glfwDestroyWindow((GLFWwindow*)mDisplay);
+		glfwTerminate();
+	}
+#endif
+
+	mDisplay = mContext = mSurface = nullptr;
+}
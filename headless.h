@@ -0,0 +1,42 @@
+///////////////////////////////////////////////////////////////////////////////
+// headless.h
+// ========
+// offscreen rendering without a window system: an EGL context (surfaceless,
+// or a pbuffer when surfaceless contexts are not supported) on Linux, so it
+// runs on Mesa llvmpipe, or a hidden GLFW window elsewhere. The scene is
+// rendered into a framebuffer object and read back to write images.
+//
+// Linux builds link against libEGL for this module and never initialize
+// GLFW, so they run where no display is available.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <vector>
+
+class Headless
+{
+public:
+	GLuint gFramebuffer = 0;	// Handle for the offscreen framebuffer object
+	GLuint gColorBuffer = 0;	// RGBA8 colour renderbuffer
+	GLuint gDepthBuffer = 0;	// 24-bit depth renderbuffer
+	int gWidth = 0;
+	int gHeight = 0;
+
+public:
+	bool CreateContext(int width, int height);
+	bool CreateRenderTarget(int width, int height);
+	void BindRenderTarget();
+	bool ReadPixels(std::vector<unsigned char>& pixels);
+	bool WriteImage(const char* filename);
+	void Destroy();
+
+	static bool WritePPM(const char* filename, const std::vector<unsigned char>& pixels, int width, int height);
+
+private:
+	void* mDisplay = nullptr;	// EGLDisplay, or the hidden GLFWwindow
+	void* mContext = nullptr;	// EGLContext
+	void* mSurface = nullptr;	// EGLSurface when a pbuffer was needed
+};
@@ -0,0 +1,463 @@
+///////////////////////////////////////////////////////////////////////////////
+// jobsystem.cpp
+// ========
+// a work-stealing job system: a fixed pool of worker threads, each owning a
+// Chase-Lev deque. A worker pushes and pops jobs at the bottom of its own
+// deque and, when that is empty, steals from the top of another's, so work
+// spreads to whichever threads are free. Threads outside the pool submit
+// through a small shared queue and, while they wait, run or steal jobs
+// themselves.
+//
+// Jobs can be tracked with a Counter: Wait(counter) returns once every job
+// started with it has finished, and RunAfter parks a job on another counter
+// that queues it when that counter is done, so no thread blocks waiting for
+// it. ParallelFor splits a range in halves, leaving one half on the deque for
+// others to steal, down to chunks of a given size. Busy time, jobs run and
+// steals are kept per worker for utilization reports. Before Start (or with no
+// pool threads) every job runs on the caller.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "jobsystem.h"
+#include "cpuprofiler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+const long long JobSystem::WorkStealingDeque::CAPACITY;
+
+namespace
+{
+	// Failed searches before an idle pool thread goes to sleep
+	const int IDLE_SPINS = 64;
+
+	// The job system and worker index of the calling thread, set for pool threads
+	struct ThreadWorker
+	{
+		const JobSystem* system;
+		unsigned int index;
+	};
+	thread_local ThreadWorker tThreadWorker = { nullptr, 0 };
+}
+
+
+///////////////////////////////////////////////////
+//	WorkStealingDeque (Chase and Lev, with the C11
+//	memory orderings of Le, Pop, Cohen and Nardelli)
+///////////////////////////////////////////////////
+
+// Owner only; false when the deque is full
+bool JobSystem::WorkStealingDeque::Push(Job* job)
+{
+	long long bottom = mBottom.load(std::memory_order_relaxed);
+	long long top = mTop.load(std::memory_order_acquire);
+	if (bottom - top >= CAPACITY)
+		return false;
+
+	// releasing bottom publishes the job to thieves that acquire it
+	mJobs[bottom % CAPACITY].store(job, std::memory_order_relaxed);
+	mBottom.store(bottom + 1, std::memory_order_release);
+	return true;
+}
+
+
+// Owner only; takes the newest job
+JobSystem::Job* JobSystem::WorkStealingDeque::Pop()
+{
+	long long bottom = mBottom.load(std::memory_order_relaxed) - 1;
+	mBottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long long top = mTop.load(std::memory_order_relaxed);
+
+	if (top > bottom)
+	{
+		// empty
+		mBottom.store(bottom + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = mJobs[bottom % CAPACITY].load(std::memory_order_relaxed);
+	if (top == bottom)
+	{
+		// last job: race the thieves for it
+		if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			job = nullptr;
+		mBottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+
+// Any thread; takes the oldest job, or nothing when empty or when another thread got it first
+JobSystem::Job* JobSystem::WorkStealingDeque::Steal()
+{
+	long long top = mTop.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long long bottom = mBottom.load(std::memory_order_acquire);
+	if (top >= bottom)
+		return nullptr;
+
+	Job* job = mJobs[top % CAPACITY].load(std::memory_order_relaxed);
+	if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr;
+	return job;
+}
+
+
+///////////////////////////////////////////////////
+//	Worker
+///////////////////////////////////////////////////
+
+// Over-allocates and rounds up to the alignment, keeping the block's start just below the worker
+void* JobSystem::Worker::operator new(size_t size)
+{
+	const size_t alignment = alignof(Worker);
+	void* block = ::operator new(size + alignment + sizeof(void*));
+	uintptr_t aligned = ((uintptr_t)block + sizeof(void*) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	((void**)aligned)[-1] = block;
+	return (void*)aligned;
+}
+
+
+void JobSystem::Worker::operator delete(void* pointer)
+{
+	if (pointer)
+		::operator delete(((void**)pointer)[-1]);
+}
+
+
+///////////////////////////////////////////////////
+//	Counter
+///////////////////////////////////////////////////
+
+// The count only drops to zero under the lock, so taking it once zero is seen
+// means the last job is done with the counter and its owner may destroy it
+bool JobSystem::Counter::Done() const
+{
+	if (mPending.load(std::memory_order_acquire) != 0)
+		return false;
+	std::lock_guard<std::mutex> lock(mMutex);
+	return true;
+}
+
+
+///////////////////////////////////////////////////
+//	JobSystem
+///////////////////////////////////////////////////
+
+JobSystem::~JobSystem()
+{
+	Stop();
+}
+
+
+// Pool threads besides the calling thread: one per remaining hardware thread
+unsigned int JobSystem::DefaultWorkerThreads()
+{
+	unsigned int hardware = std::thread::hardware_concurrency();
+	return hardware > 1 ? hardware - 1 : 0;
+}
+
+
+void JobSystem::Start(unsigned int workerThreads)
+{
+	Stop();
+
+	mStop = false;
+	for (unsigned int i = 0; i <= workerThreads; ++i)
+		mWorkers.emplace_back(new Worker());
+	for (unsigned int i = 1; i <= workerThreads; ++i)
+		mWorkers[i]->thread = std::thread(&JobSystem::WorkerMain, this, i);
+	ResetStats();
+}
+
+
+// Stops the pool once it is idle; jobs still queued are dropped without running
+void JobSystem::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+
+	for (std::unique_ptr<Worker>& worker : mWorkers)
+	{
+		if (worker->thread.joinable())
+			worker->thread.join();
+	}
+
+	// the pool threads are gone, so the deques have a single user again
+	for (std::unique_ptr<Worker>& worker : mWorkers)
+	{
+		while (Job* job = worker->deque.Pop())
+			delete job;
+	}
+	for (Job* job : mSubmitted)
+		delete job;
+	mSubmitted.clear();
+	mQueued = 0;
+	mWorkers.clear();
+}
+
+
+// Index of the calling thread's worker; 0 for threads outside the pool
+unsigned int JobSystem::CurrentWorker() const
+{
+	return tThreadWorker.system == this ? tThreadWorker.index : 0;
+}
+
+
+// Queues a job: on the calling worker's own deque, or the shared queue from outside the pool
+void JobSystem::Run(std::function<void()> function, Counter* counter)
+{
+	Job* job = new Job{ function, counter };
+	if (counter)
+		counter->mPending.fetch_add(1, std::memory_order_relaxed);
+	Submit(job);
+}
+
+
+// Queues a job that starts once every job of dependency has finished
+void JobSystem::RunAfter(Counter& dependency, std::function<void()> function, Counter* counter)
+{
+	Job* job = new Job{ function, counter };
+	if (counter)
+		counter->mPending.fetch_add(1, std::memory_order_relaxed);
+
+	{
+		// Finish releases the continuations under the same lock, so the job is either released by it or queued here
+		std::lock_guard<std::mutex> lock(dependency.mMutex);
+		if (dependency.mPending.load(std::memory_order_acquire) != 0)
+		{
+			dependency.mContinuations.push_back(job);
+			return;
+		}
+	}
+	Submit(job);
+}
+
+
+// Puts a job where the workers find it: the calling worker's own deque, or the shared queue from outside the pool
+void JobSystem::Submit(Job* job)
+{
+	unsigned int worker = CurrentWorker();
+	if (mWorkers.size() <= 1)
+	{
+		// no pool: run it here
+		Execute(job, worker);
+		return;
+	}
+
+	if (worker != 0)
+	{
+		if (!mWorkers[worker]->deque.Push(job))
+		{
+			Execute(job, worker);	// deque full: run it now rather than grow
+			return;
+		}
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(mSubmittedMutex);
+		mSubmitted.push_back(job);
+	}
+
+	mQueued.fetch_add(1, std::memory_order_seq_cst);
+	if (mSleepers.load(std::memory_order_seq_cst) > 0)
+	{
+		// taking the lock orders this job before a worker that is about to sleep
+		{
+			std::lock_guard<std::mutex> lock(mSleepMutex);
+		}
+		mWake.notify_one();
+	}
+}
+
+
+// Runs or steals other jobs until every job of counter has finished
+void JobSystem::Wait(Counter& counter)
+{
+	PROFILE_ZONE("job wait");
+
+	unsigned int worker = CurrentWorker();
+	while (!counter.Done())
+	{
+		Job* job = FindJob(worker);
+		if (job)
+			Execute(job, worker);
+		else
+			std::this_thread::yield();
+	}
+}
+
+
+// Calls function on chunks of [0, count) across the workers and returns once all are done
+void JobSystem::ParallelFor(size_t count, size_t chunkSize, const RangeFunction& function)
+{
+	if (count == 0)
+		return;
+
+	chunkSize = std::max<size_t>(chunkSize, 1);
+	if (mWorkers.size() <= 1 || count <= chunkSize)
+	{
+		function(0, count, CurrentWorker());
+		return;
+	}
+
+	Counter counter;
+	Run([this, count, chunkSize, &function, &counter]() { SplitRange(0, count, chunkSize, function, counter); }, &counter);
+	Wait(counter);
+}
+
+
+// Leaves the upper half of the range for other workers to steal until one chunk is left, then runs it
+void JobSystem::SplitRange(size_t begin, size_t end, size_t chunkSize, const RangeFunction& function, Counter& counter)
+{
+	while (end - begin > chunkSize)
+	{
+		size_t chunks = (end - begin + chunkSize - 1) / chunkSize;
+		size_t middle = begin + (chunks / 2) * chunkSize;
+		Run([this, middle, end, chunkSize, &function, &counter]() { SplitRange(middle, end, chunkSize, function, counter); }, &counter);
+		end = middle;
+	}
+	function(begin, end, CurrentWorker());
+}
+
+
+void JobSystem::WorkerMain(unsigned int worker)
+{
+	tThreadWorker = { this, worker };
+	PROFILE_THREAD_NAME(("worker " + std::to_string(worker)).c_str());
+
+	int idle = 0;
+	while (!mStop.load(std::memory_order_relaxed))
+	{
+		Job* job = FindJob(worker);
+		if (job)
+		{
+			Execute(job, worker);
+			idle = 0;
+			continue;
+		}
+
+		if (++idle < IDLE_SPINS)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		// nothing to do: sleep until a job is queued
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mSleepers.fetch_add(1, std::memory_order_seq_cst);
+		mWake.wait(lock, [&]() { return mStop.load() || mQueued.load(std::memory_order_seq_cst) > 0; });
+		mSleepers.fetch_sub(1, std::memory_order_relaxed);
+		idle = 0;
+	}
+}
+
+
+// Own deque first, then the shared queue, then steal from the other workers
+JobSystem::Job* JobSystem::FindJob(unsigned int worker)
+{
+	Job* job = worker != 0 ? mWorkers[worker]->deque.Pop() : nullptr;
+
+	if (!job)
+	{
+		std::lock_guard<std::mutex> lock(mSubmittedMutex);
+		if (!mSubmitted.empty())
+		{
+			job = mSubmitted.front();
+			mSubmitted.pop_front();
+		}
+	}
+
+	// start at the next worker so thieves spread out over the victims
+	for (size_t i = 1; !job && i < mWorkers.size(); ++i)
+	{
+		size_t victim = (worker + i) % mWorkers.size();
+		if (victim == 0 || victim == worker)
+			continue;
+		job = mWorkers[victim]->deque.Steal();
+		if (job)
+			mWorkers[worker]->steals.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (job)
+		mQueued.fetch_sub(1, std::memory_order_relaxed);
+	return job;
+}
+
+
+void JobSystem::Execute(Job* job, unsigned int worker)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	job->function();
+	std::chrono::nanoseconds busy = std::chrono::steady_clock::now() - start;
+
+	if (worker < mWorkers.size())
+	{
+		Worker& stats = *mWorkers[worker];
+		stats.jobs.fetch_add(1, std::memory_order_relaxed);
+		stats.busyNanoseconds.fetch_add((unsigned long long)busy.count(), std::memory_order_relaxed);
+	}
+
+	Counter* counter = job->counter;
+	delete job;
+	if (counter)
+		Finish(*counter);
+}
+
+
+// Counts a job of counter as done and, if it was the last, queues the jobs RunAfter parked on it
+void JobSystem::Finish(Counter& counter)
+{
+	// not the last job: no lock needed
+	int pending = counter.mPending.load(std::memory_order_relaxed);
+	while (pending > 1)
+	{
+		if (counter.mPending.compare_exchange_weak(pending, pending - 1, std::memory_order_release, std::memory_order_relaxed))
+			return;
+	}
+
+	std::vector<Job*> continuations;
+	{
+		std::lock_guard<std::mutex> lock(counter.mMutex);
+		if (counter.mPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			continuations.swap(counter.mContinuations);
+	}
+
+	// the counter may be gone by now; only the jobs taken from it are used
+	for (Job* continuation : continuations)
+		Submit(continuation);
+}
+
+
+void JobSystem::ResetStats()
+{
+	for (std::unique_ptr<Worker>& worker : mWorkers)
+	{
+		worker->jobs = 0;
+		worker->steals = 0;
+		worker->busyNanoseconds = 0;
+	}
+	mStatsStart = std::chrono::steady_clock::now();
+}
+
+
+// Jobs, steals, busy time and utilization of every worker since the last reset, as JSON
+void JobSystem::WriteStats(std::ostream& out) const
+{
+	double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mStatsStart).count();
+
+	out << "{\n  \"wall_s\": " << wallSeconds << ",\n  \"workers\": [";
+	for (size_t i = 0; i < mWorkers.size(); ++i)
+	{
+		const Worker& worker = *mWorkers[i];
+		double busySeconds = worker.busyNanoseconds.load() * 1e-9;
+		out << (i ? "," : "") << "\n    { \"worker\": " << i << (i == 0 ? ", \"outside_pool\": true" : "")
+			<< ", \"jobs\": " << worker.jobs.load() << ", \"steals\": " << worker.steals.load()
+			<< ", \"busy_s\": " << busySeconds << ", \"utilization\": " << (wallSeconds > 0.0 ? busySeconds / wallSeconds : 0.0) << " }";
+	}
+	out << "\n  ]\n}";
+}
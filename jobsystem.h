@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////////////////////
+// jobsystem.h
+// ========
+// a work-stealing job system: a fixed pool of worker threads, each owning a
+// Chase-Lev deque. A worker pushes and pops jobs at the bottom of its own
+// deque and, when that is empty, steals from the top of another's, so work
+// spreads to whichever threads are free. Threads outside the pool submit
+// through a small shared queue and, while they wait, run or steal jobs
+// themselves.
+//
+// Jobs can be tracked with a Counter: Wait(counter) returns once every job
+// started with it has finished, and RunAfter parks a job on another counter
+// that queues it when that counter is done, so no thread blocks waiting for
+// it. ParallelFor splits a range in halves, leaving one half on the deque for
+// others to steal, down to chunks of a given size. Busy time, jobs run and
+// steals are kept per worker for utilization reports. Before Start (or with no
+// pool threads) every job runs on the caller.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+class JobSystem
+{
+public:
+	// Runs chunk [begin, end) on the given worker (0 for threads outside the pool)
+	typedef std::function<void(size_t begin, size_t end, unsigned int worker)> RangeFunction;
+
+private:
+	struct Job;
+
+public:
+	// Number of unfinished jobs started with it, and the jobs RunAfter holds back until it is done
+	class Counter
+	{
+	public:
+		bool Done() const;
+
+	private:
+		friend class JobSystem;
+		std::atomic<int> mPending{ 0 };
+		mutable std::mutex mMutex;			// Held while the count drops to zero and while continuations are added
+		std::vector<Job*> mContinuations;
+	};
+
+private:
+	struct Job
+	{
+		std::function<void()> function;
+		Counter* counter;
+	};
+
+	// Chase-Lev deque: the owner pushes and pops at the bottom, any thread steals from the top
+	class WorkStealingDeque
+	{
+	public:
+		static const long long CAPACITY = 4096;
+
+		bool Push(Job* job);
+		Job* Pop();
+		Job* Steal();
+
+	private:
+		alignas(64) std::atomic<long long> mTop{ 0 };
+		alignas(64) std::atomic<long long> mBottom{ 0 };
+		std::atomic<Job*> mJobs[CAPACITY];
+	};
+
+	// A pool thread's deque and statistics; index 0 stands for the threads outside the pool
+	struct Worker
+	{
+		// C++14 new ignores the deque's cache-line alignment, so workers allocate their own aligned blocks
+		static void* operator new(size_t size);
+		static void operator delete(void* pointer);
+
+		WorkStealingDeque deque;
+		std::thread thread;
+		std::atomic<unsigned long long> jobs{ 0 };
+		std::atomic<unsigned long long> steals{ 0 };
+		std::atomic<unsigned long long> busyNanoseconds{ 0 };
+	};
+
+public:
+	~JobSystem();
+
+	void Start(unsigned int workerThreads);
+	void Stop();
+	unsigned int WorkerCount() const { return mWorkers.empty() ? 1 : (unsigned int)mWorkers.size(); }
+	unsigned int CurrentWorker() const;
+
+	void Run(std::function<void()> function, Counter* counter = nullptr);
+	void RunAfter(Counter& dependency, std::function<void()> function, Counter* counter = nullptr);
+	void Wait(Counter& counter);
+	void ParallelFor(size_t count, size_t chunkSize, const RangeFunction& function);
+
+	void ResetStats();
+	void WriteStats(std::ostream& out) const;
+
+	static unsigned int DefaultWorkerThreads();
+
+private:
+	void WorkerMain(unsigned int worker);
+	void Submit(Job* job);
+	Job* FindJob(unsigned int worker);
+	void Execute(Job* job, unsigned int worker);
+	void Finish(Counter& counter);
+	void SplitRange(size_t begin, size_t end, size_t chunkSize, const RangeFunction& function, Counter& counter);
+
+	std::vector<std::unique_ptr<Worker>> mWorkers;	// [0] is the outside threads' slot; its deque is unused
+	std::deque<Job*> mSubmitted;					// Jobs from threads outside the pool
+	std::mutex mSubmittedMutex;
+
+	// Idle pool threads sleep until a job is queued
+	std::atomic<long long> mQueued{ 0 };
+	std::atomic<int> mSleepers{ 0 };
+	std::mutex mSleepMutex;
+	std::condition_variable mWake;
+	std::atomic<bool> mStop{ false };
+
+	std::chrono::steady_clock::time_point mStatsStart = std::chrono::steady_clock::now();
+};
@@ -0,0 +1,272 @@
+///////////////////////////////////////////////////////////////////////////////
+// lightclusters.cpp
+// ========
+// clustered forward lighting. The view frustum is divided into a grid of
+// clusters, CLUSTERS_X x CLUSTERS_Y screen tiles by CLUSTERS_Z depth slices
+// spaced exponentially between the near and far planes, and every frame
+// each point light is assigned to the clusters its range sphere touches.
+// The fragment shader finds its cluster from gl_FragCoord and its view
+// depth and only shades the lights on that cluster's list, so the cost per
+// fragment follows the lights near it rather than the lights in the scene.
+//
+// Assignment runs on the job system, one depth slice per job; the lists
+// are then compacted and uploaded as three shader storage buffers: the
+// lights, an (offset, count) pair per cluster and the light index lists.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "lightclusters.h"
+#include "cpuprofiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+const int ClusteredLights::CLUSTERS_X;
+const int ClusteredLights::CLUSTERS_Y;
+const int ClusteredLights::CLUSTERS_Z;
+const int ClusteredLights::MAX_LIGHTS_PER_CLUSTER;
+const int ClusteredLights::CLUSTER_COUNT;
+const GLuint ClusteredLights::LIGHT_BINDING;
+const GLuint ClusteredLights::CLUSTER_BINDING;
+const GLuint ClusteredLights::INDEX_BINDING;
+
+namespace
+{
+	// A light is cut off where its strongest channel falls below one step of an 8-bit framebuffer
+	const float CUTOFF_INTENSITY = 1.0f / 256.0f;
+
+	// Depth slice holding a view depth; slices are spaced exponentially so near ones stay thin
+	int DepthSlice(float depth, float nearPlane, float farPlane)
+	{
+		if (depth <= nearPlane)
+			return 0;
+		// clamped as a float: depths far past the far plane do not fit an int
+		float slice = std::floor(std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * ClusteredLights::CLUSTERS_Z);
+		return (int)std::min(slice, (float)(ClusteredLights::CLUSTERS_Z - 1));
+	}
+
+	// A point of the view-space segment from near to far that lies at the given view depth
+	glm::vec3 PointAtDepth(const glm::vec3& nearPoint, const glm::vec3& farPoint, float depth)
+	{
+		float t = (depth + nearPoint.z) / (nearPoint.z - farPoint.z);
+		return nearPoint + (farPoint - nearPoint) * t;
+	}
+
+	glm::vec3 Unproject(const glm::mat4& inverseProjection, float x, float y, float z)
+	{
+		glm::vec4 point = inverseProjection * glm::vec4(x, y, z, 1.0f);
+		return glm::vec3(point) / point.w;
+	}
+}
+
+
+// Distance where the light's ambient + diffuse + specular contribution drops below the cutoff; infinite without falloff
+float ClusteredLights::AttenuationRange(const PointLight& light)
+{
+	glm::vec3 total = light.ambient + light.diffuse + light.specular;
+	float intensity = std::max(total.x, std::max(total.y, total.z));
+	if (intensity <= 0.0f)
+		return 0.0f;
+
+	// solve constant + linear * d + quadratic * d^2 = intensity / cutoff
+	float target = intensity / CUTOFF_INTENSITY - light.constant;
+	if (target <= 0.0f)
+		return 0.0f;
+	if (light.quadratic > 0.0f)
+		return (-light.linear + std::sqrt(light.linear * light.linear + 4.0f * light.quadratic * target)) / (2.0f * light.quadratic);
+	if (light.linear > 0.0f)
+		return target / light.linear;
+	return std::numeric_limits<float>::infinity();
+}
+
+
+// Assigns every light to the clusters of this frame's view
+void ClusteredLights::Build(JobSystem& jobs, const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane)
+{
+	PROFILE_FUNCTION();
+
+	if (projection != mBoundsProjection || nearPlane != mNearPlane || farPlane != mFarPlane)
+		BuildClusterBounds(projection, nearPlane, farPlane);
+
+	// view-space spheres and the depth slices they reach
+	mVolumes.resize(gLights.size());
+	for (size_t i = 0; i < gLights.size(); ++i)
+	{
+		PointLight& light = gLights[i];
+		// a light without falloff reaches as far as the far plane, which keeps its volume finite
+		light.range = std::min(AttenuationRange(light), farPlane);
+
+		LightVolume& volume = mVolumes[i];
+		volume.center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+		volume.radius = light.range;
+
+		float depth = -volume.center.z;
+		if (depth + volume.radius < nearPlane || depth - volume.radius > farPlane)
+		{
+			volume.firstSlice = 0;
+			volume.lastSlice = -1;
+			continue;
+		}
+		volume.firstSlice = DepthSlice(depth - volume.radius, nearPlane, farPlane);
+		volume.lastSlice = DepthSlice(depth + volume.radius, nearPlane, farPlane);
+	}
+
+	mClusterLights.resize((size_t)CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER);
+	mClusterCounts.assign(CLUSTER_COUNT, 0);
+	jobs.ParallelFor(CLUSTERS_Z, 1, [&](size_t begin, size_t end, unsigned int)
+	{
+		for (size_t slice = begin; slice < end; ++slice)
+			AssignSlice((int)slice);
+	});
+
+	// compact the fixed-size lists into offset / count pairs and one index list
+	mGrid.resize(CLUSTER_COUNT * 2);
+	mIndices.clear();
+	mDropped = 0;
+	for (int cluster = 0; cluster < CLUSTER_COUNT; ++cluster)
+	{
+		unsigned int count = std::min<unsigned int>(mClusterCounts[cluster], MAX_LIGHTS_PER_CLUSTER);
+		mDropped += mClusterCounts[cluster] - count;
+
+		mGrid[cluster * 2] = (unsigned int)mIndices.size();
+		mGrid[cluster * 2 + 1] = count;
+		const unsigned int* lights = &mClusterLights[(size_t)cluster * MAX_LIGHTS_PER_CLUSTER];
+		mIndices.insert(mIndices.end(), lights, lights + count);
+	}
+}
+
+
+// View-space boxes of every cluster: the tile's corner rays clipped to the slice's depth range
+void ClusteredLights::BuildClusterBounds(const glm::mat4& projection, float nearPlane, float farPlane)
+{
+	PROFILE_FUNCTION();
+
+	mBoundsProjection = projection;
+	mNearPlane = nearPlane;
+	mFarPlane = farPlane;
+	mBounds.resize(CLUSTER_COUNT);
+
+	glm::mat4 inverseProjection = glm::inverse(projection);
+	for (int y = 0; y < CLUSTERS_Y; ++y)
+	{
+		for (int x = 0; x < CLUSTERS_X; ++x)
+		{
+			// the tile's four corner rays, from the near plane to the far plane
+			glm::vec3 nearPoints[4], farPoints[4];
+			for (int corner = 0; corner < 4; ++corner)
+			{
+				float ndcX = -1.0f + 2.0f * (x + (corner & 1)) / CLUSTERS_X;
+				float ndcY = -1.0f + 2.0f * (y + (corner >> 1)) / CLUSTERS_Y;
+				nearPoints[corner] = Unproject(inverseProjection, ndcX, ndcY, -1.0f);
+				farPoints[corner] = Unproject(inverseProjection, ndcX, ndcY, 1.0f);
+			}
+
+			for (int z = 0; z < CLUSTERS_Z; ++z)
+			{
+				float sliceNear = nearPlane * std::pow(farPlane / nearPlane, (float)z / CLUSTERS_Z);
+				float sliceFar = nearPlane * std::pow(farPlane / nearPlane, (float)(z + 1) / CLUSTERS_Z);
+
+				ClusterBounds& bounds = mBounds[(z * CLUSTERS_Y + y) * CLUSTERS_X + x];
+				bounds.min = glm::vec3(std::numeric_limits<float>::max());
+				bounds.max = glm::vec3(-std::numeric_limits<float>::max());
+				for (int corner = 0; corner < 4; ++corner)
+				{
+					for (float depth : { sliceNear, sliceFar })
+					{
+						glm::vec3 point = PointAtDepth(nearPoints[corner], farPoints[corner], depth);
+						bounds.min = glm::min(bounds.min, point);
+						bounds.max = glm::max(bounds.max, point);
+					}
+				}
+			}
+		}
+	}
+}
+
+
+// Adds every light whose sphere touches a cluster of the slice to that cluster's list
+void ClusteredLights::AssignSlice(int slice)
+{
+	const int tiles = CLUSTERS_X * CLUSTERS_Y;
+	for (size_t light = 0; light < mVolumes.size(); ++light)
+	{
+		const LightVolume& volume = mVolumes[light];
+		if (slice < volume.firstSlice || slice > volume.lastSlice)
+			continue;
+
+		float radiusSquared = volume.radius * volume.radius;
+		for (int tile = 0; tile < tiles; ++tile)
+		{
+			int cluster = slice * tiles + tile;
+			const ClusterBounds& bounds = mBounds[cluster];
+
+			// squared distance from the sphere's centre to the box
+			glm::vec3 closest = glm::clamp(volume.center, bounds.min, bounds.max);
+			glm::vec3 offset = volume.center - closest;
+			if (glm::dot(offset, offset) > radiusSquared)
+				continue;
+
+			unsigned int count = mClusterCounts[cluster]++;
+			if (count < (unsigned int)MAX_LIGHTS_PER_CLUSTER)
+				mClusterLights[(size_t)cluster * MAX_LIGHTS_PER_CLUSTER + count] = (unsigned int)light;
+		}
+	}
+}
+
+
+// Uploads the lights, the cluster grid and the index lists and binds them for the surface shader
+void ClusteredLights::Upload()
+{
+	PROFILE_FUNCTION();
+
+	if (mLightBuffer == 0)
+	{
+		glGenBuffers(1, &mLightBuffer);
+		glGenBuffers(1, &mClusterBuffer);
+		glGenBuffers(1, &mIndexBuffer);
+	}
+
+	// glBufferData orphans last frame's storage, so nothing waits on draws still reading it
+	PointLight none = {};
+	unsigned int noIndex = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mLightBuffer);
+	if (gLights.empty())
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(PointLight), &none, GL_STREAM_DRAW);
+	else
+		glBufferData(GL_SHADER_STORAGE_BUFFER, gLights.size() * sizeof(PointLight), gLights.data(), GL_STREAM_DRAW);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mClusterBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, mGrid.size() * sizeof(unsigned int), mGrid.data(), GL_STREAM_DRAW);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mIndexBuffer);
+	if (mIndices.empty())
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(unsigned int), &noIndex, GL_STREAM_DRAW);
+	else
+		glBufferData(GL_SHADER_STORAGE_BUFFER, mIndices.size() * sizeof(unsigned int), mIndices.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, mLightBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BINDING, mClusterBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDEX_BINDING, mIndexBuffer);
+}
+
+
+// What the shader needs to find a fragment's cluster: tiles per pixel and the depth slice mapping
+void ClusteredLights::SetUniforms(GLuint program, int viewportWidth, int viewportHeight) const
+{
+	float logRange = std::log(mFarPlane / mNearPlane);
+	glProgramUniform3i(program, glGetUniformLocation(program, "uClusterCounts"), CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z);
+	glProgramUniform2f(program, glGetUniformLocation(program, "uClusterTileScale"),
+		(float)CLUSTERS_X / std::max(viewportWidth, 1), (float)CLUSTERS_Y / std::max(viewportHeight, 1));
+	glProgramUniform2f(program, glGetUniformLocation(program, "uClusterDepthScaleBias"),
+		CLUSTERS_Z / logRange, -CLUSTERS_Z * std::log(mNearPlane) / logRange);
+}
+
+
+void ClusteredLights::Destroy()
+{
+	glDeleteBuffers(1, &mLightBuffer);
+	glDeleteBuffers(1, &mClusterBuffer);
+	glDeleteBuffers(1, &mIndexBuffer);
+	mLightBuffer = mClusterBuffer = mIndexBuffer = 0;
+}
@@ -0,0 +1,105 @@
+///////////////////////////////////////////////////////////////////////////////
+// lightclusters.h
+// ========
+// clustered forward lighting. The view frustum is divided into a grid of
+// clusters, CLUSTERS_X x CLUSTERS_Y screen tiles by CLUSTERS_Z depth slices
+// spaced exponentially between the near and far planes, and every frame
+// each point light is assigned to the clusters its range sphere touches.
+// The fragment shader finds its cluster from gl_FragCoord and its view
+// depth and only shades the lights on that cluster's list, so the cost per
+// fragment follows the lights near it rather than the lights in the scene.
+//
+// Assignment runs on the job system, one depth slice per job; the lists
+// are then compacted and uploaded as three shader storage buffers: the
+// lights, an (offset, count) pair per cluster and the light index lists.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "jobsystem.h"
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+class ClusteredLights
+{
+public:
+	static const int CLUSTERS_X = 16;
+	static const int CLUSTERS_Y = 9;
+	static const int CLUSTERS_Z = 24;
+	static const int MAX_LIGHTS_PER_CLUSTER = 128;	// Lights beyond this in one cluster are dropped
+
+	// Shader storage bindings; 0 and 1 are the bindless handle table and the per-draw matrices
+	static const GLuint LIGHT_BINDING = 2;
+	static const GLuint CLUSTER_BINDING = 3;
+	static const GLuint INDEX_BINDING = 4;
+
+	// One point light, laid out as the shader's std430 PointLight
+	struct PointLight
+	{
+		glm::vec3 position;
+		float range;			// Filled in by Build: distance where the light falls below 1/256
+		glm::vec3 ambient;
+		float constant;
+		glm::vec3 diffuse;
+		float linear;
+		glm::vec3 specular;
+		float quadratic;
+	};
+
+private:
+	// View-space box of one cluster
+	struct ClusterBounds
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	// View-space sphere of a light and the depth slices it spans
+	struct LightVolume
+	{
+		glm::vec3 center;
+		float radius;
+		int firstSlice;
+		int lastSlice;			// Below firstSlice when the light is outside the depth range
+	};
+
+public:
+	std::vector<PointLight> gLights;
+
+public:
+	void Build(JobSystem& jobs, const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane);
+	void Upload();
+	void SetUniforms(GLuint program, int viewportWidth, int viewportHeight) const;
+	void Destroy();
+
+	size_t AssignedLights() const { return mIndices.size(); }	// Light references over all clusters
+	size_t DroppedLights() const { return mDropped; }
+
+	static float AttenuationRange(const PointLight& light);
+
+private:
+	static const int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+
+	void BuildClusterBounds(const glm::mat4& projection, float nearPlane, float farPlane);
+	void AssignSlice(int slice);
+
+	glm::mat4 mBoundsProjection = glm::mat4(0.0f);	// Projection the cluster bounds were built for
+	std::vector<ClusterBounds> mBounds;
+	float mNearPlane = 0.1f;
+	float mFarPlane = 100.0f;
+
+	std::vector<LightVolume> mVolumes;
+	std::vector<unsigned int> mClusterLights;		// MAX_LIGHTS_PER_CLUSTER slots per cluster while assigning
+	std::vector<unsigned int> mClusterCounts;
+	std::vector<unsigned int> mGrid;				// Offset and count per cluster
+	std::vector<unsigned int> mIndices;				// Compacted light lists
+	size_t mDropped = 0;
+
+	GLuint mLightBuffer = 0;
+	GLuint mClusterBuffer = 0;
+	GLuint mIndexBuffer = 0;
+};
@@ -8,8 +8,15 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "meshes.h"
+#include "cpuprofiler.h"
+#include "microbench.h"
 
 #include <vector>
+#include <string>
+
+// glibc's <cmath> defines these as macros; the meshes use the constants below
+#undef M_PI
+#undef M_PI_2
 
 namespace
 {
@@ -25,6 +32,8 @@ namespace
 ///////////////////////////////////////////////////
 void Meshes::CreateMeshes()
 {
+	PROFILE_FUNCTION();
+
 	UCreatePlaneMesh(gPlaneMesh);
 	UCreatePrismMesh(gPrismMesh);
 	UCreateBoxMesh(gBoxMesh);
@@ -35,6 +44,14 @@ void Meshes::CreateMeshes()
 	UCreatePyramid4Mesh(gPyramid4Mesh);
 	UCreateSphereMesh(gSphereMesh);
 	UCreateTorusMesh(gTorusMesh);
+
+	GLMesh* all[] = { &gPlaneMesh, &gPrismMesh, &gBoxMesh, &gConeMesh, &gCylinderMesh, &gTaperedCylinderMesh,
+		&gPyramid3Mesh, &gPyramid4Mesh, &gSphereMesh, &gTorusMesh };
+	for (GLMesh* mesh : all)
+	{
+		UMeasureBounds(*mesh);
+		UCreateDepthStream(*mesh);
+	}
 }
 
 ///////////////////////////////////////////////////
@@ -47,6 +64,7 @@ void Meshes::DestroyMeshes()
 	UDestroyMesh(gBoxMesh);
 	UDestroyMesh(gConeMesh);
 	UDestroyMesh(gCylinderMesh);
+	UDestroyMesh(gTaperedCylinderMesh);
 	UDestroyMesh(gPlaneMesh);
 	UDestroyMesh(gPyramid3Mesh);
 	UDestroyMesh(gPyramid4Mesh);
@@ -55,6 +73,37 @@ void Meshes::DestroyMeshes()
 	UDestroyMesh(gTorusMesh);
 }
 
+///////////////////////////////////////////////////
+//	BenchmarkMeshes()
+//
+//	Time CreateMeshes and every mesh generator; the
+//	torus is also timed at several tessellations.
+//	Each iteration creates and deletes the GL objects
+//	and waits for the upload, so it needs a context.
+///////////////////////////////////////////////////
+void Meshes::BenchmarkMeshes(MicroBenchmark& suite)
+{
+	GLMesh mesh = {};
+
+	suite.Run("Meshes/CreateMeshes", [&]() { CreateMeshes(); DestroyMeshes(); glFinish(); });
+	suite.Run("Meshes/Plane", [&]() { UCreatePlaneMesh(mesh); UDestroyMesh(mesh); glFinish(); });
+	suite.Run("Meshes/Prism", [&]() { UCreatePrismMesh(mesh); UDestroyMesh(mesh); glFinish(); });
+	suite.Run("Meshes/Box", [&]() { UCreateBoxMesh(mesh); UDestroyMesh(mesh); glFinish(); });
+	suite.Run("Meshes/Cone", [&]() { UCreateConeMesh(mesh); UDestroyMesh(mesh); glFinish(); });
+	suite.Run("Meshes/Cylinder", [&]() { UCreateCylinderMesh(mesh); UDestroyMesh(mesh); glFinish(); });
+	suite.Run("Meshes/TaperedCylinder", [&]() { UCreateTaperedCylinderMesh(mesh); UDestroyMesh(mesh); glFinish(); });
+	suite.Run("Meshes/Pyramid3", [&]() { UCreatePyramid3Mesh(mesh); UDestroyMesh(mesh); glFinish(); });
+	suite.Run("Meshes/Pyramid4", [&]() { UCreatePyramid4Mesh(mesh); UDestroyMesh(mesh); glFinish(); });
+	suite.Run("Meshes/Sphere", [&]() { UCreateSphereMesh(mesh); UDestroyMesh(mesh); glFinish(); });
+
+	const int torusSegments[] = { 15, 30, 60, 120 };
+	for (int segments : torusSegments)
+	{
+		suite.Run("Meshes/Torus/" + std::to_string(segments),
+			[&]() { UCreateTorusMesh(mesh, segments, segments); UDestroyMesh(mesh); glFinish(); });
+	}
+}
+
 ///////////////////////////////////////////////////
 //	UCreatePlaneMesh(GLMesh&)
 //
@@ -1227,10 +1276,10 @@ void Meshes::UCreateTaperedCylinderMesh(GLMesh &mesh)
 //
 //	glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
 ///////////////////////////////////////////////////
-void Meshes::UCreateTorusMesh(GLMesh &mesh)
+void Meshes::UCreateTorusMesh(GLMesh &mesh, int mainSegments, int tubeSegments)
 {
-	int _mainSegments = 30;
-	int _tubeSegments = 30;
+	int _mainSegments = mainSegments;
+	int _tubeSegments = tubeSegments;
 	float _mainRadius = 1.0f;
 	float _tubeRadius = .1f;
 
@@ -2327,4 +2376,81 @@ void Meshes::UDestroyMesh(GLMesh &mesh)
 {
 	glDeleteVertexArrays(1, &mesh.vao);
 	glDeleteBuffers(2, mesh.vbos);
-}
\ No newline at end of file
+	glDeleteVertexArrays(1, &mesh.depthVao);
+	glDeleteBuffers(1, &mesh.depthVbo);
+	mesh.depthVao = 0;
+	mesh.depthVbo = 0;
+}
+
+///////////////////////////////////////////////////
+//	ReadPositions()
+//
+//	Read the vertex positions back from the mesh's
+//	vertex buffer (the first three floats of every
+//	vertex, whatever the layout)
+///////////////////////////////////////////////////
+std::vector<glm::vec3> Meshes::ReadPositions(const GLMesh &mesh)
+{
+	std::vector<glm::vec3> positions;
+
+	GLint size = 0;
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+	glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+	if (mesh.nVertices == 0 || size <= 0)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return positions;
+	}
+
+	std::vector<float> data(size / sizeof(float));
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, data.size() * sizeof(float), data.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	size_t stride = data.size() / mesh.nVertices;
+	positions.reserve(mesh.nVertices);
+	for (size_t i = 0; i + 2 < data.size(); i += stride)
+		positions.push_back(glm::vec3(data[i], data[i + 1], data[i + 2]));
+	return positions;
+}
+
+///////////////////////////////////////////////////
+//	UMeasureBounds()
+//
+//	Set the mesh's bounding radius from its vertex
+//	positions
+///////////////////////////////////////////////////
+void Meshes::UMeasureBounds(GLMesh &mesh)
+{
+	mesh.radius = 0.0f;
+	for (const glm::vec3& position : ReadPositions(mesh))
+		mesh.radius = glm::max(mesh.radius, glm::length(position));
+}
+
+///////////////////////////////////////////////////
+//	UCreateDepthStream()
+//
+//	Copy the mesh's positions into a tightly packed
+//	buffer with its own VAO, so the depth pre-pass
+//	fetches 12 bytes per vertex instead of the whole
+//	interleaved vertex. The VAO shares the mesh's
+//	index buffer, so the same draw calls work on it
+///////////////////////////////////////////////////
+void Meshes::UCreateDepthStream(GLMesh &mesh)
+{
+	std::vector<glm::vec3> positions = ReadPositions(mesh);
+
+	glGenVertexArrays(1, &mesh.depthVao);
+	glBindVertexArray(mesh.depthVao);
+
+	glGenBuffers(1, &mesh.depthVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.depthVbo);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+	glEnableVertexAttribArray(0);
+
+	if (mesh.nIndices > 0)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
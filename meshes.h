@@ -13,8 +13,13 @@
 
 #include <glm/glm.hpp>
 
+#include <vector>
+
+class MicroBenchmark;
+
 class Meshes
 {
+public:
 	// Stores the GL data relative to a given mesh
 	struct GLMesh
 	{
@@ -22,6 +27,9 @@ class Meshes
 		GLuint vbos[2];     // Handles for the vertex buffer objects
 		GLuint nVertices;	// Number of vertices for the mesh
 		GLuint nIndices;    // Number of indices for the mesh
+		float radius;		// Bounding sphere radius around the mesh origin, for culling
+		GLuint depthVao;	// Position-only stream for the depth pre-pass, sharing the index buffer
+		GLuint depthVbo;
 	};
 
 public:
@@ -39,6 +47,7 @@ public:
 public:
 	void CreateMeshes();
 	void DestroyMeshes();
+	void BenchmarkMeshes(MicroBenchmark& suite);
 
 private:
 	void UCreatePlaneMesh(GLMesh &mesh);
@@ -47,12 +56,16 @@ private:
 	void UCreateConeMesh(GLMesh &mesh);
 	void UCreateCylinderMesh(GLMesh &mesh);
 	void UCreateTaperedCylinderMesh(GLMesh &mesh);
-	void UCreateTorusMesh(GLMesh &mesh);
+	void UCreateTorusMesh(GLMesh &mesh, int mainSegments = 30, int tubeSegments = 30);
 	void UCreatePyramid3Mesh(GLMesh &mesh);
 	void UCreatePyramid4Mesh(GLMesh &mesh);
 	void UCreateSphereMesh(GLMesh &mesh);
 
 	void UDestroyMesh(GLMesh &mesh);
+	void UMeasureBounds(GLMesh &mesh);
+	void UCreateDepthStream(GLMesh &mesh);
 
 	void CalculateTriangleNormal(glm::vec3 px, glm::vec3 py, glm::vec3 pz);
+
+	static std::vector<glm::vec3> ReadPositions(const GLMesh &mesh);
 };
\ No newline at end of file
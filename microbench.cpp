@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+// microbench.cpp
+// ========
+// a small Google Benchmark style harness for the hot paths: each case is
+// run enough iterations to fill a minimum time, that run is repeated, and
+// the per-iteration time is reported (mean, median, min, stddev) as JSON
+// in the same shape as Google Benchmark's "benchmarks" array so results can
+// be tracked over time with the same tooling.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "microbench.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+const unsigned long long MicroBenchmark::MAX_ITERATIONS;
+
+
+// Prints (and optionally writes) every result; false only when writing fails
+bool MicroBenchmark::Report() const
+{
+	std::ostringstream report;
+	report << "{\n  \"context\": { \"repetitions\": " << gRepetitions << ", \"min_time_s\": " << gMinTimeSeconds << " },\n"
+		<< "  \"benchmarks\": [";
+	for (size_t i = 0; i < mResults.size(); ++i)
+	{
+		const Result& result = mResults[i];
+		report << (i ? "," : "") << "\n    { \"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+			<< ", \"real_time\": " << result.meanNs << ", \"median\": " << result.medianNs
+			<< ", \"min\": " << result.minNs << ", \"stddev\": " << result.stddevNs << ", \"time_unit\": \"ns\" }";
+	}
+	report << "\n  ]\n}";
+
+	std::cout << report.str() << std::endl;
+
+	if (!gOutputFile.empty())
+	{
+		std::ofstream file(gOutputFile);
+		if (!file || !(file << report.str() << "\n"))
+		{
+			std::cout << "Failed to write " << gOutputFile << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+
+bool MicroBenchmark::Matches(const std::string& name) const
+{
+	return gFilter.empty() || name.find(gFilter) != std::string::npos;
+}
+
+
+// Iterations expected to fill the minimum time, from a shorter calibration run
+unsigned long long MicroBenchmark::NextIterations(unsigned long long iterations, double seconds) const
+{
+	if (seconds <= 0.0)
+		return std::min(iterations * 10, MAX_ITERATIONS);
+
+	double scaled = iterations * gMinTimeSeconds / seconds;
+	return (unsigned long long)std::min(std::max(scaled, 1.0), (double)MAX_ITERATIONS);
+}
+
+
+void MicroBenchmark::AddResult(const std::string& name, unsigned long long iterations, std::vector<double>& samples)
+{
+	std::sort(samples.begin(), samples.end());
+
+	double sum = 0.0;
+	for (double sample : samples)
+		sum += sample;
+	double mean = sum / samples.size();
+
+	double variance = 0.0;
+	for (double sample : samples)
+		variance += (sample - mean) * (sample - mean);
+	variance = samples.size() > 1 ? variance / (samples.size() - 1) : 0.0;
+
+	Result result;
+	result.name = name;
+	result.iterations = iterations;
+	result.meanNs = mean;
+	result.medianNs = samples[samples.size() / 2];
+	result.minNs = samples.front();
+	result.stddevNs = std::sqrt(variance);
+	mResults.push_back(result);
+
+	std::cout << name << ": " << result.medianNs << " ns median over " << iterations << " iterations" << std::endl;
+}
+
+
+void MicroBenchmark::UseAddress(const volatile char*)
+{
+}
@@ -0,0 +1,101 @@
+///////////////////////////////////////////////////////////////////////////////
+// microbench.h
+// ========
+// a small Google Benchmark style harness for the hot paths: each case is
+// run enough iterations to fill a minimum time, that run is repeated, and
+// the per-iteration time is reported (mean, median, min, stddev) as JSON
+// in the same shape as Google Benchmark's "benchmarks" array so results can
+// be tracked over time with the same tooling.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+class MicroBenchmark
+{
+private:
+	// Timings of one case
+	struct Result
+	{
+		std::string name;
+		unsigned long long iterations;	// Per repetition
+		double meanNs;					// Per iteration
+		double medianNs;
+		double minNs;
+		double stddevNs;
+	};
+
+public:
+	std::string gFilter;				// Only cases whose name contains this run
+	std::string gOutputFile;			// JSON report file; the report is always printed too
+	double gMinTimeSeconds = 0.1;		// Time each repetition runs for
+	int gRepetitions = 5;
+
+public:
+	// Times body(); run whatever must not be optimised away through DoNotOptimize
+	template <class Body>
+	void Run(const std::string& name, Body body)
+	{
+		if (!Matches(name))
+			return;
+
+		typedef std::chrono::steady_clock Clock;
+
+		// grow the iteration count until one run takes a measurable share of the minimum time
+		unsigned long long iterations = 1;
+		for (;;)
+		{
+			Clock::time_point start = Clock::now();
+			for (unsigned long long i = 0; i < iterations; ++i)
+				body();
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			if (seconds >= gMinTimeSeconds * 0.1 || iterations >= MAX_ITERATIONS)
+			{
+				iterations = NextIterations(iterations, seconds);
+				break;
+			}
+			iterations *= 10;
+		}
+
+		std::vector<double> samples;
+		for (int repetition = 0; repetition < gRepetitions; ++repetition)
+		{
+			Clock::time_point start = Clock::now();
+			for (unsigned long long i = 0; i < iterations; ++i)
+				body();
+			samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations);
+		}
+		AddResult(name, iterations, samples);
+	}
+
+	// Keeps the compiler from discarding a value that is otherwise unused
+	template <class T>
+	static void DoNotOptimize(const T& value)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		UseAddress(&reinterpret_cast<const volatile char&>(value));
+		_ReadWriteBarrier();
+#endif
+	}
+
+	bool Report() const;
+
+private:
+	static const unsigned long long MAX_ITERATIONS = 1000000000ULL;
+
+	bool Matches(const std::string& name) const;
+	unsigned long long NextIterations(unsigned long long iterations, double seconds) const;
+	void AddResult(const std::string& name, unsigned long long iterations, std::vector<double>& samples);
+	static void UseAddress(const volatile char* address);
+
+	std::vector<Result> mResults;
+};
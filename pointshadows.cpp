@@ -0,0 +1,405 @@
+///////////////////////////////////////////////////////////////////////////////
+// pointshadows.cpp
+// ========
+// omnidirectional shadows for the point lights. Shadow cubes live in one
+// GL_TEXTURE_CUBE_MAP_ARRAY atlas with a fixed number of slots, so shadow
+// memory does not grow with the light count; a light holds a slot only
+// while it is among the most important lights, ranked by how much of the
+// screen its range sphere covers and how close it is to the camera.
+//
+// A cube is rendered in a single pass: a geometry shader sends every
+// caster triangle to each of the six faces it touches through gl_Layer.
+// Cubes are reused until their light or a caster in its range moves, and
+// at most gUpdateBudget stale cubes are re-rendered per frame, the most
+// important and longest-waiting first, so the per-frame cost is bounded
+// as well. Lights without a rendered cube are shaded unshadowed.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "pointshadows.h"
+#include "cpuprofiler.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+const GLuint PointShadows::SLOT_BINDING;
+
+namespace
+{
+	const int MAX_SLOTS = 64;
+	const int CUBE_FACES = 6;
+
+	// Near plane of the cube faces; casters closer to the light than this do not shadow
+	const float CUBE_NEAR = 0.05f;
+
+	// A light keeps its slot against newcomers up to this much more important than it
+	const float SLOT_HYSTERESIS = 1.25f;
+
+	// View direction and up vector of every cube face, in GL_TEXTURE_CUBE_MAP_POSITIVE_X order
+	const glm::vec3 FACE_DIRECTIONS[CUBE_FACES] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+		glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+	const glm::vec3 FACE_UPS[CUBE_FACES] = { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+		glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+
+	bool SpheresOverlap(const glm::vec3& a, float radiusA, const glm::vec3& b, float radiusB)
+	{
+		glm::vec3 offset = a - b;
+		float reach = radiusA + radiusB;
+		return glm::dot(offset, offset) <= reach * reach;
+	}
+}
+
+
+// Picks this frame's shadowed lights, re-renders up to gUpdateBudget stale cubes and uploads the per-light slot table
+void PointShadows::Render(const std::vector<ClusteredLights::PointLight>& lights, const std::vector<DrawListBuilder::SceneObject>& objects,
+	const TransformHierarchy& transforms, const glm::mat4& view, const glm::mat4& projection, GLuint shadowProgram,
+	GLuint transformBinding, const DrawFunction& draw)
+{
+	if (!gEnabled)
+		return;
+
+	PROFILE_FUNCTION();
+	++mFrames;
+
+	int slots = std::min(std::max(gSlots, 1), MAX_SLOTS);
+	if ((slots != mAtlasSlots || gResolution != mAtlasResolution) && !CreateAtlas(slots, gResolution))
+	{
+		gEnabled = false;
+		return;
+	}
+
+	// a different light list invalidates every slot
+	if (lights.size() != mLightSlots.size())
+	{
+		mLightSlots.assign(lights.size(), -1);
+		for (Slot& slot : mSlotData)
+		{
+			slot.light = -1;
+			slot.valid = false;
+		}
+	}
+	Schedule(lights, view, projection);
+
+	// the scene version is the last update that moved any object; older cubes may need a look
+	unsigned long long sceneVersion = 0;
+	for (const DrawListBuilder::SceneObject& object : objects)
+		sceneVersion = std::max(sceneVersion, transforms.ChangedAt(object.transform));
+
+	// stale cubes, the most important and longest-waiting first, within the budget
+	mUpdates.clear();
+	for (int s = 0; s < mAtlasSlots; ++s)
+	{
+		const Slot& slot = mSlotData[s];
+		if (slot.light >= 0 && IsStale(slot, lights[slot.light], objects, transforms, sceneVersion))
+			mUpdates.push_back(s);
+	}
+	auto priority = [&](int s)
+	{
+		const Slot& slot = mSlotData[s];
+		return mImportance[slot.light] * (float)(1 + (slot.valid ? mFrames - slot.lastRendered : mFrames));
+	};
+	std::stable_sort(mUpdates.begin(), mUpdates.end(), [&](int a, int b) { return priority(a) > priority(b); });
+	size_t budget = (size_t)std::max(gUpdateBudget, 0);
+	mPending = mUpdates.size() > budget ? mUpdates.size() - budget : 0;
+	if (mPending > 0)
+	{
+		mDeferredUpdates += mPending;
+		mUpdates.resize(budget);
+	}
+
+	if (!mUpdates.empty())
+	{
+		// casters of every cube being rendered, grouped by slot
+		mCasters.clear();
+		for (int s : mUpdates)
+		{
+			Slot& slot = mSlotData[s];
+			const ClusteredLights::PointLight& light = lights[slot.light];
+			slot.casters.clear();
+			for (const DrawListBuilder::SceneObject& object : objects)
+			{
+				const glm::mat4& world = transforms.World(object.transform);
+				if (SpheresOverlap(glm::vec3(world[3]), DrawListBuilder::WorldRadius(object, world), light.position, light.range))
+				{
+					mCasters.push_back(Caster{ s, &object });
+					slot.casters.push_back(&object);
+				}
+			}
+		}
+		DrawListBuilder::UploadTransforms(mCasters, transforms, mCasterTransforms, mCasterBuffer, transformBinding);
+
+		GLint previousFramebuffer = 0, viewport[4];
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+
+		glUseProgram(shadowProgram);
+		GLint faceMatricesLoc = glGetUniformLocation(shadowProgram, "uFaceMatrices");
+		GLint layerBaseLoc = glGetUniformLocation(shadowProgram, "uLayerBase");
+		GLint lightPositionLoc = glGetUniformLocation(shadowProgram, "uLightPosition");
+		GLint lightRangeLoc = glGetUniformLocation(shadowProgram, "uLightRange");
+		GLint drawIndexLoc = glGetUniformLocation(shadowProgram, "uDrawIndex");
+
+		glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+		glViewport(0, 0, mAtlasResolution, mAtlasResolution);
+
+		const GLfloat farDepth = 1.0f;
+		size_t next = 0;
+		for (int s : mUpdates)
+		{
+			Slot& slot = mSlotData[s];
+			const ClusteredLights::PointLight& light = lights[slot.light];
+
+			// one view-projection per face; the geometry shader routes each triangle to the faces it touches
+			glm::mat4 faceProjection = glm::perspective(glm::radians(90.0f), 1.0f, CUBE_NEAR, std::max(light.range, CUBE_NEAR * 2.0f));
+			glm::mat4 faceMatrices[CUBE_FACES];
+			for (int face = 0; face < CUBE_FACES; ++face)
+				faceMatrices[face] = faceProjection * glm::lookAt(light.position, light.position + FACE_DIRECTIONS[face], FACE_UPS[face]);
+
+			glUniformMatrix4fv(faceMatricesLoc, CUBE_FACES, GL_FALSE, glm::value_ptr(faceMatrices[0]));
+			glUniform1i(layerBaseLoc, s * CUBE_FACES);
+			glUniform3fv(lightPositionLoc, 1, glm::value_ptr(light.position));
+			glUniform1f(lightRangeLoc, light.range);
+
+			// only this slot's six layers are cleared; the other cubes are kept
+			glClearTexSubImage(mAtlas, 0, 0, 0, s * CUBE_FACES, mAtlasResolution, mAtlasResolution, CUBE_FACES, GL_DEPTH_COMPONENT, GL_FLOAT, &farDepth);
+			for (; next < mCasters.size() && mCasters[next].slot == s; ++next)
+			{
+				glUniform1i(drawIndexLoc, (GLint)next);
+				draw(*mCasters[next].object);
+				++mCasterDraws;
+			}
+
+			slot.valid = true;
+			slot.position = light.position;
+			slot.range = light.range;
+			slot.renderedAt = transforms.UpdateCount();
+			slot.lastRendered = mFrames;
+			++mCubeRenders;
+		}
+
+		glBindVertexArray(0);
+		glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	}
+
+	UploadSlotTable();
+}
+
+
+// Ranks the lights by screen coverage over camera distance and hands the atlas slots to the most important ones
+void PointShadows::Schedule(const std::vector<ClusteredLights::PointLight>& lights, const glm::mat4& view, const glm::mat4& projection)
+{
+	mImportance.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); ++i)
+	{
+		const ClusteredLights::PointLight& light = lights[i];
+		glm::vec4 viewCenter = view * glm::vec4(light.position, 1.0f);
+		float distance = glm::length(glm::vec3(viewCenter));
+
+		// share of the screen the range sphere covers, 0 when it is off screen
+		float coverage = 1.0f;
+		if (distance > light.range)
+		{
+			glm::vec4 clip = projection * viewCenter;
+			float w = std::max(clip.w, 1e-4f);
+			float radiusX = projection[0][0] * light.range / w;
+			float radiusY = projection[1][1] * light.range / w;
+			bool visible = -viewCenter.z > -light.range && std::abs(clip.x / w) <= 1.0f + radiusX && std::abs(clip.y / w) <= 1.0f + radiusY;
+			coverage = visible ? std::min(1.0f, 0.25f * 3.14159265f * radiusX * radiusY) : 0.0f;
+		}
+		mImportance[i] = coverage / (1.0f + distance);
+	}
+
+	// lights holding a slot get a margin, so two similar lights do not take a slot from each other every frame
+	mRanking.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); ++i)
+		mRanking[i] = (int)i;
+	auto weight = [&](int light) { return mImportance[light] * (mLightSlots[light] >= 0 ? SLOT_HYSTERESIS : 1.0f); };
+	size_t chosen = std::min(mRanking.size(), (size_t)mAtlasSlots);
+	std::partial_sort(mRanking.begin(), mRanking.begin() + chosen, mRanking.end(), [&](int a, int b) { return weight(a) > weight(b); });
+	while (chosen > 0 && mImportance[mRanking[chosen - 1]] <= 0.0f)
+		--chosen;
+
+	// free the slots of lights that dropped out, then give the free slots to the newcomers
+	std::vector<bool> keep(lights.size(), false);
+	for (size_t i = 0; i < chosen; ++i)
+		keep[mRanking[i]] = true;
+	for (Slot& slot : mSlotData)
+	{
+		if (slot.light >= 0 && !keep[slot.light])
+		{
+			mLightSlots[slot.light] = -1;
+			slot.light = -1;
+			slot.valid = false;
+			++mEvictions;
+		}
+	}
+	int freeSlot = 0;
+	for (size_t i = 0; i < chosen; ++i)
+	{
+		int light = mRanking[i];
+		if (mLightSlots[light] >= 0)
+			continue;
+		while (mSlotData[freeSlot].light >= 0)
+			++freeSlot;
+		mSlotData[freeSlot].light = light;
+		mSlotData[freeSlot].valid = false;
+		mLightSlots[light] = freeSlot;
+	}
+}
+
+
+// A cube is stale when it was never rendered, its light moved or changed range, or a caster in range moved
+bool PointShadows::IsStale(const Slot& slot, const ClusteredLights::PointLight& light, const std::vector<DrawListBuilder::SceneObject>& objects,
+	const TransformHierarchy& transforms, unsigned long long sceneVersion) const
+{
+	if (!slot.valid || slot.position != light.position || slot.range != light.range)
+		return true;
+	if (sceneVersion <= slot.renderedAt)
+		return false;
+
+	// casters that left the range since the render, then objects that moved into it
+	for (const DrawListBuilder::SceneObject* object : slot.casters)
+	{
+		if (transforms.ChangedAt(object->transform) > slot.renderedAt)
+			return true;
+	}
+	for (const DrawListBuilder::SceneObject& object : objects)
+	{
+		if (transforms.ChangedAt(object.transform) <= slot.renderedAt)
+			continue;
+		const glm::mat4& world = transforms.World(object.transform);
+		if (SpheresOverlap(glm::vec3(world[3]), DrawListBuilder::WorldRadius(object, world), light.position, light.range))
+			return true;
+	}
+	return false;
+}
+
+
+// Slot of every light for the shader; lights whose cube is not rendered yet read -1
+void PointShadows::UploadSlotTable()
+{
+	mSlotTable.assign(std::max<size_t>(mLightSlots.size(), 1), -1);
+	for (size_t i = 0; i < mLightSlots.size(); ++i)
+	{
+		int slot = mLightSlots[i];
+		if (slot >= 0 && mSlotData[slot].valid)
+			mSlotTable[i] = slot;
+	}
+
+	if (mSlotBuffer == 0)
+		glGenBuffers(1, &mSlotBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mSlotBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, mSlotTable.size() * sizeof(GLint), mSlotTable.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SLOT_BINDING, mSlotBuffer);
+}
+
+
+// Binds the atlas and sets the shading program's point shadow uniforms
+void PointShadows::Bind(GLuint program, GLuint textureUnit) const
+{
+	// the sampler names its unit even while off, so it never aliases the unit of another sampler type
+	glProgramUniform1i(program, glGetUniformLocation(program, "uPointShadowMap"), (GLint)textureUnit);
+	glProgramUniform1i(program, glGetUniformLocation(program, "uPointShadows"), gEnabled && mAtlas != 0);
+	if (!gEnabled || mAtlas == 0)
+		return;
+
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, mAtlas);
+	glActiveTexture(GL_TEXTURE0);
+
+	// a texel of a 90 degree face spans 2 / resolution of the distance to the light
+	glProgramUniform1f(program, glGetUniformLocation(program, "uPointShadowTexel"), 2.0f / mAtlasResolution);
+}
+
+
+// gSlots cubes of six depth layers each, and a layered framebuffer over all of them
+bool PointShadows::CreateAtlas(int slots, GLsizei resolution)
+{
+	Destroy();
+
+	// created mid-frame: leave the active unit's binding as the frame set it
+	GLint previousTexture = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_CUBE_MAP_ARRAY, &previousTexture);
+
+	glGenTextures(1, &mAtlas);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, mAtlas);
+	glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 1, GL_DEPTH_COMPONENT16, resolution, resolution, slots * CUBE_FACES);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, (GLuint)previousTexture);
+
+	// filter across face edges instead of clamping at them
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+	GLint previous = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+	glGenFramebuffers(1, &mFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mAtlas, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Point shadow framebuffer incomplete: 0x" << std::hex << status << std::dec << "; point shadows disabled" << std::endl;
+		Destroy();
+		return false;
+	}
+
+	mAtlasSlots = slots;
+	mAtlasResolution = resolution;
+	mSlotData.assign(slots, Slot());
+	for (Slot& slot : mSlotData)
+		slot.light = -1;
+	return true;
+}
+
+
+void PointShadows::Destroy()
+{
+	glDeleteFramebuffers(1, &mFramebuffer);
+	glDeleteTextures(1, &mAtlas);
+	glDeleteBuffers(1, &mCasterBuffer);
+	glDeleteBuffers(1, &mSlotBuffer);
+	mFramebuffer = mAtlas = mCasterBuffer = mSlotBuffer = 0;
+	mAtlasSlots = 0;
+	mAtlasResolution = 0;
+	mSlotData.clear();
+	mLightSlots.clear();
+}
+
+
+// Atlas size and how much of the scheduling budget went to cube renders
+void PointShadows::WriteJson(std::ostream& out) const
+{
+	int shadowedLights = 0;
+	for (GLint slot : mSlotTable)
+		shadowedLights += slot >= 0;
+
+	out << "{\n  \"enabled\": " << (gEnabled ? "true" : "false")
+		<< ",\n  \"slots\": " << mAtlasSlots
+		<< ",\n  \"resolution\": " << mAtlasResolution
+		<< ",\n  \"atlas_bytes\": " << (size_t)mAtlasSlots * CUBE_FACES * mAtlasResolution * mAtlasResolution * 2
+		<< ",\n  \"update_budget\": " << gUpdateBudget
+		<< ",\n  \"lights\": " << mLightSlots.size()
+		<< ",\n  \"shadowed_lights\": " << shadowedLights
+		<< ",\n  \"frames\": " << mFrames
+		<< ",\n  \"cube_renders\": " << mCubeRenders
+		<< ",\n  \"deferred_updates\": " << mDeferredUpdates
+		<< ",\n  \"evictions\": " << mEvictions
+		<< ",\n  \"caster_draws\": " << mCasterDraws
+		<< "\n}" << std::endl;
+}
@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////////
+// pointshadows.h
+// ========
+// omnidirectional shadows for the point lights. Shadow cubes live in one
+// GL_TEXTURE_CUBE_MAP_ARRAY atlas with a fixed number of slots, so shadow
+// memory does not grow with the light count; a light holds a slot only
+// while it is among the most important lights, ranked by how much of the
+// screen its range sphere covers and how close it is to the camera.
+//
+// A cube is rendered in a single pass: a geometry shader sends every
+// caster triangle to each of the six faces it touches through gl_Layer.
+// Cubes are reused until their light or a caster in its range moves, and
+// at most gUpdateBudget stale cubes are re-rendered per frame, the most
+// important and longest-waiting first, so the per-frame cost is bounded
+// as well. Lights without a rendered cube are shaded unshadowed.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "drawlist.h"
+#include "lightclusters.h"
+#include "transforms.h"
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <functional>
+#include <ostream>
+#include <vector>
+
+class PointShadows
+{
+public:
+	// Shader storage binding of the per-light slot table; 0 to 4 hold the handles, matrices and light clusters
+	static const GLuint SLOT_BINDING = 5;
+
+	// Issues the draw calls of one caster; the program, its uniforms and the VAO state are the caller's
+	typedef std::function<void(const DrawListBuilder::SceneObject&)> DrawFunction;
+
+private:
+	// One cube of the atlas and the light it currently belongs to
+	struct Slot
+	{
+		int light;						// Index into the light list, -1 while free
+		bool valid;						// Rendered for the light's current position, range and casters
+		glm::vec3 position;				// Light position and range the cube was rendered with
+		float range;
+		unsigned long long renderedAt;	// Transform update count at the last render
+		unsigned long long lastRendered;	// Frame of the last render
+		std::vector<const DrawListBuilder::SceneObject*> casters;	// Casters of the last render
+	};
+
+	// One draw of the shadow pass
+	struct Caster
+	{
+		int slot;
+		const DrawListBuilder::SceneObject* object;
+	};
+
+public:
+	bool gEnabled = true;
+	int gSlots = 8;					// Cubes in the atlas; lights past the most important gSlots are unshadowed
+	int gUpdateBudget = 2;			// Cubes re-rendered per frame at most
+	GLsizei gResolution = 256;		// Size of every cube face
+
+public:
+	void Render(const std::vector<ClusteredLights::PointLight>& lights, const std::vector<DrawListBuilder::SceneObject>& objects,
+		const TransformHierarchy& transforms, const glm::mat4& view, const glm::mat4& projection, GLuint shadowProgram,
+		GLuint transformBinding, const DrawFunction& draw);
+	void Bind(GLuint program, GLuint textureUnit) const;
+	void Destroy();
+
+	bool Pending() const { return gEnabled && mPending > 0; }	// Stale cubes the budget left for a later frame
+	void WriteJson(std::ostream& out) const;
+
+private:
+	bool CreateAtlas(int slots, GLsizei resolution);
+	void Schedule(const std::vector<ClusteredLights::PointLight>& lights, const glm::mat4& view, const glm::mat4& projection);
+	bool IsStale(const Slot& slot, const ClusteredLights::PointLight& light, const std::vector<DrawListBuilder::SceneObject>& objects,
+		const TransformHierarchy& transforms, unsigned long long sceneVersion) const;
+	void UploadSlotTable();
+
+	GLuint mAtlas = 0;				// Six depth layers per slot
+	GLuint mFramebuffer = 0;
+	GLuint mCasterBuffer = 0;		// Per-draw matrices of the shadow pass
+	GLuint mSlotBuffer = 0;			// Slot of every light, -1 for unshadowed
+	int mAtlasSlots = 0;
+	GLsizei mAtlasResolution = 0;
+
+	std::vector<Slot> mSlotData;
+	std::vector<int> mLightSlots;		// Slot held by every light, -1 for none
+	std::vector<float> mImportance;		// Scheduling weight of every light this frame
+	std::vector<int> mRanking;			// Lights by descending importance
+	std::vector<int> mUpdates;			// Slots re-rendered this frame
+	std::vector<Caster> mCasters;
+	std::vector<DrawListBuilder::DrawTransform> mCasterTransforms;
+	std::vector<GLint> mSlotTable;
+
+	size_t mPending = 0;
+	unsigned long long mFrames = 0;
+	unsigned long long mCubeRenders = 0;
+	unsigned long long mDeferredUpdates = 0;	// Stale cubes left for a later frame by the budget
+	unsigned long long mEvictions = 0;			// Slots handed to a more important light
+	unsigned long long mCasterDraws = 0;
+};
@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////////
+// renderthread.cpp
+// ========
+// runs GL submission and the swap on a thread of its own. The main thread
+// keeps GLFW events, input and the simulation, and hands each frame over as
+// a small packet (camera, view state, framebuffer size and one-off commands)
+// through a single-producer/single-consumer lock-free ring. Frame N+1 is
+// built while frame N is being submitted, so a slow swap no longer delays
+// input handling.
+//
+// The ring itself never locks; a condition variable is only used to put the
+// render thread to sleep when there is no frame to draw (render-on-change)
+// and to park the main thread when it is a full queue ahead.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "renderthread.h"
+#include "cpuprofiler.h"
+
+#include <GL/glew.h>
+
+const size_t RenderThread::QUEUE_DEPTH;
+
+
+// Hands the window's GL context to a new render thread that calls render() for every packet
+bool RenderThread::Start(GLFWwindow* window, std::function<void(const FramePacket&)> render)
+{
+	if (Running())
+		return false;
+
+	mWindow = window;
+	mRender = render;
+	mStop = false;
+	mFramesRendered = 0;
+
+	// a context can only be current on one thread
+	glfwMakeContextCurrent(NULL);
+	mThread = std::thread(&RenderThread::Run, this);
+	return true;
+}
+
+
+// Queues a frame; waits while the render thread is a full queue behind
+void RenderThread::Submit(const FramePacket& packet)
+{
+	PROFILE_FUNCTION();
+
+	if (!mQueue.TryPush(packet))
+	{
+		std::unique_lock<std::mutex> lock(mWakeMutex);
+		mWake.wait(lock, [&]() { return mQueue.TryPush(packet); });
+	}
+
+	// taking the lock orders the push before a render thread that is just about to sleep
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+	}
+	mWake.notify_all();
+}
+
+
+// Draws every queued frame, then hands the context back to the calling thread
+void RenderThread::Stop()
+{
+	if (!Running())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+	mThread.join();
+
+	glfwMakeContextCurrent(mWindow);
+}
+
+
+void RenderThread::Run()
+{
+	PROFILE_THREAD_NAME("render");
+	glfwMakeContextCurrent(mWindow);
+
+	FramePacket packet;
+	for (;;)
+	{
+		if (!mQueue.TryPop(packet))
+		{
+			std::unique_lock<std::mutex> lock(mWakeMutex);
+			mWake.wait(lock, [&]() { return !mQueue.Empty() || mStop; });
+			if (!mQueue.TryPop(packet))
+				break;	// stopping with nothing left to draw
+		}
+
+		// the producer may be waiting for this slot
+		{
+			std::lock_guard<std::mutex> lock(mWakeMutex);
+		}
+		mWake.notify_all();
+
+		mRender(packet);
+		mFramesRendered.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	glFinish();
+	glfwMakeContextCurrent(NULL);
+}
@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////////////////////////
+// renderthread.h
+// ========
+// runs GL submission and the swap on a thread of its own. The main thread
+// keeps GLFW events, input and the simulation, and hands each frame over as
+// a small packet (camera, view state, framebuffer size and one-off commands)
+// through a single-producer/single-consumer lock-free ring. Frame N+1 is
+// built while frame N is being submitted, so a slow swap no longer delays
+// input handling.
+//
+// The ring itself never locks; a condition variable is only used to put the
+// render thread to sleep when there is no frame to draw (render-on-change)
+// and to park the main thread when it is a full queue ahead.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Bounded lock-free ring for exactly one producer thread and one consumer thread
+template <class T, size_t Capacity>
+class SpscQueue
+{
+public:
+	bool TryPush(const T& item)
+	{
+		size_t tail = mTail.load(std::memory_order_relaxed);
+		if (tail - mHead.load(std::memory_order_acquire) == Capacity)
+			return false;
+
+		mItems[tail % Capacity] = item;
+		mTail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool TryPop(T& item)
+	{
+		size_t head = mHead.load(std::memory_order_relaxed);
+		if (head == mTail.load(std::memory_order_acquire))
+			return false;
+
+		item = mItems[head % Capacity];
+		mHead.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Empty() const
+	{
+		return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+	}
+
+	bool Full() const
+	{
+		return mTail.load(std::memory_order_acquire) - mHead.load(std::memory_order_acquire) == Capacity;
+	}
+
+private:
+	// Head and tail sit on their own cache lines so the two threads do not share one
+	alignas(64) std::atomic<size_t> mHead{ 0 };		// Next item to pop; only the consumer writes it
+	alignas(64) std::atomic<size_t> mTail{ 0 };		// Next slot to fill; only the producer writes it
+	alignas(64) T mItems[Capacity];
+};
+
+
+// Everything the render thread needs to draw one frame
+struct FramePacket
+{
+	// One-off requests that must run where the GL state lives
+	enum Command
+	{
+		PRINT_GPU_PROFILE = 1 << 0,
+		PRINT_TEXTURE_RESIDENCY = 1 << 1
+	};
+
+	glm::vec3 cameraPosition;
+	float yaw;
+	float pitch;
+	int framebufferWidth;
+	int framebufferHeight;
+	unsigned int commands;			// Command bits
+};
+
+
+class RenderThread
+{
+public:
+	// Frame N+1 is built while N renders; a deeper queue would only add latency
+	static const size_t QUEUE_DEPTH = 1;
+
+public:
+	bool Start(GLFWwindow* window, std::function<void(const FramePacket&)> render);
+	void Submit(const FramePacket& packet);
+	void Stop();
+	bool Running() const { return mThread.joinable(); }
+	unsigned long long FramesRendered() const { return mFramesRendered.load(std::memory_order_relaxed); }
+
+private:
+	void Run();
+
+	GLFWwindow* mWindow = nullptr;
+	std::function<void(const FramePacket&)> mRender;
+	std::thread mThread;
+	SpscQueue<FramePacket, QUEUE_DEPTH> mQueue;
+	std::atomic<bool> mStop{ false };
+	std::atomic<unsigned long long> mFramesRendered{ 0 };
+
+	// Sleeping only: the render thread when the queue is empty, the main thread when it is full
+	std::mutex mWakeMutex;
+	std::condition_variable mWake;
+};
@@ -0,0 +1,402 @@
+///////////////////////////////////////////////////////////////////////////////
+// shadowmaps.cpp
+// ========
+// cascaded shadow maps for the directional light. The view distance up to
+// gShadowDistance is split into cascades (a blend of logarithmic and
+// uniform splits); each cascade is an orthographic light-space box around
+// the bounding sphere of its slice of the view frustum, grown by a guard
+// band and snapped to a coarse light-space grid, so it stays put while the
+// camera turns or moves a little.
+//
+// Static objects are rendered into a cached depth layer per cascade that
+// is only redrawn when the cascade's box, the light or a static object
+// moves. Dynamic objects are composited every frame: the cached layer is
+// copied on the GPU and the dynamic casters are drawn over it. Without
+// dynamic casters the cached layers are sampled directly, so a still scene
+// costs no shadow geometry at all.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "shadowmaps.h"
+#include "cpuprofiler.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+const int ShadowMaps::MAX_CASCADES;
+
+namespace
+{
+	// The box is this much larger than the frustum slice's sphere and snaps to quarters of its size,
+	// so the camera can move about a quarter of the cascade before the cached layer is redrawn
+	const float GUARD_BAND = 1.25f;
+	const float SNAP_FRACTION = 0.25f;
+
+	// Casters this far towards the light outside a cascade's box still shadow it
+	const float CASTER_DISTANCE = 100.0f;
+
+	// Slope-scaled depth bias of the shadow pass
+	const float POLYGON_OFFSET_FACTOR = 2.0f;
+	const float POLYGON_OFFSET_UNITS = 4.0f;
+
+	glm::vec3 Unproject(const glm::mat4& inverseProjection, float x, float y, float z)
+	{
+		glm::vec4 point = inverseProjection * glm::vec4(x, y, z, 1.0f);
+		return glm::vec3(point) / point.w;
+	}
+
+	// A point of the view-space segment from near to far that lies at the given view depth
+	glm::vec3 PointAtDepth(const glm::vec3& nearPoint, const glm::vec3& farPoint, float depth)
+	{
+		float t = (depth + nearPoint.z) / (nearPoint.z - farPoint.z);
+		return nearPoint + (farPoint - nearPoint) * t;
+	}
+
+	float Snap(float value, float step)
+	{
+		return std::floor(value / step) * step;
+	}
+
+	// Created while the frame is being set up, so the array bound to the active unit (the scene textures) is put back
+	GLuint CreateDepthArray(GLsizei resolution, int layers)
+	{
+		GLint previous = 0;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &previous);
+
+		GLuint texture = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, resolution, resolution, layers);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, (GLuint)previous);
+		return texture;
+	}
+}
+
+
+// Redraws the cascade layers whose static casters are stale, then composites this frame's dynamic casters
+void ShadowMaps::Render(const std::vector<DrawListBuilder::SceneObject>& objects, const TransformHierarchy& transforms, const glm::vec3& lightDirection,
+	const glm::mat4& view, const glm::mat4& projection, float nearPlane, GLuint depthProgram, GLuint transformBinding, const DrawFunction& draw)
+{
+	if (!gEnabled)
+		return;
+
+	PROFILE_FUNCTION();
+	++mFrames;
+
+	int cascades = std::min(std::max(gCascades, 1), MAX_CASCADES);
+	if ((cascades != mTargetCascades || gResolution != mTargetResolution) && !CreateTargets(cascades, gResolution))
+	{
+		gEnabled = false;
+		return;
+	}
+
+	if (lightDirection != mLightDirection)
+	{
+		mLightDirection = lightDirection;
+		glm::vec3 direction = glm::normalize(lightDirection);
+		glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		mLightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+		Invalidate();
+	}
+	if (!gCacheStatic)
+		Invalidate();
+	FitCascades(cascades, view, projection, nearPlane);
+
+	// the static scene changes whenever the transform of a static object does
+	unsigned long long staticVersion = 0;
+	for (const DrawListBuilder::SceneObject& object : objects)
+	{
+		if (!object.dynamic)
+			staticVersion = std::max(staticVersion, transforms.ChangedAt(object.transform));
+	}
+
+	bool redraw[MAX_CASCADES] = {};
+	for (int c = 0; c < cascades; ++c)
+	{
+		const Cascade& cascade = mCascadeData[c];
+		redraw[c] = !cascade.cached || cascade.cachedCenter != cascade.center || cascade.cachedRadius != cascade.radius
+			|| cascade.cachedVersion != staticVersion;
+	}
+
+	// static casters of the cascades being redrawn, dynamic casters of every cascade
+	mCasters.clear();
+	int dynamicCasters[MAX_CASCADES] = {};
+	for (const DrawListBuilder::SceneObject& object : objects)
+	{
+		const glm::mat4& world = transforms.World(object.transform);
+		glm::vec3 center = glm::vec3(mLightView * world[3]);
+		float radius = DrawListBuilder::WorldRadius(object, world);
+
+		for (int c = 0; c < cascades; ++c)
+		{
+			if ((object.dynamic || redraw[c]) && Overlaps(mCascadeData[c], center, radius))
+			{
+				mCasters.push_back(Caster{ c, &object });
+				if (object.dynamic)
+					++dynamicCasters[c];
+			}
+		}
+	}
+
+	// the composite layers are sampled while any dynamic caster is around; each must then be current
+	mSampleComposite = false;
+	bool composite[MAX_CASCADES] = {};
+	for (int c = 0; c < cascades; ++c)
+		mSampleComposite = mSampleComposite || dynamicCasters[c] > 0;
+	if (!mSampleComposite && std::none_of(redraw, redraw + cascades, [](bool stale) { return stale; }))
+		return;
+
+	// per cascade: static casters first, then dynamic ones
+	std::stable_sort(mCasters.begin(), mCasters.end(), [](const Caster& a, const Caster& b)
+	{
+		return a.cascade * 2 + a.object->dynamic < b.cascade * 2 + b.object->dynamic;
+	});
+	DrawListBuilder::UploadTransforms(mCasters, transforms, mCasterTransforms, mCasterBuffer, transformBinding);
+
+	GLint previousFramebuffer = 0, viewport[4];
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	glUseProgram(depthProgram);
+	glUniformMatrix4fv(glGetUniformLocation(depthProgram, "view"), 1, GL_FALSE, glm::value_ptr(mLightView));
+	GLint projectionLoc = glGetUniformLocation(depthProgram, "projection");
+	GLint drawIndexLoc = glGetUniformLocation(depthProgram, "uDrawIndex");
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glViewport(0, 0, gResolution, gResolution);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(POLYGON_OFFSET_FACTOR, POLYGON_OFFSET_UNITS);
+
+	const GLfloat farDepth = 1.0f;
+	size_t next = 0;
+	for (int c = 0; c < cascades; ++c)
+	{
+		Cascade& cascade = mCascadeData[c];
+		glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(cascade.projection));
+
+		size_t staticEnd = next;
+		while (staticEnd < mCasters.size() && mCasters[staticEnd].cascade == c && !mCasters[staticEnd].object->dynamic)
+			++staticEnd;
+
+		if (redraw[c])
+		{
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mStaticDepth, 0, c);
+			glClearBufferfv(GL_DEPTH, 0, &farDepth);
+			for (size_t i = next; i < staticEnd; ++i)
+			{
+				glUniform1i(drawIndexLoc, (GLint)i);
+				draw(*mCasters[i].object);
+			}
+			mStaticDraws += staticEnd - next;
+			++mStaticRenders;
+
+			cascade.cached = true;
+			cascade.cachedCenter = cascade.center;
+			cascade.cachedRadius = cascade.radius;
+			cascade.cachedVersion = staticVersion;
+			++cascade.staticGeneration;
+		}
+		next = staticEnd;
+
+		size_t dynamicEnd = next + dynamicCasters[c];
+		composite[c] = mSampleComposite && (dynamicCasters[c] > 0 || cascade.compositeHasDynamic
+			|| cascade.compositeGeneration != cascade.staticGeneration);
+		if (composite[c])
+		{
+			// start from the cached static depth, then add the casters that move
+			glCopyImageSubData(mStaticDepth, GL_TEXTURE_2D_ARRAY, 0, 0, 0, c, mCompositeDepth, GL_TEXTURE_2D_ARRAY, 0, 0, 0, c,
+				gResolution, gResolution, 1);
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mCompositeDepth, 0, c);
+			for (size_t i = next; i < dynamicEnd; ++i)
+			{
+				glUniform1i(drawIndexLoc, (GLint)i);
+				draw(*mCasters[i].object);
+			}
+			mDynamicDraws += dynamicEnd - next;
+
+			cascade.compositeHasDynamic = dynamicCasters[c] > 0;
+			cascade.compositeGeneration = cascade.staticGeneration;
+		}
+		next = dynamicEnd;
+	}
+
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindVertexArray(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+
+// Splits the view distance and fits a snapped light-space box around every slice
+void ShadowMaps::FitCascades(int cascades, const glm::mat4& view, const glm::mat4& projection, float nearPlane)
+{
+	mActiveCascades = cascades;
+	float farPlane = std::max(gShadowDistance, nearPlane * 2.0f);
+
+	glm::mat4 inverseProjection = glm::inverse(projection);
+	glm::mat4 cameraToWorld = glm::inverse(view);
+	glm::vec3 nearPoints[4], farPoints[4];
+	for (int corner = 0; corner < 4; ++corner)
+	{
+		float x = (corner & 1) ? 1.0f : -1.0f;
+		float y = (corner & 2) ? 1.0f : -1.0f;
+		nearPoints[corner] = Unproject(inverseProjection, x, y, -1.0f);
+		farPoints[corner] = Unproject(inverseProjection, x, y, 1.0f);
+	}
+
+	float sliceNear = nearPlane;
+	for (int c = 0; c < cascades; ++c)
+	{
+		float fraction = (float)(c + 1) / cascades;
+		float logSplit = nearPlane * std::pow(farPlane / nearPlane, fraction);
+		float uniformSplit = nearPlane + (farPlane - nearPlane) * fraction;
+		float sliceFar = gSplitLambda * logSplit + (1.0f - gSplitLambda) * uniformSplit;
+
+		// bounding sphere of the slice in view space; it does not change as the camera turns
+		glm::vec3 points[8];
+		glm::vec3 center(0.0f);
+		for (int corner = 0; corner < 4; ++corner)
+		{
+			points[corner * 2] = PointAtDepth(nearPoints[corner], farPoints[corner], sliceNear);
+			points[corner * 2 + 1] = PointAtDepth(nearPoints[corner], farPoints[corner], sliceFar);
+			center += points[corner * 2] + points[corner * 2 + 1];
+		}
+		center /= 8.0f;
+		float sphereRadius = 0.0f;
+		for (const glm::vec3& point : points)
+			sphereRadius = std::max(sphereRadius, glm::length(point - center));
+
+		// round up so float noise cannot change the box, then snap its centre to the light-space grid
+		Cascade& cascade = mCascadeData[c];
+		cascade.radius = std::ceil(sphereRadius * GUARD_BAND * 16.0f) / 16.0f;
+		float step = cascade.radius * SNAP_FRACTION;
+		glm::vec3 lightCenter = glm::vec3(mLightView * cameraToWorld * glm::vec4(center, 1.0f));
+		cascade.center = glm::vec3(Snap(lightCenter.x, step), Snap(lightCenter.y, step), Snap(lightCenter.z, step));
+		cascade.end = sliceFar;
+
+		cascade.projection = glm::ortho(cascade.center.x - cascade.radius, cascade.center.x + cascade.radius,
+			cascade.center.y - cascade.radius, cascade.center.y + cascade.radius,
+			-(cascade.center.z + cascade.radius + CASTER_DISTANCE), -(cascade.center.z - cascade.radius));
+
+		// clip space to texture coordinates and depth in [0, 1]
+		glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+		cascade.shadowMatrix = bias * cascade.projection * mLightView;
+
+		sliceNear = sliceFar;
+	}
+}
+
+
+// Light-space bounding sphere against a cascade's box, which reaches CASTER_DISTANCE towards the light
+bool ShadowMaps::Overlaps(const Cascade& cascade, const glm::vec3& center, float radius) const
+{
+	float reach = cascade.radius + radius;
+	return std::abs(center.x - cascade.center.x) <= reach && std::abs(center.y - cascade.center.y) <= reach
+		&& center.z - radius <= cascade.center.z + cascade.radius + CASTER_DISTANCE && center.z + radius >= cascade.center.z - cascade.radius;
+}
+
+
+// Binds the layers to sample this frame and sets the shading program's cascade uniforms
+void ShadowMaps::Bind(GLuint program, GLuint textureUnit) const
+{
+	// the sampler names its unit even while off, so it never aliases the unit of another sampler type
+	glProgramUniform1i(program, glGetUniformLocation(program, "uShadowMap"), (GLint)textureUnit);
+	glProgramUniform1i(program, glGetUniformLocation(program, "uShadows"), gEnabled && mActiveCascades > 0);
+	if (!gEnabled || mActiveCascades == 0)
+		return;
+
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mSampleComposite ? mCompositeDepth : mStaticDepth);
+	glActiveTexture(GL_TEXTURE0);
+
+	glm::mat4 matrices[MAX_CASCADES];
+	glm::vec4 ends(0.0f), texelSizes(0.0f);
+	for (int c = 0; c < mActiveCascades; ++c)
+	{
+		matrices[c] = mCascadeData[c].shadowMatrix;
+		ends[c] = mCascadeData[c].end;
+		texelSizes[c] = 2.0f * mCascadeData[c].radius / gResolution;
+	}
+	glProgramUniform1i(program, glGetUniformLocation(program, "uCascadeCount"), mActiveCascades);
+	glProgramUniform4fv(program, glGetUniformLocation(program, "uCascadeEnds"), 1, glm::value_ptr(ends));
+	glProgramUniform4fv(program, glGetUniformLocation(program, "uShadowTexelSizes"), 1, glm::value_ptr(texelSizes));
+	glProgramUniformMatrix4fv(program, glGetUniformLocation(program, "uShadowMatrices"), mActiveCascades, GL_FALSE, glm::value_ptr(matrices[0]));
+}
+
+
+// Forces every cascade's static layer to be redrawn
+void ShadowMaps::Invalidate()
+{
+	for (Cascade& cascade : mCascadeData)
+		cascade.cached = false;
+}
+
+
+// One depth layer per cascade for the static and the composite maps
+bool ShadowMaps::CreateTargets(int cascades, GLsizei resolution)
+{
+	Destroy();
+
+	mStaticDepth = CreateDepthArray(resolution, cascades);
+	mCompositeDepth = CreateDepthArray(resolution, cascades);
+
+	GLint previous = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+	glGenFramebuffers(1, &mFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mStaticDepth, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Shadow map framebuffer incomplete: 0x" << std::hex << status << std::dec << "; shadows disabled" << std::endl;
+		Destroy();
+		return false;
+	}
+
+	mTargetCascades = cascades;
+	mTargetResolution = resolution;
+	return true;
+}
+
+
+void ShadowMaps::Destroy()
+{
+	glDeleteFramebuffers(1, &mFramebuffer);
+	glDeleteTextures(1, &mStaticDepth);
+	glDeleteTextures(1, &mCompositeDepth);
+	glDeleteBuffers(1, &mCasterBuffer);
+	mFramebuffer = mStaticDepth = mCompositeDepth = mCasterBuffer = 0;
+	mTargetCascades = 0;
+	mTargetResolution = 0;
+	for (Cascade& cascade : mCascadeData)
+		cascade = Cascade();
+}
+
+
+// How often the cached layers had to be redrawn and how many casters were drawn
+void ShadowMaps::WriteJson(std::ostream& out) const
+{
+	out << "{\n  \"enabled\": " << (gEnabled ? "true" : "false")
+		<< ",\n  \"cascades\": " << mActiveCascades
+		<< ",\n  \"cache_static\": " << (gCacheStatic ? "true" : "false")
+		<< ",\n  \"resolution\": " << gResolution
+		<< ",\n  \"frames\": " << mFrames
+		<< ",\n  \"static_layer_renders\": " << mStaticRenders
+		<< ",\n  \"static_caster_draws\": " << mStaticDraws
+		<< ",\n  \"dynamic_caster_draws\": " << mDynamicDraws
+		<< "\n}" << std::endl;
+}
@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////////////////////////
+// shadowmaps.h
+// ========
+// cascaded shadow maps for the directional light. The view distance up to
+// gShadowDistance is split into cascades (a blend of logarithmic and
+// uniform splits); each cascade is an orthographic light-space box around
+// the bounding sphere of its slice of the view frustum, grown by a guard
+// band and snapped to a coarse light-space grid, so it stays put while the
+// camera turns or moves a little.
+//
+// Static objects are rendered into a cached depth layer per cascade that
+// is only redrawn when the cascade's box, the light or a static object
+// moves. Dynamic objects are composited every frame: the cached layer is
+// copied on the GPU and the dynamic casters are drawn over it. Without
+// dynamic casters the cached layers are sampled directly, so a still scene
+// costs no shadow geometry at all.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "drawlist.h"
+#include "transforms.h"
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <functional>
+#include <ostream>
+#include <vector>
+
+class ShadowMaps
+{
+public:
+	static const int MAX_CASCADES = 4;
+
+	// Issues the draw calls of one caster; the program, its uniforms and the VAO state are the caller's
+	typedef std::function<void(const DrawListBuilder::SceneObject&)> DrawFunction;
+
+private:
+	// Light-space box of one cascade and the state of its cached layers
+	struct Cascade
+	{
+		glm::vec3 center;				// Snapped light-space centre of the box
+		float radius;					// Half extent of the box, guard band included
+		float end;						// View depth where the cascade ends
+		glm::mat4 projection;
+		glm::mat4 shadowMatrix;			// World to shadow map texture coordinates and depth
+
+		bool cached;					// The static layer holds this box's casters
+		glm::vec3 cachedCenter;
+		float cachedRadius;
+		unsigned long long cachedVersion;		// Static scene version the layer was drawn at
+		unsigned long long staticGeneration;	// Bumped on every static redraw
+		unsigned long long compositeGeneration;	// Static generation the composite layer was copied from
+		bool compositeHasDynamic;		// The composite layer holds dynamic casters
+	};
+
+	// One draw of the shadow pass
+	struct Caster
+	{
+		int cascade;
+		const DrawListBuilder::SceneObject* object;
+	};
+
+public:
+	bool gEnabled = true;
+	bool gCacheStatic = true;		// Cleared to redraw every cascade every frame, for comparison
+	int gCascades = 3;
+	GLsizei gResolution = 2048;		// Size of every cascade's layer
+	float gShadowDistance = 50.0f;	// No shadows past this view depth
+	float gSplitLambda = 0.75f;		// 1 for logarithmic splits, 0 for uniform ones
+
+public:
+	void Render(const std::vector<DrawListBuilder::SceneObject>& objects, const TransformHierarchy& transforms, const glm::vec3& lightDirection,
+		const glm::mat4& view, const glm::mat4& projection, float nearPlane, GLuint depthProgram, GLuint transformBinding, const DrawFunction& draw);
+	void Bind(GLuint program, GLuint textureUnit) const;
+	void Invalidate();
+	void Destroy();
+
+	unsigned long long StaticRenders() const { return mStaticRenders; }
+	void WriteJson(std::ostream& out) const;
+
+private:
+	bool CreateTargets(int cascades, GLsizei resolution);
+	void FitCascades(int cascades, const glm::mat4& view, const glm::mat4& projection, float nearPlane);
+	bool Overlaps(const Cascade& cascade, const glm::vec3& center, float radius) const;
+
+	GLuint mStaticDepth = 0;		// Cached static casters, one layer per cascade
+	GLuint mCompositeDepth = 0;		// Static layers plus this frame's dynamic casters
+	GLuint mFramebuffer = 0;
+	GLuint mCasterBuffer = 0;		// Per-draw matrices of the shadow pass
+	int mTargetCascades = 0;
+	GLsizei mTargetResolution = 0;
+
+	Cascade mCascadeData[MAX_CASCADES] = {};
+	int mActiveCascades = 0;
+	glm::vec3 mLightDirection = glm::vec3(0.0f);
+	glm::mat4 mLightView = glm::mat4(1.0f);
+	bool mSampleComposite = false;	// Dynamic casters were drawn this frame
+
+	std::vector<Caster> mCasters;
+	std::vector<DrawListBuilder::DrawTransform> mCasterTransforms;
+
+	unsigned long long mFrames = 0;
+	unsigned long long mStaticRenders = 0;	// Cascade layers redrawn from static casters
+	unsigned long long mStaticDraws = 0;
+	unsigned long long mDynamicDraws = 0;
+};
@@ -0,0 +1,67 @@
+///////////////////////////////////////////////////////////////////////////////
+// simulation.cpp
+// ========
+// fixed-timestep simulation decoupled from rendering. Frame time is added to
+// an accumulator and the scene state is advanced in whole steps of a fixed
+// size, so movement does not depend on the frame rate; a hitch runs a few
+// extra steps (up to a cap) instead of one large one. The renderer draws an
+// interpolation between the last two states, so frames can be presented at
+// any rate, or skipped, without stepping the motion.
+//
+// Mouse look is applied to both states at once: it is event driven, and
+// interpolating it would only add a step of latency.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "simulation.h"
+
+namespace
+{
+	// Pitch is kept short of straight up or down so the view does not flip
+	const float MAX_PITCH = 89.0f;
+
+	float ClampPitch(float pitch)
+	{
+		return glm::clamp(pitch, -MAX_PITCH, MAX_PITCH);
+	}
+}
+
+
+// Starts both states at the given one with nothing accumulated
+void Simulation::Reset(const State& state)
+{
+	mPrevious = state;
+	mCurrent = state;
+	mAccumulator = 0.0;
+	mDroppedSeconds = 0.0;
+}
+
+
+// Mouse look: rotates both states so the turn shows on the next frame without interpolation lag
+void Simulation::Turn(float yawOffset, float pitchOffset)
+{
+	mPrevious.yaw += yawOffset;
+	mCurrent.yaw += yawOffset;
+	mPrevious.pitch = ClampPitch(mPrevious.pitch + pitchOffset);
+	mCurrent.pitch = ClampPitch(mCurrent.pitch + pitchOffset);
+}
+
+
+// The state between the last two steps, by how far the accumulator is into the next step
+Simulation::State Simulation::Interpolated() const
+{
+	float alpha = (float)(mAccumulator / gTimeStep);
+
+	State state;
+	state.cameraPosition = glm::mix(mPrevious.cameraPosition, mCurrent.cameraPosition, alpha);
+	state.yaw = glm::mix(mPrevious.yaw, mCurrent.yaw, alpha);
+	state.pitch = glm::mix(mPrevious.pitch, mCurrent.pitch, alpha);
+	state.time = mPrevious.time + (mCurrent.time - mPrevious.time) * alpha;
+	return state;
+}
+
+
+// True while the last step changed the camera, so interpolated frames still differ
+bool Simulation::Moving() const
+{
+	return mPrevious.cameraPosition != mCurrent.cameraPosition || mPrevious.yaw != mCurrent.yaw || mPrevious.pitch != mCurrent.pitch;
+}
@@ -0,0 +1,78 @@
+///////////////////////////////////////////////////////////////////////////////
+// simulation.h
+// ========
+// fixed-timestep simulation decoupled from rendering. Frame time is added to
+// an accumulator and the scene state is advanced in whole steps of a fixed
+// size, so movement does not depend on the frame rate; a hitch runs a few
+// extra steps (up to a cap) instead of one large one. The renderer draws an
+// interpolation between the last two states, so frames can be presented at
+// any rate, or skipped, without stepping the motion.
+//
+// Mouse look is applied to both states at once: it is event driven, and
+// interpolating it would only add a step of latency.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+class Simulation
+{
+public:
+	// Everything a step advances; rendering reads an interpolation of two of these
+	struct State
+	{
+		glm::vec3 cameraPosition;
+		float yaw;
+		float pitch;
+		double time;				// Simulated seconds, for animation
+	};
+
+public:
+	double gTimeStep = 1.0 / 120.0;	// Seconds per step
+	int gMaxStepsPerFrame = 8;		// Frame time beyond this many steps is dropped after a hitch
+
+public:
+	void Reset(const State& state);
+
+	// Runs step(state, timeStep) for every whole step in the accumulated frame time; returns the steps run
+	template <class Step>
+	int Advance(double frameSeconds, Step step)
+	{
+		mAccumulator += frameSeconds;
+
+		int steps = 0;
+		while (mAccumulator >= gTimeStep)
+		{
+			if (steps == gMaxStepsPerFrame)
+			{
+				// keep the partial step so interpolation stays continuous
+				double wholeSteps = std::floor(mAccumulator / gTimeStep) * gTimeStep;
+				mDroppedSeconds += wholeSteps;
+				mAccumulator -= wholeSteps;
+				break;
+			}
+
+			mPrevious = mCurrent;
+			step(mCurrent, gTimeStep);
+			mCurrent.time += gTimeStep;
+			mAccumulator -= gTimeStep;
+			++steps;
+		}
+		return steps;
+	}
+
+	void Turn(float yawOffset, float pitchOffset);
+	State Interpolated() const;
+	bool Moving() const;
+	const State& Current() const { return mCurrent; }
+	double DroppedSeconds() const { return mDroppedSeconds; }
+
+private:
+	State mPrevious = {};
+	State mCurrent = {};
+	double mAccumulator = 0.0;		// Frame time not yet simulated, less than one step after Advance
+	double mDroppedSeconds = 0.0;	// Frame time discarded by the step cap
+};
@@ -0,0 +1,1423 @@
+///////////////////////////////////////////////////////////////////////////////
+// textures.cpp
+// ========
+// load the scene textures and pack them into a single GL_TEXTURE_2D_ARRAY:
+// same-size images get a layer each, odd sizes are rectangle-packed into
+// atlas layers so the whole scene samples through one texture binding.
+// When ARB_bindless_texture is available every image instead keeps its own
+// texture and the shader reads resident handles from a per-draw table.
+//
+// Textures are reference counted and their GPU memory (mips included) is
+// tracked against an optional budget: least-recently-used textures first
+// drop their top mip levels and are evicted only when that is not enough.
+// Use is recorded from the draws that survive culling. An evicted texture
+// keeps its smallest mips, which draws sample until the file has been
+// decoded again on the job system and the full texture replaces them.
+//
+// Image files are memory mapped and decoded straight from the mapping; the
+// decoded pixels are flipped while being copied into a mapped pixel unpack
+// buffer, so there is no separate flip pass or client-memory upload copy.
+//
+// JPEG decoding relies on stb_image's SSE2 IDCT and colour conversion. Images
+// can be loaded at 1/2 or 1/4 size: they are decoded at full size and then
+// downsampled by SSE2/AVX2 box-filter kernels picked at run time, which saves
+// texture memory and upload time but not decode time
+///////////////////////////////////////////////////////////////////////////////
+
+#include "textures.h"
+#include "microbench.h"
+#include "jobsystem.h"
+
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TEXTURES_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//image loader for textures
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace
+{
+	// Every texture is stored as RGBA8 so same-size and atlas layers share one format
+	const int TEXTURE_CHANNELS = 4;
+
+	// Border of repeated edge texels around each atlas image so linear filtering
+	// never picks up a neighbouring image
+	const GLint ATLAS_PADDING = 2;
+
+	// Shader storage binding of the bindless handle table
+	const GLuint HANDLE_TABLE_BINDING = 0;
+
+	// Top mip levels a texture may drop before it is evicted instead
+	const GLint MAX_DROPPED_LEVELS = 2;
+
+	// Evicted textures keep the mips up to this size for the draws made while they reload
+	const GLint EVICTED_TAIL_SIZE = 16;
+
+	// The texture array is never evicted, only shrunk down to this layer size
+	const GLint MIN_ARRAY_LAYER_SIZE = 64;
+
+	// Instruction sets the image kernels can use
+	enum SimdLevel
+	{
+		SIMD_NONE,
+		SIMD_SSE2,
+		SIMD_AVX2
+	};
+
+	// Pick the widest kernel the CPU supports
+	SimdLevel DetectSimdLevel()
+	{
+#if defined(TEXTURES_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+		__cpuid(info, 1);
+		bool sse2 = (info[3] & (1 << 26)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		bool avx2 = false;
+		if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+		return avx2 ? SIMD_AVX2 : sse2 ? SIMD_SSE2 : SIMD_NONE;
+#elif defined(TEXTURES_X86) && defined(__GNUC__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return SIMD_AVX2;
+		return __builtin_cpu_supports("sse2") ? SIMD_SSE2 : SIMD_NONE;
+#else
+		return SIMD_NONE;
+#endif
+	}
+
+	const SimdLevel SIMD_LEVEL = DetectSimdLevel();
+
+	// Average 2x2 blocks of two RGBA8 rows into one row of `width` pixels (reference kernel)
+	void HalveRowsScalar(const unsigned char* row0, const unsigned char* row1, int srcWidth, int width, int start, unsigned char* dst)
+	{
+		for (int x = start; x < width; ++x)
+		{
+			int x0 = std::min(x * 2, srcWidth - 1);
+			int x1 = std::min(x * 2 + 1, srcWidth - 1);
+			for (int c = 0; c < 4; ++c)
+			{
+				int sum = row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c];
+				dst[x * 4 + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+
+#ifdef TEXTURES_X86
+	// SSE2: 8 source pixels per step; averages rows, then even/odd pixel pairs.
+	// _mm_avg_epu8 rounds twice, so results can be one step above the scalar kernel.
+	void HalveRowsSSE2(const unsigned char* row0, const unsigned char* row1, int srcWidth, int width, unsigned char* dst)
+	{
+		int x = 0;
+		for (; x + 4 <= width && x * 2 + 8 <= srcWidth; x += 4)
+		{
+			__m128i a = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(row0 + x * 8)), _mm_loadu_si128((const __m128i*)(row1 + x * 8)));
+			__m128i b = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(row0 + x * 8 + 16)), _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 16)));
+			__m128i even = _mm_unpacklo_epi64(_mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0)));
+			__m128i odd = _mm_unpackhi_epi64(_mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0)));
+			_mm_storeu_si128((__m128i*)(dst + x * 4), _mm_avg_epu8(even, odd));
+		}
+		HalveRowsScalar(row0, row1, srcWidth, width, x, dst);
+	}
+
+	// AVX2: 16 source pixels per step, same rounding as the SSE2 kernel
+#ifdef __GNUC__
+	__attribute__((target("avx2")))
+#endif
+	void HalveRowsAVX2(const unsigned char* row0, const unsigned char* row1, int srcWidth, int width, unsigned char* dst)
+	{
+		const __m256i split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+		int x = 0;
+		for (; x + 8 <= width && x * 2 + 16 <= srcWidth; x += 8)
+		{
+			__m256i a = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(row0 + x * 8)), _mm256_loadu_si256((const __m256i*)(row1 + x * 8)));
+			__m256i b = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(row0 + x * 8 + 32)), _mm256_loadu_si256((const __m256i*)(row1 + x * 8 + 32)));
+			a = _mm256_permutevar8x32_epi32(a, split);	// evens low, odds high
+			b = _mm256_permutevar8x32_epi32(b, split);
+			__m256i even = _mm256_permute2x128_si256(a, b, 0x20);
+			__m256i odd = _mm256_permute2x128_si256(a, b, 0x31);
+			_mm256_storeu_si256((__m256i*)(dst + x * 4), _mm256_avg_epu8(even, odd));
+		}
+		HalveRowsSSE2(row0 + x * 8, row1 + x * 8, srcWidth - x * 2, width - x, dst + x * 4);
+	}
+#endif
+
+	// Halve one row pair with the widest kernel available
+	void HalveRows(const unsigned char* row0, const unsigned char* row1, int srcWidth, int width, unsigned char* dst, SimdLevel level)
+	{
+#ifdef TEXTURES_X86
+		if (level == SIMD_AVX2)
+			return HalveRowsAVX2(row0, row1, srcWidth, width, dst);
+		if (level == SIMD_SSE2)
+			return HalveRowsSSE2(row0, row1, srcWidth, width, dst);
+#endif
+		HalveRowsScalar(row0, row1, srcWidth, width, 0, dst);
+	}
+
+	// Read-only memory mapping of a whole file
+	struct MappedFile
+	{
+		const unsigned char* data = nullptr;
+		size_t size = 0;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#endif
+
+		// map the file; the decoder reads it once front to back
+		bool Open(const char* filename)
+		{
+#ifdef _WIN32
+			file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			{
+				Close();
+				return false;
+			}
+			size = (size_t)fileSize.QuadPart;
+
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping)
+				data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+			int fd = open(filename, O_RDONLY);
+			if (fd < 0)
+				return false;
+
+			struct stat info;
+			if (fstat(fd, &info) == 0 && info.st_size > 0)
+			{
+				size = (size_t)info.st_size;
+				void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (view != MAP_FAILED)
+				{
+					madvise(view, size, MADV_SEQUENTIAL);
+					madvise(view, size, MADV_WILLNEED);
+					data = (const unsigned char*)view;
+				}
+			}
+			close(fd); // the mapping keeps the file alive
+#endif
+			if (!data)
+			{
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		void Close()
+		{
+#ifdef _WIN32
+			if (data)
+				UnmapViewOfFile(data);
+			if (mapping)
+				CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+			mapping = nullptr;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (data)
+				munmap((void*)data, size);
+#endif
+			data = nullptr;
+			size = 0;
+		}
+	};
+}
+
+///////////////////////////////////////////////////
+//	PrefetchImages(JobSystem&, const vector<string>&, int)
+//
+//	jobs: job system the files are decoded on
+//	filenames: images about to be passed to UCreateTexture
+//	reduction: as for UCreateTexture
+//
+//	Decode the files in parallel, one job per file. The
+//	pixels wait here until UCreateTexture asks for the same
+//	file and reduction; UCreateTexture still decodes on
+//	its own anything that was not prefetched.
+///////////////////////////////////////////////////
+void Textures::PrefetchImages(JobSystem& jobs, const std::vector<std::string>& filenames, int reduction)
+{
+	size_t first = mDecoded.size();
+	for (const std::string& filename : filenames)
+	{
+		DecodedImage decoded;
+		decoded.filename = filename;
+		decoded.reduction = reduction;
+		decoded.pixels = nullptr;
+		decoded.width = 0;
+		decoded.height = 0;
+		mDecoded.push_back(decoded);
+	}
+
+	jobs.ParallelFor(filenames.size(), 1, [&](size_t begin, size_t end, unsigned int)
+	{
+		for (size_t i = first + begin; i < first + end; ++i)
+		{
+			DecodedImage& decoded = mDecoded[i];
+			decoded.pixels = LoadImage(decoded.filename.c_str(), decoded.width, decoded.height, decoded.reduction);
+		}
+	});
+}
+
+///////////////////////////////////////////////////
+//	UCreateTexture(const char*, TextureSlot&, int)
+//
+//	filename: image file to decode
+//	slot: filled in with the layer and rectangle (or the
+//		bindless table index) once BuildTextures() has run
+//	reduction: 0 for full size, 1 for 1/2, 2 for 1/4 (for
+//		distant LODs or thumbnails)
+//
+//	Decode an image and queue it for the texture array.
+//	Loading a file that is already loaded only adds a
+//	reference to the existing texture.
+///////////////////////////////////////////////////
+bool Textures::UCreateTexture(const char* filename, TextureSlot& slot, int reduction)
+{
+	slot.layer = 0;
+	slot.rect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	slot.index = -1;
+
+	// share an image that is already loaded
+	for (size_t i = 0; i < mEntries.size(); ++i)
+	{
+		TextureEntry& entry = mEntries[i];
+		if (entry.residency == RELEASED || entry.filename != filename || entry.reduction != reduction)
+			continue;
+
+		++entry.refCount;
+		if (!entry.slots.empty())
+			slot = *entry.slots.front();
+		slot.index = (GLint)i;
+		entry.slots.push_back(&slot);
+		return true;
+	}
+
+	// the array is packed once; after that only bindless textures can be added
+	if (mBuilt && !gBindless)
+	{
+		std::cout << "Cannot add " << filename << " after the texture array has been built" << std::endl;
+		return false;
+	}
+
+	int width, height;
+	unsigned char* image = TakeDecodedImage(filename, width, height, reduction);
+	if (!image)
+		image = LoadImage(filename, width, height, reduction);
+	if (!image)
+		return false;
+
+	TextureEntry entry;
+	entry.filename = filename;
+	entry.reduction = reduction;
+	entry.refCount = 1;
+	entry.width = width;
+	entry.height = height;
+	entry.textureId = 0;
+	entry.handle = 0;
+	entry.droppedLevels = 0;
+	entry.bytes = 0;
+	entry.lastUsedFrame = gFrame;
+	entry.residency = RESIDENT;
+	entry.reloading = false;
+	entry.slots.push_back(&slot);
+
+	slot.index = (GLint)mEntries.size();
+	mEntries.push_back(entry);
+
+	if (mBuilt)
+	{
+		// bindless textures can be added at any time; grow the handle table to match
+		bool created = CreateEntryTexture(slot.index, image);
+		stbi_image_free(image);
+		if (!created)
+			return false;
+
+		std::vector<GLuint64> handles;
+		for (const TextureEntry& loaded : mEntries)
+			handles.push_back(loaded.handle);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, gHandleBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint64) * handles.size(), handles.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return true;
+	}
+
+	PendingImage pending;
+	pending.pixels = image;
+	pending.width = width;
+	pending.height = height;
+	pending.x = 0;
+	pending.y = 0;
+	pending.layer = 0;
+	pending.padding = 0;
+	pending.entry = slot.index;
+	mPending.push_back(pending);
+
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UDestroyTexture(TextureSlot&)
+//
+//	slot: slot returned by UCreateTexture
+//
+//	Drop a reference; the texture is freed with the last one.
+//	Images in the texture array keep their layer space until
+//	the array itself is destroyed.
+///////////////////////////////////////////////////
+void Textures::UDestroyTexture(TextureSlot& slot)
+{
+	if (slot.index < 0 || slot.index >= (GLint)mEntries.size())
+		return;
+
+	size_t index = slot.index;
+	TextureEntry& entry = mEntries[index];
+	entry.slots.erase(std::remove(entry.slots.begin(), entry.slots.end(), &slot), entry.slots.end());
+	slot.index = -1;
+
+	if (--entry.refCount > 0)
+		return;
+
+	if (gBindless)
+		ReleaseEntryTexture(index);
+	entry.residency = RELEASED;
+}
+
+///////////////////////////////////////////////////
+//	BuildTextures()
+//
+//	Upload every queued image. Uses bindless handles when
+//	the driver exposes ARB_bindless_texture and falls back
+//	to the texture array otherwise (e.g. Mesa llvmpipe).
+///////////////////////////////////////////////////
+bool Textures::BuildTextures()
+{
+	gBindless = gAllowBindless && GLEW_ARB_bindless_texture;
+	if (gBindless)
+	{
+		if (BuildBindlessTextures())
+			return true;
+
+		std::cout << "INFO: Bindless textures unavailable, using the texture array" << std::endl;
+		gBindless = false;
+	}
+
+	return BuildTextureArray();
+}
+
+///////////////////////////////////////////////////
+//	BuildTextureArray()
+//
+//	Pack every queued image into one GL_TEXTURE_2D_ARRAY.
+//	The most common image size becomes the layer size and
+//	those images get a whole layer; everything else is shelf
+//	packed into atlas layers. Images larger than a layer are
+//	halved, and those left too large for the atlas padding
+//	get an unpadded layer of their own.
+///////////////////////////////////////////////////
+bool Textures::BuildTextureArray()
+{
+	if (mPending.empty())
+		return false;
+
+	// pick the layer size: most common size, ties go to the larger image
+	std::map<std::pair<int, int>, int> sizeCounts;
+	for (const PendingImage& image : mPending)
+		++sizeCounts[std::make_pair(image.width, image.height)];
+
+	int bestCount = 0;
+	for (const auto& entry : sizeCounts)
+	{
+		int area = entry.first.first * entry.first.second;
+		if (entry.second > bestCount || (entry.second == bestCount && area > gLayerWidth * gLayerHeight))
+		{
+			bestCount = entry.second;
+			gLayerWidth = entry.first.first;
+			gLayerHeight = entry.first.second;
+		}
+	}
+
+	// same-size images take a whole layer each
+	std::vector<PendingImage*> atlasImages;
+	gLayerCount = 0;
+	for (PendingImage& image : mPending)
+	{
+		if (image.width == gLayerWidth && image.height == gLayerHeight)
+		{
+			image.layer = gLayerCount++;
+			continue;
+		}
+
+		// images larger than a layer are halved until they fit
+		while (image.width > gLayerWidth || image.height > gLayerHeight)
+		{
+			std::cout << "INFO: Halving " << mEntries[image.entry].filename << " (" << image.width << "x" << image.height << ") to fit the texture array" << std::endl;
+			HalveImage(image.pixels, image.width, image.height, true);
+		}
+
+		// images that fit a layer only without the atlas padding take a layer of their own, unpadded
+		if (image.width + 2 * ATLAS_PADDING > gLayerWidth || image.height + 2 * ATLAS_PADDING > gLayerHeight)
+		{
+			image.layer = gLayerCount++;
+			continue;
+		}
+
+		image.padding = ATLAS_PADDING;
+		atlasImages.push_back(&image);
+	}
+
+	gLayerCount = PackAtlasImages(atlasImages, gLayerCount);
+	gArrayLevels = MipLevels(gLayerWidth, gLayerHeight);
+
+	glGenTextures(1, &gTextureArray);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, gTextureArray);
+
+	// set the texture wrapping parameters
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// immutable storage so the residency manager can copy levels into a smaller array
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, gArrayLevels, GL_RGBA8, gLayerWidth, gLayerHeight, gLayerCount);
+
+	for (PendingImage& image : mPending)
+	{
+		UploadPadded(image, image.padding);
+
+		FillSlots(mEntries[image.entry], image.layer, glm::vec4(
+			(float)image.x / gLayerWidth, (float)image.y / gLayerHeight,
+			(float)image.width / gLayerWidth, (float)image.height / gLayerHeight));
+
+		stbi_image_free(image.pixels);
+	}
+	mPending.clear();
+
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0); // Unbind the texture
+
+	gResidentBytes = TextureBytes(gLayerWidth, gLayerHeight, gArrayLevels) * gLayerCount;
+	mBuilt = true;
+
+	std::cout << "INFO: Texture array " << gLayerWidth << "x" << gLayerHeight << " with " << gLayerCount << " layers" << std::endl;
+
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	BuildBindlessTextures()
+//
+//	Give every queued image its own texture at full size,
+//	make its handle resident and store the handles in an
+//	SSBO the fragment shader indexes per draw
+///////////////////////////////////////////////////
+bool Textures::BuildBindlessTextures()
+{
+	if (mPending.empty())
+		return false;
+
+	for (PendingImage& image : mPending)
+	{
+		if (!CreateEntryTexture(image.entry, image.pixels))
+		{
+			// undo what was created so the texture array can take over
+			for (size_t i = 0; i < mEntries.size(); ++i)
+				ReleaseEntryTexture(i);
+			return false;
+		}
+		FillSlots(mEntries[image.entry], 0, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+	}
+
+	std::vector<GLuint64> handles;
+	for (const TextureEntry& entry : mEntries)
+		handles.push_back(entry.handle);
+
+	glGenBuffers(1, &gHandleBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gHandleBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint64) * handles.size(), handles.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	for (PendingImage& image : mPending)
+		stbi_image_free(image.pixels);
+	mPending.clear();
+	FreeDecodedImages();
+	mBuilt = true;
+
+	std::cout << "INFO: Bindless textures: " << handles.size() << " resident handles" << std::endl;
+
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	BindTextures(GLuint)
+//
+//	unit: texture unit the surface shader samples from
+//
+//	Bind the texture array, or in bindless mode only the
+//	handle table; one bind covers the whole scene
+///////////////////////////////////////////////////
+void Textures::BindTextures(GLuint unit)
+{
+	if (gBindless)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HANDLE_TABLE_BINDING, gHandleBuffer);
+		return;
+	}
+
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, gTextureArray);
+}
+
+///////////////////////////////////////////////////
+//	DestroyTextures()
+//
+//	Release every texture, the texture array, the
+//	handle table and any images that were never packed
+//	or prefetched images that were never used, once the
+//	reloads still decoding have finished
+///////////////////////////////////////////////////
+void Textures::DestroyTextures()
+{
+	for (std::unique_ptr<Reload>& reload : mReloads)
+	{
+		mReloadJobs->Wait(reload->done);
+		stbi_image_free(reload->pixels);
+	}
+	mReloads.clear();
+
+	for (PendingImage& image : mPending)
+		stbi_image_free(image.pixels);
+	mPending.clear();
+
+	for (size_t i = 0; i < mEntries.size(); ++i)
+		ReleaseEntryTexture(i);
+	mEntries.clear();
+
+	glDeleteTextures(1, &gTextureArray);
+	gTextureArray = 0;
+	gLayerCount = 0;
+
+	glDeleteBuffers(1, &gHandleBuffer);
+	gHandleBuffer = 0;
+
+	glDeleteBuffers(1, &mStagingBuffer);
+	mStagingBuffer = 0;
+	mStagingFallback.clear();
+
+	gResidentBytes = 0;
+	mBuilt = false;
+}
+
+///////////////////////////////////////////////////
+//	BeginFrame()
+//
+//	Advance the frame counter used for LRU ordering
+///////////////////////////////////////////////////
+void Textures::BeginFrame()
+{
+	++gFrame;
+}
+
+///////////////////////////////////////////////////
+//	Touch(const TextureSlot&)
+//
+//	slot: texture of a draw that survived culling
+//
+//	Mark a texture as used this frame. Nothing is loaded
+//	here; StreamReloads brings back the textures that were
+//	used while evicted or reduced.
+///////////////////////////////////////////////////
+void Textures::Touch(const TextureSlot& slot)
+{
+	if (slot.index < 0 || slot.index >= (GLint)mEntries.size())
+		return;
+
+	mEntries[slot.index].lastUsedFrame = gFrame;
+}
+
+///////////////////////////////////////////////////
+//	StreamReloads(JobSystem&)
+//
+//	jobs: job system the files are decoded on
+//
+//	Upload the reloads whose decode has finished, then
+//	start a decode for every texture used this frame that
+//	is evicted, or reduced while the budget has room for
+//	its full mip chain. Draws keep sampling the reduced
+//	texture until its reload is uploaded; nothing waits.
+///////////////////////////////////////////////////
+void Textures::StreamReloads(JobSystem& jobs)
+{
+	if (!gBindless)
+		return;
+
+	for (size_t i = 0; i < mReloads.size();)
+	{
+		if (!mReloads[i]->done.Done())
+		{
+			++i;
+			continue;
+		}
+		FinishReload(*mReloads[i]);
+		mReloads.erase(mReloads.begin() + i);
+	}
+
+	for (size_t i = 0; i < mEntries.size(); ++i)
+	{
+		TextureEntry& entry = mEntries[i];
+		if (entry.residency == RELEASED || entry.reloading || entry.lastUsedFrame != gFrame || entry.droppedLevels == 0)
+			continue;
+
+		size_t fullBytes = TextureBytes(entry.width, entry.height, MipLevels(entry.width, entry.height));
+		bool fits = gBudgetBytes == 0 || gResidentBytes - entry.bytes + fullBytes <= gBudgetBytes;
+		if (entry.residency != EVICTED && !fits)
+			continue;
+
+		std::unique_ptr<Reload> reload(new Reload());
+		reload->entry = i;
+		reload->filename = entry.filename;
+		reload->reduction = entry.reduction;
+		reload->pixels = nullptr;
+		reload->width = 0;
+		reload->height = 0;
+		entry.reloading = true;
+
+		Reload* decode = reload.get();
+		mReloads.push_back(std::move(reload));
+		mReloadJobs = &jobs;
+		jobs.Run([decode]()
+		{
+			decode->pixels = LoadImage(decode->filename.c_str(), decode->width, decode->height, decode->reduction);
+		}, &decode->done);
+	}
+}
+
+///////////////////////////////////////////////////
+//	EnforceBudget()
+//
+//	Bring texture memory back under gBudgetBytes. The least
+//	recently used texture that can still drop a mip level is
+//	reduced first; only when none can is the least recently
+//	used texture evicted down to its mip tail. Textures drawn
+//	this frame are never evicted, and drop mips only when no
+//	other texture is left to evict.
+///////////////////////////////////////////////////
+void Textures::EnforceBudget()
+{
+	if (gBudgetBytes == 0)
+		return;
+
+	// the array is shared by every draw, so it can only shrink
+	if (!gBindless)
+	{
+		while (gResidentBytes > gBudgetBytes && gArrayLevels > 1 &&
+			gLayerWidth / 2 >= MIN_ARRAY_LAYER_SIZE && gLayerHeight / 2 >= MIN_ARRAY_LAYER_SIZE)
+			DropArrayTopLevel();
+		return;
+	}
+
+	while (gResidentBytes > gBudgetBytes)
+	{
+		size_t reduce = mEntries.size();
+		size_t evict = mEntries.size();
+
+		for (size_t i = 0; i < mEntries.size(); ++i)
+		{
+			const TextureEntry& entry = mEntries[i];
+			if (entry.residency != RESIDENT)
+				continue;
+
+			bool canDrop = entry.droppedLevels < MAX_DROPPED_LEVELS &&
+				MipLevels(entry.width, entry.height) - entry.droppedLevels > 1;
+			if (canDrop && (reduce == mEntries.size() || entry.lastUsedFrame < mEntries[reduce].lastUsedFrame))
+				reduce = i;
+			if (entry.lastUsedFrame != gFrame && (evict == mEntries.size() || entry.lastUsedFrame < mEntries[evict].lastUsedFrame))
+				evict = i;
+		}
+
+		// textures drawn this frame only lose mips once nothing else is left to evict
+		if (reduce < mEntries.size() && (mEntries[reduce].lastUsedFrame != gFrame || evict == mEntries.size()))
+			DropTopLevels(reduce, 1);
+		else if (evict < mEntries.size())
+		{
+			// keep the smallest mips so draws have something to sample while the texture reloads
+			TextureEntry& entry = mEntries[evict];
+			GLint tail = entry.droppedLevels;
+			while (std::max(entry.width >> tail, entry.height >> tail) > EVICTED_TAIL_SIZE)
+				++tail;
+
+			std::cout << "INFO: Evicting texture " << entry.filename << std::endl;
+			if (tail > entry.droppedLevels)
+				DropTopLevels(evict, tail - entry.droppedLevels);
+			entry.residency = EVICTED;
+		}
+		else
+			break;	// everything left was drawn this frame and is reduced as far as it goes
+	}
+}
+
+///////////////////////////////////////////////////
+//	PrintResidency()
+//
+//	Print the memory estimate and state of every texture
+///////////////////////////////////////////////////
+void Textures::PrintResidency()
+{
+	std::cout << "Texture memory: " << gResidentBytes / (1024 * 1024) << " MB";
+	if (gBudgetBytes > 0)
+		std::cout << " of " << gBudgetBytes / (1024 * 1024) << " MB budget";
+	std::cout << std::endl;
+
+	if (!gBindless)
+		std::cout << "  array " << gLayerWidth << "x" << gLayerHeight << " x" << gLayerCount << ", " << gArrayLevels << " levels" << std::endl;
+
+	for (const TextureEntry& entry : mEntries)
+	{
+		const char* state = entry.residency == RESIDENT ? "resident" : entry.residency == EVICTED ? "evicted" : "released";
+		std::cout << "  " << entry.filename << ": " << state << ", refs " << entry.refCount
+			<< ", dropped levels " << entry.droppedLevels << ", " << entry.bytes / 1024 << " KB"
+			<< ", last used frame " << entry.lastUsedFrame << std::endl;
+	}
+}
+
+///////////////////////////////////////////////////
+//	PackAtlasImages(std::vector<PendingImage*>&, GLint)
+//
+//	images: odd-size images to place
+//	firstLayer: first layer not taken by a same-size image
+//
+//	Shelf-pack the images tallest first; a new shelf starts
+//	when a row is full and a new layer when the shelves are.
+//	Returns the total number of layers in use.
+///////////////////////////////////////////////////
+GLint Textures::PackAtlasImages(std::vector<PendingImage*>& images, GLint firstLayer)
+{
+	if (images.empty())
+		return firstLayer;
+
+	std::sort(images.begin(), images.end(), [](const PendingImage* a, const PendingImage* b) {
+		return a->height > b->height;
+	});
+
+	GLint layer = firstLayer;
+	GLint cursorX = 0;
+	GLint cursorY = 0;
+	GLint shelfHeight = 0;
+
+	for (PendingImage* image : images)
+	{
+		GLint paddedWidth = image->width + 2 * ATLAS_PADDING;
+		GLint paddedHeight = image->height + 2 * ATLAS_PADDING;
+
+		// start a new shelf when the row is full
+		if (cursorX + paddedWidth > gLayerWidth)
+		{
+			cursorY += shelfHeight;
+			cursorX = 0;
+			shelfHeight = 0;
+		}
+
+		// start a new layer when the shelves are full
+		if (cursorY + paddedHeight > gLayerHeight)
+		{
+			++layer;
+			cursorX = 0;
+			cursorY = 0;
+			shelfHeight = 0;
+		}
+
+		image->x = cursorX + ATLAS_PADDING;
+		image->y = cursorY + ATLAS_PADDING;
+		image->layer = layer;
+
+		cursorX += paddedWidth;
+		shelfHeight = std::max(shelfHeight, paddedHeight);
+	}
+
+	return layer + 1;
+}
+
+///////////////////////////////////////////////////
+//	UploadPadded(const PendingImage&, GLint)
+//
+//	image: packed image to upload to the bound array
+//	padding: texels of repeated edge around the image
+//
+//	Copy an image into its layer, surrounded by a border
+//	of its own edge texels
+///////////////////////////////////////////////////
+void Textures::UploadPadded(const PendingImage& image, GLint padding)
+{
+	const void* pixels = StageImage(image.pixels, image.width, image.height, padding);
+
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, image.x - padding, image.y - padding, image.layer,
+		image.width + 2 * padding, image.height + 2 * padding, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+///////////////////////////////////////////////////
+//	StageImage(const unsigned char*, int, int, GLint)
+//
+//	pixels: decoded RGBA8 image, top row first
+//	width, height: size of the image
+//	padding: texels of repeated edge around the image
+//
+//	Write the image bottom row first (OpenGL's orientation)
+//	with its padding into the mapped staging PBO. Returns the
+//	pointer to pass to glTexSubImage: offset 0 with the PBO
+//	bound, or a client copy if the buffer could not be mapped.
+//	Unbind GL_PIXEL_UNPACK_BUFFER after the upload.
+///////////////////////////////////////////////////
+const void* Textures::StageImage(const unsigned char* pixels, int width, int height, GLint padding)
+{
+	size_t size = (size_t)(width + 2 * padding) * (height + 2 * padding) * TEXTURE_CHANNELS;
+
+	if (mStagingBuffer == 0)
+		glGenBuffers(1, &mStagingBuffer);
+
+	// orphan the previous contents so mapping never waits on an upload in flight
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mStagingBuffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	unsigned char* staging = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (staging)
+	{
+		CopyFlippedPadded(pixels, width, height, padding, staging);
+		if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+			return nullptr; // offset 0 into the bound PBO
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	mStagingFallback.resize(size);
+	CopyFlippedPadded(pixels, width, height, padding, mStagingFallback.data());
+	return mStagingFallback.data();
+}
+
+// Point every slot sharing an image at its place in the array
+void Textures::FillSlots(const TextureEntry& entry, GLint layer, const glm::vec4& rect)
+{
+	for (TextureSlot* slot : entry.slots)
+	{
+		slot->layer = layer;
+		slot->rect = rect;
+	}
+}
+
+///////////////////////////////////////////////////
+//	CreateEntryTexture(size_t, const unsigned char*)
+//
+//	index: texture table entry
+//	pixels: full-size RGBA8 image
+//
+//	Create the bindless texture of an entry with its full
+//	mip chain and make its handle resident
+///////////////////////////////////////////////////
+bool Textures::CreateEntryTexture(size_t index, const unsigned char* pixels)
+{
+	TextureEntry& entry = mEntries[index];
+	GLint levels = MipLevels(entry.width, entry.height);
+
+	GLuint textureId;
+	glGenTextures(1, &textureId);
+	glBindTexture(GL_TEXTURE_2D, textureId);
+
+	// set the texture wrapping parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, entry.width, entry.height);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, entry.width, entry.height, GL_RGBA, GL_UNSIGNED_BYTE,
+		StageImage(pixels, entry.width, entry.height, 0));
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+
+	// the texture becomes immutable once a handle is taken, so set everything first
+	GLuint64 handle = glGetTextureHandleARB(textureId);
+	if (handle == 0)
+	{
+		glDeleteTextures(1, &textureId);
+		return false;
+	}
+	glMakeTextureHandleResidentARB(handle);
+
+	entry.textureId = textureId;
+	entry.handle = handle;
+	entry.droppedLevels = 0;
+	entry.bytes = TextureBytes(entry.width, entry.height, levels);
+	entry.residency = RESIDENT;
+	gResidentBytes += entry.bytes;
+
+	return true;
+}
+
+// Free the bindless texture of an entry, keeping its bookkeeping
+void Textures::ReleaseEntryTexture(size_t index)
+{
+	TextureEntry& entry = mEntries[index];
+	if (entry.textureId == 0)
+		return;
+
+	glMakeTextureHandleNonResidentARB(entry.handle);
+	glDeleteTextures(1, &entry.textureId);
+
+	gResidentBytes -= entry.bytes;
+	entry.textureId = 0;
+	entry.handle = 0;
+	entry.bytes = 0;
+}
+
+// Write the handle of an entry into the handle table
+void Textures::UploadHandle(size_t index)
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gHandleBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint64) * index, sizeof(GLuint64), &mEntries[index].handle);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+///////////////////////////////////////////////////
+//	DropTopLevels(size_t, GLint)
+//
+//	index: texture table entry
+//	count: top mip levels to drop
+//
+//	Replace a bindless texture with one that starts `count`
+//	levels further down, copying the remaining levels on
+//	the GPU
+///////////////////////////////////////////////////
+void Textures::DropTopLevels(size_t index, GLint count)
+{
+	TextureEntry& entry = mEntries[index];
+	GLint levels = MipLevels(entry.width, entry.height) - entry.droppedLevels;
+	count = std::min(count, levels - 1);
+	if (count <= 0)
+		return;
+
+	GLint width = std::max(entry.width >> (entry.droppedLevels + count), 1);
+	GLint height = std::max(entry.height >> (entry.droppedLevels + count), 1);
+
+	GLuint textureId;
+	glGenTextures(1, &textureId);
+	glBindTexture(GL_TEXTURE_2D, textureId);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexStorage2D(GL_TEXTURE_2D, levels - count, GL_RGBA8, width, height);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	for (GLint level = 0; level < levels - count; ++level)
+		glCopyImageSubData(entry.textureId, GL_TEXTURE_2D, level + count, 0, 0, 0,
+			textureId, GL_TEXTURE_2D, level, 0, 0, 0,
+			std::max(width >> level, 1), std::max(height >> level, 1), 1);
+
+	GLuint64 handle = glGetTextureHandleARB(textureId);
+	if (handle == 0)
+	{
+		glDeleteTextures(1, &textureId);
+		return;
+	}
+	glMakeTextureHandleResidentARB(handle);
+
+	ReleaseEntryTexture(index);
+	entry.textureId = textureId;
+	entry.handle = handle;
+	entry.droppedLevels += count;
+	entry.bytes = TextureBytes(width, height, levels - count);
+	gResidentBytes += entry.bytes;
+	UploadHandle(index);
+}
+
+///////////////////////////////////////////////////
+//	DropArrayTopLevel()
+//
+//	Replace the texture array with one that starts at its
+//	next mip level. Slot rectangles are relative to the
+//	layer size, so they stay valid.
+///////////////////////////////////////////////////
+void Textures::DropArrayTopLevel()
+{
+	GLint width = std::max(gLayerWidth / 2, 1);
+	GLint height = std::max(gLayerHeight / 2, 1);
+
+	GLuint arrayId;
+	glGenTextures(1, &arrayId);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, arrayId);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, gArrayLevels - 1, GL_RGBA8, width, height, gLayerCount);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	for (GLint level = 0; level < gArrayLevels - 1; ++level)
+		glCopyImageSubData(gTextureArray, GL_TEXTURE_2D_ARRAY, level + 1, 0, 0, 0,
+			arrayId, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+			std::max(width >> level, 1), std::max(height >> level, 1), gLayerCount);
+
+	glDeleteTextures(1, &gTextureArray);
+	gTextureArray = arrayId;
+	gLayerWidth = width;
+	gLayerHeight = height;
+	gArrayLevels -= 1;
+	gResidentBytes = TextureBytes(gLayerWidth, gLayerHeight, gArrayLevels) * gLayerCount;
+
+	std::cout << "INFO: Texture array reduced to " << gLayerWidth << "x" << gLayerHeight << " to stay in budget" << std::endl;
+}
+
+// Give a reloaded entry its full-size texture back; the entry may have been released while it decoded
+void Textures::FinishReload(Reload& reload)
+{
+	TextureEntry& entry = mEntries[reload.entry];
+	entry.reloading = false;
+
+	if (reload.pixels && entry.residency != RELEASED)
+	{
+		ReleaseEntryTexture(reload.entry);
+		entry.width = reload.width;
+		entry.height = reload.height;
+		if (CreateEntryTexture(reload.entry, reload.pixels))
+			UploadHandle(reload.entry);
+	}
+	stbi_image_free(reload.pixels);
+	reload.pixels = nullptr;
+}
+
+// Hand over a prefetched image for the file and reduction, or null when there is none
+unsigned char* Textures::TakeDecodedImage(const char* filename, int& width, int& height, int reduction)
+{
+	for (size_t i = 0; i < mDecoded.size(); ++i)
+	{
+		DecodedImage& decoded = mDecoded[i];
+		if (!decoded.pixels || decoded.filename != filename || decoded.reduction != reduction)
+			continue;
+
+		unsigned char* pixels = decoded.pixels;
+		width = decoded.width;
+		height = decoded.height;
+		mDecoded.erase(mDecoded.begin() + i);
+		return pixels;
+	}
+	return nullptr;
+}
+
+// Free prefetched images that were never used
+void Textures::FreeDecodedImages()
+{
+	for (DecodedImage& decoded : mDecoded)
+		stbi_image_free(decoded.pixels);
+	mDecoded.clear();
+}
+
+// Decode an image file into RGBA8 pixels, top row first; free with stbi_image_free.
+// The file is memory mapped so the decoder reads the page cache directly instead
+// of copying it through stdio buffers. Each reduction step halves the image.
+unsigned char* Textures::LoadImage(const char* filename, int& width, int& height, int reduction)
+{
+	int channels;
+	unsigned char* image;
+	MappedFile file;
+	if (file.Open(filename))
+	{
+		image = stbi_load_from_memory(file.data, (int)file.size, &width, &height, &channels, TEXTURE_CHANNELS);
+		file.Close();
+	}
+	else
+		image = stbi_load(filename, &width, &height, &channels, TEXTURE_CHANNELS);
+
+	for (int i = 0; image && i < reduction; ++i)
+		HalveImage(image, width, height, true);
+
+	return image;
+}
+
+// Copy an image bottom row first, as OpenGL expects, surrounded by `padding` texels of its own edge
+void Textures::CopyFlippedPadded(const unsigned char* pixels, int width, int height, GLint padding, unsigned char* destination)
+{
+	size_t rowBytes = (size_t)width * TEXTURE_CHANNELS;
+	size_t paddedRowBytes = (size_t)(width + 2 * padding) * TEXTURE_CHANNELS;
+
+	for (int y = 0; y < height + 2 * padding; ++y)
+	{
+		// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
+		int glRow = std::min(std::max(y - padding, 0), height - 1);
+		const unsigned char* src = pixels + (size_t)(height - 1 - glRow) * rowBytes;
+		unsigned char* dst = destination + y * paddedRowBytes;
+
+		for (int x = 0; x < padding; ++x)
+			memcpy(dst + x * TEXTURE_CHANNELS, src, TEXTURE_CHANNELS);
+		memcpy(dst + padding * TEXTURE_CHANNELS, src, rowBytes);
+		for (int x = 0; x < padding; ++x)
+			memcpy(dst + (padding + width + x) * TEXTURE_CHANNELS, src + rowBytes - TEXTURE_CHANNELS, TEXTURE_CHANNELS);
+	}
+}
+
+// Downsample an RGBA8 image to half size with a 2x2 box filter
+void Textures::HalveImage(unsigned char*& pixels, int& width, int& height, bool simd)
+{
+	int halfWidth = std::max(width / 2, 1);
+	int halfHeight = std::max(height / 2, 1);
+	unsigned char* halved = (unsigned char*)malloc((size_t)halfWidth * halfHeight * TEXTURE_CHANNELS);
+	SimdLevel level = simd ? SIMD_LEVEL : SIMD_NONE;
+
+	for (int y = 0; y < halfHeight; ++y)
+	{
+		const unsigned char* row0 = pixels + (size_t)std::min(y * 2, height - 1) * width * TEXTURE_CHANNELS;
+		const unsigned char* row1 = pixels + (size_t)std::min(y * 2 + 1, height - 1) * width * TEXTURE_CHANNELS;
+		HalveRows(row0, row1, width, halfWidth, halved + (size_t)y * halfWidth * TEXTURE_CHANNELS, level);
+	}
+
+	stbi_image_free(pixels);
+	pixels = halved;
+	width = halfWidth;
+	height = halfHeight;
+}
+
+///////////////////////////////////////////////////
+//	BenchmarkDecode(const std::vector<std::string>&, int)
+//
+//	filenames: images to decode
+//	iterations: decodes per image and path
+//
+//	Time the stdio stb_image path against the mapped-file
+//	path, the 1/2 and 1/4 loads (a full decode followed by
+//	the SIMD halving kernels) and the halving kernels alone,
+//	scalar against SIMD. Each file is decoded once untimed
+//	so every path reads from the page cache, and the two
+//	full-decode paths alternate which one runs first. The
+//	reduced loads are checked against the full decode
+//	downsampled by an exact box filter of the same size.
+//	Prints one JSON object.
+///////////////////////////////////////////////////
+void Textures::BenchmarkDecode(const std::vector<std::string>& filenames, int iterations)
+{
+	typedef std::chrono::steady_clock Clock;
+	const char* simdNames[] = { "none", "sse2", "avx2" };
+
+	std::cout << "{\n  \"simd\": \"" << simdNames[SIMD_LEVEL] << "\",\n  \"iterations\": " << iterations << ",\n  \"images\": [";
+
+	for (size_t f = 0; f < filenames.size(); ++f)
+	{
+		const char* filename = filenames[f].c_str();
+		double stdioMs = 0.0, mappedMs = 0.0;
+		double loadMs[2] = { 0.0, 0.0 }, scalarMs[2] = { 0.0, 0.0 }, simdMs[2] = { 0.0, 0.0 };
+		int maxDiff[2] = { 0, 0 };
+		double psnr[2] = { 0.0, 0.0 };
+		int width = 0, height = 0, channels;
+
+		// warm-up: the first read of a file pays for the disk, not the decoder
+		stbi_image_free(LoadImage(filename, width, height, 0));
+
+		for (int i = 0; i < iterations; ++i)
+		{
+			unsigned char* full = nullptr;
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				bool stdio = (pass == 0) == (i % 2 == 0);
+				Clock::time_point start = Clock::now();
+				unsigned char* decoded = stdio ? stbi_load(filename, &width, &height, &channels, TEXTURE_CHANNELS) : LoadImage(filename, width, height, 0);
+				(stdio ? stdioMs : mappedMs) += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+				if (stdio)
+					stbi_image_free(decoded);
+				else
+					full = decoded;
+			}
+			if (!full)
+				break;
+
+			size_t fullBytes = (size_t)width * height * TEXTURE_CHANNELS;
+			for (int reduction = 0; reduction < 2; ++reduction)
+			{
+				// what UCreateTexture does for a reduced texture
+				int reducedWidth, reducedHeight;
+				Clock::time_point start = Clock::now();
+				unsigned char* reduced = LoadImage(filename, reducedWidth, reducedHeight, reduction + 1);
+				loadMs[reduction] += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+				// the kernels alone, on copies of the full decode
+				unsigned char* scalar = (unsigned char*)malloc(fullBytes);
+				unsigned char* simd = (unsigned char*)malloc(fullBytes);
+				memcpy(scalar, full, fullBytes);
+				memcpy(simd, full, fullBytes);
+				int scalarWidth = width, scalarHeight = height, simdWidth = width, simdHeight = height;
+				for (int step = 0; step <= reduction; ++step)
+				{
+					start = Clock::now();
+					HalveImage(scalar, scalarWidth, scalarHeight, false);
+					scalarMs[reduction] += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+					start = Clock::now();
+					HalveImage(simd, simdWidth, simdHeight, true);
+					simdMs[reduction] += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+				}
+
+				if (i == 0 && reduced)
+				{
+					int referenceWidth, referenceHeight;
+					std::vector<unsigned char> reference = BoxDownsample(full, width, height, 2 << reduction, referenceWidth, referenceHeight);
+					double squaredError = 0.0;
+					size_t count = reference.size();
+					if (referenceWidth != reducedWidth || referenceHeight != reducedHeight)
+						count = 0;
+					for (size_t p = 0; p < count; ++p)
+					{
+						int diff = std::abs((int)reference[p] - (int)reduced[p]);
+						maxDiff[reduction] = std::max(maxDiff[reduction], diff);
+						squaredError += diff * diff;
+					}
+					double mse = count > 0 ? squaredError / count : 255.0 * 255.0;
+					psnr[reduction] = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+				}
+
+				stbi_image_free(reduced);
+				stbi_image_free(scalar);
+				stbi_image_free(simd);
+			}
+
+			stbi_image_free(full);
+		}
+
+		std::cout << (f ? "," : "") << "\n    { \"file\": \"" << filenames[f] << "\", \"width\": " << width << ", \"height\": " << height
+			<< ", \"stdio_ms\": " << stdioMs / iterations << ", \"mapped_ms\": " << mappedMs / iterations;
+		for (int reduction = 0; reduction < 2; ++reduction)
+		{
+			const char* scale = reduction == 0 ? "half" : "quarter";
+			std::cout << ", \"" << scale << "_load_ms\": " << loadMs[reduction] / iterations
+				<< ", \"" << scale << "_scalar_ms\": " << scalarMs[reduction] / iterations
+				<< ", \"" << scale << "_simd_ms\": " << simdMs[reduction] / iterations
+				<< ", \"" << scale << "_max_diff\": " << maxDiff[reduction]
+				<< ", \"" << scale << "_psnr\": " << psnr[reduction];
+		}
+		std::cout << " }";
+	}
+
+	std::cout << "\n  ]\n}" << std::endl;
+}
+
+// Average every factor x factor block of an RGBA8 image with exact rounding, sized like
+// repeated HalveImage calls and clamping at the edges the same way; the benchmark's reference
+std::vector<unsigned char> Textures::BoxDownsample(const unsigned char* pixels, int width, int height, int factor, int& outWidth, int& outHeight)
+{
+	outWidth = width;
+	outHeight = height;
+	for (int size = factor; size > 1; size /= 2)
+	{
+		outWidth = std::max(outWidth / 2, 1);
+		outHeight = std::max(outHeight / 2, 1);
+	}
+
+	std::vector<unsigned char> result((size_t)outWidth * outHeight * TEXTURE_CHANNELS);
+	int area = factor * factor;
+	for (int y = 0; y < outHeight; ++y)
+		for (int x = 0; x < outWidth; ++x)
+			for (int c = 0; c < TEXTURE_CHANNELS; ++c)
+			{
+				int sum = 0;
+				for (int dy = 0; dy < factor; ++dy)
+					for (int dx = 0; dx < factor; ++dx)
+					{
+						int sx = std::min(x * factor + dx, width - 1);
+						int sy = std::min(y * factor + dy, height - 1);
+						sum += pixels[((size_t)sy * width + sx) * TEXTURE_CHANNELS + c];
+					}
+				result[((size_t)y * outWidth + x) * TEXTURE_CHANNELS + c] = (unsigned char)((sum + area / 2) / area);
+			}
+	return result;
+}
+
+// Number of levels in a full mip chain
+GLint Textures::MipLevels(int width, int height)
+{
+	GLint levels = 1;
+	for (int size = std::max(width, height); size > 1; size /= 2)
+		++levels;
+	return levels;
+}
+
+// Estimated GPU memory of an RGBA8 texture with the given mip levels
+size_t Textures::TextureBytes(int width, int height, GLint levels)
+{
+	size_t bytes = 0;
+	for (GLint level = 0; level < levels; ++level)
+		bytes += (size_t)std::max(width >> level, 1) * std::max(height >> level, 1) * TEXTURE_CHANNELS;
+	return bytes;
+}
+
+
+// Times decode + flipped copy (the UCreateTexture path) and the flip alone, per image size
+void Textures::BenchmarkTextures(MicroBenchmark& suite, const std::vector<std::string>& filenames)
+{
+	for (const std::string& filename : filenames)
+	{
+		int width = 0, height = 0;
+		unsigned char* pixels = LoadImage(filename.c_str(), width, height, 0);
+		if (!pixels)
+		{
+			std::cout << "Failed to load " << filename << std::endl;
+			continue;
+		}
+
+		std::string size = std::to_string(width) + "x" + std::to_string(height);
+		std::vector<unsigned char> flipped(size_t(width) * height * TEXTURE_CHANNELS);
+
+		suite.Run("Textures/DecodeFlip/" + size + "/" + filename, [&]()
+		{
+			int decodedWidth, decodedHeight;
+			unsigned char* decoded = LoadImage(filename.c_str(), decodedWidth, decodedHeight, 0);
+			CopyFlippedPadded(decoded, decodedWidth, decodedHeight, 0, flipped.data());
+			stbi_image_free(decoded);
+			MicroBenchmark::DoNotOptimize(flipped[0]);
+		});
+
+		suite.Run("Textures/Flip/" + size + "/" + filename, [&]()
+		{
+			CopyFlippedPadded(pixels, width, height, 0, flipped.data());
+			MicroBenchmark::DoNotOptimize(flipped[0]);
+		});
+
+		stbi_image_free(pixels);
+	}
+}
@@ -0,0 +1,183 @@
+///////////////////////////////////////////////////////////////////////////////
+// textures.h
+// ========
+// load the scene textures and pack them into a single GL_TEXTURE_2D_ARRAY:
+// same-size images get a layer each, odd sizes are rectangle-packed into
+// atlas layers so the whole scene samples through one texture binding.
+// When ARB_bindless_texture is available every image instead keeps its own
+// texture and the shader reads resident handles from a per-draw table.
+//
+// Textures are reference counted and their GPU memory (mips included) is
+// tracked against an optional budget: least-recently-used textures first
+// drop their top mip levels and are evicted only when that is not enough.
+// Use is recorded from the draws that survive culling. An evicted texture
+// keeps its smallest mips, which draws sample until the file has been
+// decoded again on the job system and the full texture replaces them.
+//
+// Image files are memory mapped and decoded straight from the mapping; the
+// decoded pixels are flipped while being copied into a mapped pixel unpack
+// buffer, so there is no separate flip pass or client-memory upload copy.
+//
+// JPEG decoding relies on stb_image's SSE2 IDCT and colour conversion. Images
+// can be loaded at 1/2 or 1/4 size: they are decoded at full size and then
+// downsampled by SSE2/AVX2 box-filter kernels picked at run time, which saves
+// texture memory and upload time but not decode time. PrefetchImages decodes
+// a batch of files on the job system ahead of the UCreateTexture calls that
+// will use them
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "jobsystem.h"
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class MicroBenchmark;
+
+class Textures
+{
+public:
+	// Stores where a loaded image lives inside the texture array
+	struct TextureSlot
+	{
+		GLint layer;		// Layer of the texture array holding the image
+		glm::vec4 rect;		// xy = offset, zw = size of the image inside the layer (uv units)
+		GLint index;		// Entry of the texture table (and of the bindless handle table)
+	};
+
+private:
+	// Residency of a loaded image
+	enum Residency
+	{
+		RESIDENT,			// On the GPU, possibly with top mips dropped
+		EVICTED,			// Only the mip tail is kept to stay in budget; reloaded from file on next use
+		RELEASED			// Reference count reached zero
+	};
+
+	// Bookkeeping for one loaded image
+	struct TextureEntry
+	{
+		std::string filename;
+		int reduction;				// Times the image is halved after decoding
+		int refCount;
+		int width;					// Full size of the decoded image
+		int height;
+		GLuint textureId;			// Own texture in bindless mode
+		GLuint64 handle;			// Resident handle in bindless mode
+		GLint droppedLevels;		// Top mip levels dropped to save memory
+		size_t bytes;				// Estimated GPU memory, mips included
+		unsigned long long lastUsedFrame;
+		Residency residency;
+		bool reloading;				// A Reload is decoding its file
+		std::vector<TextureSlot*> slots;	// Slots sharing this image
+	};
+
+	// Decoded image waiting to be packed into the texture array
+	struct PendingImage
+	{
+		unsigned char* pixels;	// RGBA8, top row first; flipped during upload
+		int width;
+		int height;
+		GLint x;				// Placement inside the array once packed
+		GLint y;
+		GLint layer;
+		GLint padding;			// Repeated edge texels around it; only atlas images have any
+		size_t entry;			// Texture table entry the image belongs to
+	};
+
+	// Decode of an evicted or reduced texture on the job system; uploaded by StreamReloads once done
+	struct Reload
+	{
+		size_t entry;
+		std::string filename;
+		int reduction;
+		unsigned char* pixels;	// RGBA8, top row first; null when decoding failed
+		int width;
+		int height;
+		JobSystem::Counter done;
+	};
+
+	// Image decoded by PrefetchImages, waiting for its UCreateTexture call
+	struct DecodedImage
+	{
+		std::string filename;
+		int reduction;
+		unsigned char* pixels;	// RGBA8, top row first; null when decoding failed
+		int width;
+		int height;
+	};
+
+public:
+	GLuint gTextureArray = 0;	// Handle for the GL_TEXTURE_2D_ARRAY
+	GLint gLayerWidth = 0;		// Size of every layer of the array
+	GLint gLayerHeight = 0;
+	GLint gLayerCount = 0;
+	GLint gArrayLevels = 0;		// Mip levels currently stored in the array
+
+	bool gBindless = false;		// Textures are sampled through resident handles
+	bool gAllowBindless = true;	// Cleared to force the texture array path
+	GLuint gHandleBuffer = 0;	// SSBO holding the handle table
+
+	size_t gBudgetBytes = 0;	// GPU memory budget for textures, 0 for unlimited
+	size_t gResidentBytes = 0;	// Estimated GPU memory currently used by textures
+	unsigned long long gFrame = 0;
+
+public:
+	void PrefetchImages(JobSystem& jobs, const std::vector<std::string>& filenames, int reduction = 0);
+	bool UCreateTexture(const char* filename, TextureSlot& slot, int reduction = 0);
+	void UDestroyTexture(TextureSlot& slot);
+	bool BuildTextures();
+	void BindTextures(GLuint unit);
+	void DestroyTextures();
+
+	void BeginFrame();
+	void Touch(const TextureSlot& slot);
+	void StreamReloads(JobSystem& jobs);
+	bool ReloadsPending() const { return !mReloads.empty(); }	// Decodes StreamReloads has yet to upload
+	void EnforceBudget();
+	void PrintResidency();
+
+	static void BenchmarkDecode(const std::vector<std::string>& filenames, int iterations);
+	static void BenchmarkTextures(MicroBenchmark& suite, const std::vector<std::string>& filenames);
+
+private:
+	bool BuildTextureArray();
+	bool BuildBindlessTextures();
+	GLint PackAtlasImages(std::vector<PendingImage*>& images, GLint firstLayer);
+	void UploadPadded(const PendingImage& image, GLint padding);
+	const void* StageImage(const unsigned char* pixels, int width, int height, GLint padding);
+	void FillSlots(const TextureEntry& entry, GLint layer, const glm::vec4& rect);
+
+	bool CreateEntryTexture(size_t index, const unsigned char* pixels);
+	void ReleaseEntryTexture(size_t index);
+	void UploadHandle(size_t index);
+	void DropTopLevels(size_t index, GLint count);
+	void DropArrayTopLevel();
+	void FinishReload(Reload& reload);
+
+	unsigned char* TakeDecodedImage(const char* filename, int& width, int& height, int reduction);
+	void FreeDecodedImages();
+
+	static unsigned char* LoadImage(const char* filename, int& width, int& height, int reduction);
+	static void CopyFlippedPadded(const unsigned char* pixels, int width, int height, GLint padding, unsigned char* destination);
+	static void HalveImage(unsigned char*& pixels, int& width, int& height, bool simd);
+	static std::vector<unsigned char> BoxDownsample(const unsigned char* pixels, int width, int height, int factor, int& outWidth, int& outHeight);
+	static GLint MipLevels(int width, int height);
+	static size_t TextureBytes(int width, int height, GLint levels);
+
+	std::vector<TextureEntry> mEntries;
+	std::vector<PendingImage> mPending;
+	std::vector<DecodedImage> mDecoded;		// Filled by PrefetchImages
+	std::vector<std::unique_ptr<Reload>> mReloads;	// Decodes in flight
+	JobSystem* mReloadJobs = nullptr;		// Job system the reloads run on
+	bool mBuilt = false;
+
+	GLuint mStagingBuffer = 0;					// Pixel unpack buffer uploads are staged through
+	std::vector<unsigned char> mStagingFallback;	// Used when the staging buffer cannot be mapped
+};
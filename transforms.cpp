@@ -0,0 +1,452 @@
+///////////////////////////////////////////////////////////////////////////////
+// transforms.cpp
+// ========
+// the scene's transform hierarchy. Every node has a local translation,
+// rotation and scale relative to its parent, so a grouped prop (the globe,
+// the cup, the Switch dock) is moved by editing its group node alone.
+//
+// Nodes are stored as structure-of-arrays, sorted by depth: parents always
+// come before their children and every depth is one contiguous span. An
+// update walks the spans in order, each split across the job system, and
+// recomputes world matrices only where a node or one of its ancestors was
+// changed since the last update. Each node remembers the update that last
+// moved it, so caches built from its matrix can tell when they are stale.
+//
+// World matrices are composed straight from translation, rotation and
+// scale by SSE or AVX kernels picked at run time, skipping the rotation
+// for nodes that have none, and the normal matrix (inverse transpose of the
+// upper 3x3) is produced in the same pass.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "transforms.h"
+#include "cpuprofiler.h"
+#include "microbench.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TRANSFORMS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+const TransformHierarchy::Node TransformHierarchy::NO_PARENT;
+
+namespace
+{
+	// Instruction sets the compose kernels can use
+	enum SimdLevel
+	{
+		SIMD_NONE,
+		SIMD_SSE2,
+		SIMD_AVX
+	};
+
+	// Pick the widest kernel the CPU supports
+	SimdLevel DetectSimdLevel()
+	{
+#if defined(TRANSFORMS_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		bool sse2 = (info[3] & (1 << 26)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0 && osxsave && (_xgetbv(0) & 0x6) == 0x6;
+		return avx ? SIMD_AVX : sse2 ? SIMD_SSE2 : SIMD_NONE;
+#elif defined(TRANSFORMS_X86) && defined(__GNUC__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx"))
+			return SIMD_AVX;
+		return __builtin_cpu_supports("sse2") ? SIMD_SSE2 : SIMD_NONE;
+#else
+		return SIMD_NONE;
+#endif
+	}
+
+	const SimdLevel SIMD_LEVEL = DetectSimdLevel();
+
+	// Matrices composed per run of the compose benchmark
+	const size_t BENCHMARK_MATRICES = 100000;
+
+	bool IsIdentity(const glm::mat4& matrix)
+	{
+		return matrix == glm::mat4(1.0f);
+	}
+
+	// Reference kernel: world = parent * translate * rotation * scale, and its normal matrix
+	void ComposeScalar(const glm::mat4* parent, const glm::vec3& translation, const glm::mat4& rotation, bool identityRotation,
+		const glm::vec3& scale, glm::mat4& world, TransformHierarchy::NormalMatrix& normal)
+	{
+		glm::mat4 local(1.0f);
+		for (int column = 0; column < 3; ++column)
+			local[column] = identityRotation ? local[column] * scale[column] : rotation[column] * scale[column];
+		local[3] = glm::vec4(translation, 1.0f);
+		world = parent ? *parent * local : local;
+
+		// the inverse transpose of columns a, b, c has columns b x c, c x a, a x b over the determinant
+		glm::vec3 a(world[0]), b(world[1]), c(world[2]);
+		glm::vec3 bc = glm::cross(b, c), ca = glm::cross(c, a), ab = glm::cross(a, b);
+		float determinant = glm::dot(a, bc);
+		float inverse = determinant != 0.0f ? 1.0f / determinant : 0.0f;
+		normal.columns[0] = glm::vec4(bc * inverse, 0.0f);
+		normal.columns[1] = glm::vec4(ca * inverse, 0.0f);
+		normal.columns[2] = glm::vec4(ab * inverse, 0.0f);
+	}
+
+#ifdef TRANSFORMS_X86
+	// p[0..3] * v: a column of parent * local
+	inline __m128 TransformColumn(const __m128* p, __m128 v)
+	{
+		__m128 result = _mm_mul_ps(p[0], _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+		result = _mm_add_ps(result, _mm_mul_ps(p[1], _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+		result = _mm_add_ps(result, _mm_mul_ps(p[2], _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+		return _mm_add_ps(result, _mm_mul_ps(p[3], _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+	}
+
+	// a x b on xyz; w stays 0 for direction columns
+	inline __m128 Cross(__m128 a, __m128 b)
+	{
+		__m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 cross = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+		return _mm_shuffle_ps(cross, cross, _MM_SHUFFLE(3, 0, 2, 1));
+	}
+
+	// Normal matrix of the world columns a, b, c (w = 0)
+	inline void StoreNormal(__m128 a, __m128 b, __m128 c, TransformHierarchy::NormalMatrix& normal)
+	{
+		__m128 bc = Cross(b, c), ca = Cross(c, a), ab = Cross(a, b);
+
+		__m128 products = _mm_mul_ps(a, bc);
+		__m128 sum = _mm_add_ps(products, _mm_shuffle_ps(products, products, _MM_SHUFFLE(2, 3, 0, 1)));
+		sum = _mm_add_ps(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		float determinant = _mm_cvtss_f32(sum);
+		__m128 inverse = _mm_set1_ps(determinant != 0.0f ? 1.0f / determinant : 0.0f);
+
+		_mm_storeu_ps(&normal.columns[0].x, _mm_mul_ps(bc, inverse));
+		_mm_storeu_ps(&normal.columns[1].x, _mm_mul_ps(ca, inverse));
+		_mm_storeu_ps(&normal.columns[2].x, _mm_mul_ps(ab, inverse));
+	}
+
+	// SSE2: one column per instruction; an identity rotation only scales the parent's columns
+	void ComposeSSE2(const glm::mat4* parent, const glm::vec3& translation, const glm::mat4& rotation, bool identityRotation,
+		const glm::vec3& scale, glm::mat4& world, TransformHierarchy::NormalMatrix& normal)
+	{
+		__m128 local3 = _mm_setr_ps(translation.x, translation.y, translation.z, 1.0f);
+		__m128 columns[4];
+
+		if (parent)
+		{
+			__m128 p[4] = { _mm_loadu_ps(&(*parent)[0].x), _mm_loadu_ps(&(*parent)[1].x), _mm_loadu_ps(&(*parent)[2].x), _mm_loadu_ps(&(*parent)[3].x) };
+			if (identityRotation)
+			{
+				columns[0] = _mm_mul_ps(p[0], _mm_set1_ps(scale.x));
+				columns[1] = _mm_mul_ps(p[1], _mm_set1_ps(scale.y));
+				columns[2] = _mm_mul_ps(p[2], _mm_set1_ps(scale.z));
+			}
+			else
+			{
+				columns[0] = TransformColumn(p, _mm_mul_ps(_mm_loadu_ps(&rotation[0].x), _mm_set1_ps(scale.x)));
+				columns[1] = TransformColumn(p, _mm_mul_ps(_mm_loadu_ps(&rotation[1].x), _mm_set1_ps(scale.y)));
+				columns[2] = TransformColumn(p, _mm_mul_ps(_mm_loadu_ps(&rotation[2].x), _mm_set1_ps(scale.z)));
+			}
+			columns[3] = TransformColumn(p, local3);
+		}
+		else
+		{
+			if (identityRotation)
+			{
+				columns[0] = _mm_setr_ps(scale.x, 0.0f, 0.0f, 0.0f);
+				columns[1] = _mm_setr_ps(0.0f, scale.y, 0.0f, 0.0f);
+				columns[2] = _mm_setr_ps(0.0f, 0.0f, scale.z, 0.0f);
+			}
+			else
+			{
+				columns[0] = _mm_mul_ps(_mm_loadu_ps(&rotation[0].x), _mm_set1_ps(scale.x));
+				columns[1] = _mm_mul_ps(_mm_loadu_ps(&rotation[1].x), _mm_set1_ps(scale.y));
+				columns[2] = _mm_mul_ps(_mm_loadu_ps(&rotation[2].x), _mm_set1_ps(scale.z));
+			}
+			columns[3] = local3;
+		}
+
+		for (int column = 0; column < 4; ++column)
+			_mm_storeu_ps(&world[column].x, columns[column]);
+		StoreNormal(columns[0], columns[1], columns[2], normal);
+	}
+
+	// AVX: two columns per instruction for the parent multiply
+#ifdef __GNUC__
+	__attribute__((target("avx")))
+#endif
+	void ComposeAVX(const glm::mat4* parent, const glm::vec3& translation, const glm::mat4& rotation, bool identityRotation,
+		const glm::vec3& scale, glm::mat4& world, TransformHierarchy::NormalMatrix& normal)
+	{
+		if (!parent || identityRotation)
+			return ComposeSSE2(parent, translation, rotation, identityRotation, scale, world, normal);
+
+		// local columns in pairs: (0, 1) and (2, 3)
+		__m256 scale01 = _mm256_setr_ps(scale.x, scale.x, scale.x, scale.x, scale.y, scale.y, scale.y, scale.y);
+		__m256 local01 = _mm256_mul_ps(_mm256_loadu_ps(&rotation[0].x), scale01);
+		__m256 local23 = _mm256_setr_ps(rotation[2].x * scale.z, rotation[2].y * scale.z, rotation[2].z * scale.z, rotation[2].w * scale.z,
+			translation.x, translation.y, translation.z, 1.0f);
+
+		// each parent column in both halves, each local element spread across its half
+		__m256 p0 = _mm256_broadcast_ps((const __m128*)&(*parent)[0].x);
+		__m256 p1 = _mm256_broadcast_ps((const __m128*)&(*parent)[1].x);
+		__m256 p2 = _mm256_broadcast_ps((const __m128*)&(*parent)[2].x);
+		__m256 p3 = _mm256_broadcast_ps((const __m128*)&(*parent)[3].x);
+
+		__m256 world01 = _mm256_mul_ps(p0, _mm256_permute_ps(local01, 0x00));
+		world01 = _mm256_add_ps(world01, _mm256_mul_ps(p1, _mm256_permute_ps(local01, 0x55)));
+		world01 = _mm256_add_ps(world01, _mm256_mul_ps(p2, _mm256_permute_ps(local01, 0xAA)));
+		world01 = _mm256_add_ps(world01, _mm256_mul_ps(p3, _mm256_permute_ps(local01, 0xFF)));
+
+		__m256 world23 = _mm256_mul_ps(p0, _mm256_permute_ps(local23, 0x00));
+		world23 = _mm256_add_ps(world23, _mm256_mul_ps(p1, _mm256_permute_ps(local23, 0x55)));
+		world23 = _mm256_add_ps(world23, _mm256_mul_ps(p2, _mm256_permute_ps(local23, 0xAA)));
+		world23 = _mm256_add_ps(world23, _mm256_mul_ps(p3, _mm256_permute_ps(local23, 0xFF)));
+
+		_mm256_storeu_ps(&world[0].x, world01);
+		_mm256_storeu_ps(&world[2].x, world23);
+		StoreNormal(_mm256_castps256_ps128(world01), _mm256_extractf128_ps(world01, 1), _mm256_castps256_ps128(world23), normal);
+		_mm256_zeroupper();
+	}
+#endif
+
+	// Compose one node with the widest kernel available
+	inline void Compose(SimdLevel level, const glm::mat4* parent, const glm::vec3& translation, const glm::mat4& rotation, bool identityRotation,
+		const glm::vec3& scale, glm::mat4& world, TransformHierarchy::NormalMatrix& normal)
+	{
+#ifdef TRANSFORMS_X86
+		if (level == SIMD_AVX)
+			return ComposeAVX(parent, translation, rotation, identityRotation, scale, world, normal);
+		if (level == SIMD_SSE2)
+			return ComposeSSE2(parent, translation, rotation, identityRotation, scale, world, normal);
+#endif
+		ComposeScalar(parent, translation, rotation, identityRotation, scale, world, normal);
+	}
+}
+
+
+// Adds a node under parent (or a root for NO_PARENT); the parent must already exist
+TransformHierarchy::Node TransformHierarchy::AddNode(Node parent, const glm::vec3& translation, const glm::mat4& rotation, const glm::vec3& scale)
+{
+	Node node = (Node)mSlots.size();
+
+	// appending keeps every parent ahead of its children; only the depth order is lost
+	mSlots.push_back((unsigned int)mParents.size());
+	mParents.push_back(parent == NO_PARENT ? NO_PARENT : mSlots[parent]);
+	mTranslations.push_back(translation);
+	mRotations.push_back(rotation);
+	mScales.push_back(scale);
+	mIdentityRotations.push_back(IsIdentity(rotation));
+	mWorld.push_back(glm::mat4(1.0f));
+	mNormals.push_back(NormalMatrix());
+	mDirty.push_back(1);
+	mChangedAt.push_back(0);
+
+	mSorted = false;
+	mAnyDirty = true;
+	return node;
+}
+
+
+void TransformHierarchy::Clear()
+{
+	mParents.clear();
+	mTranslations.clear();
+	mRotations.clear();
+	mScales.clear();
+	mIdentityRotations.clear();
+	mWorld.clear();
+	mNormals.clear();
+	mDirty.clear();
+	mChangedAt.clear();
+	mSlots.clear();
+	mLevelStarts.clear();
+	mSorted = true;
+	mAnyDirty = false;
+}
+
+
+void TransformHierarchy::SetTranslation(Node node, const glm::vec3& translation)
+{
+	unsigned int slot = mSlots[node];
+	mTranslations[slot] = translation;
+	mDirty[slot] = 1;
+	mAnyDirty = true;
+}
+
+
+void TransformHierarchy::SetRotation(Node node, const glm::mat4& rotation)
+{
+	unsigned int slot = mSlots[node];
+	mRotations[slot] = rotation;
+	mIdentityRotations[slot] = IsIdentity(rotation);
+	mDirty[slot] = 1;
+	mAnyDirty = true;
+}
+
+
+void TransformHierarchy::SetScale(Node node, const glm::vec3& scale)
+{
+	unsigned int slot = mSlots[node];
+	mScales[slot] = scale;
+	mDirty[slot] = 1;
+	mAnyDirty = true;
+}
+
+
+// Recomputes the world matrices of changed nodes and their descendants, one depth at a time
+void TransformHierarchy::Update(JobSystem& jobs)
+{
+	if (!mAnyDirty)
+		return;
+
+	PROFILE_FUNCTION();
+
+	if (!mSorted)
+		SortByDepth();
+	++mUpdateCount;
+
+	// every parent is finished before the span of its children starts
+	for (size_t level = 0; level + 1 < mLevelStarts.size(); ++level)
+	{
+		size_t start = mLevelStarts[level];
+		jobs.ParallelFor(mLevelStarts[level + 1] - start, gChunkSize, [&](size_t begin, size_t end, unsigned int)
+		{
+			UpdateRange(start + begin, start + end);
+		});
+	}
+
+	std::fill(mDirty.begin(), mDirty.end(), (unsigned char)0);
+	mAnyDirty = false;
+}
+
+
+// Reorders the slots by depth (stable, so siblings keep their order) and records where each depth starts
+void TransformHierarchy::SortByDepth()
+{
+	PROFILE_FUNCTION();
+
+	size_t count = mParents.size();
+
+	// parents come before children, so depths can be filled in slot order
+	std::vector<unsigned int> depths(count);
+	unsigned int maxDepth = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		depths[i] = mParents[i] == NO_PARENT ? 0 : depths[mParents[i]] + 1;
+		maxDepth = std::max(maxDepth, depths[i]);
+	}
+
+	// counting sort by depth
+	mLevelStarts.assign(count ? maxDepth + 2 : 1, 0);
+	for (size_t i = 0; i < count; ++i)
+		++mLevelStarts[depths[i] + 1];
+	for (size_t level = 1; level < mLevelStarts.size(); ++level)
+		mLevelStarts[level] += mLevelStarts[level - 1];
+
+	std::vector<size_t> next(mLevelStarts.begin(), mLevelStarts.end() - 1);
+	std::vector<unsigned int> newSlot(count);
+	for (size_t i = 0; i < count; ++i)
+		newSlot[i] = (unsigned int)next[depths[i]]++;
+
+	std::vector<unsigned int> parents(count);
+	std::vector<glm::vec3> translations(count);
+	std::vector<glm::mat4> rotations(count);
+	std::vector<glm::vec3> scales(count);
+	std::vector<unsigned char> identityRotations(count);
+	std::vector<glm::mat4> world(count);
+	std::vector<NormalMatrix> normals(count);
+	std::vector<unsigned char> dirty(count);
+	std::vector<unsigned long long> changedAt(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		unsigned int slot = newSlot[i];
+		parents[slot] = mParents[i] == NO_PARENT ? NO_PARENT : newSlot[mParents[i]];
+		translations[slot] = mTranslations[i];
+		rotations[slot] = mRotations[i];
+		scales[slot] = mScales[i];
+		identityRotations[slot] = mIdentityRotations[i];
+		world[slot] = mWorld[i];
+		normals[slot] = mNormals[i];
+		dirty[slot] = mDirty[i];
+		changedAt[slot] = mChangedAt[i];
+	}
+	mParents.swap(parents);
+	mTranslations.swap(translations);
+	mRotations.swap(rotations);
+	mScales.swap(scales);
+	mIdentityRotations.swap(identityRotations);
+	mWorld.swap(world);
+	mNormals.swap(normals);
+	mDirty.swap(dirty);
+	mChangedAt.swap(changedAt);
+
+	for (unsigned int& slot : mSlots)
+		slot = newSlot[slot];
+	mSorted = true;
+}
+
+
+// Slots of one depth; the parents' flags and matrices are final by now
+void TransformHierarchy::UpdateRange(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; ++i)
+	{
+		unsigned int parent = mParents[i];
+		if (parent != NO_PARENT && mDirty[parent])
+			mDirty[i] = 1;
+		if (!mDirty[i])
+			continue;
+
+		// transformations are applied right-to-left order: scale, rotate, translate, then the parent's
+		Compose(SIMD_LEVEL, parent == NO_PARENT ? nullptr : &mWorld[parent], mTranslations[i], mRotations[i], mIdentityRotations[i] != 0,
+			mScales[i], mWorld[i], mNormals[i]);
+		mChangedAt[i] = mUpdateCount;
+	}
+}
+
+
+// Times the compose kernels on batches of child nodes, half of them rotated, at every SIMD level the CPU has
+void TransformHierarchy::BenchmarkCompose(MicroBenchmark& suite)
+{
+	std::mt19937 random(330);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	glm::mat4 parent(1.0f);
+	parent[3] = glm::vec4(1.0f, -2.0f, 0.5f, 1.0f);
+	std::vector<glm::vec3> translations(BENCHMARK_MATRICES), scales(BENCHMARK_MATRICES);
+	std::vector<glm::mat4> rotations(BENCHMARK_MATRICES, glm::mat4(1.0f));
+	for (size_t i = 0; i < BENCHMARK_MATRICES; ++i)
+	{
+		translations[i] = glm::vec3(unit(random), unit(random), unit(random)) * 10.0f;
+		scales[i] = glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(2.0f);
+		if (i % 2)
+		{
+			// an orthonormal basis from a random direction
+			glm::vec3 x = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 3.0f));
+			glm::vec3 y = glm::normalize(glm::cross(glm::vec3(0.0f, 0.0f, 1.0f), x));
+			rotations[i][0] = glm::vec4(x, 0.0f);
+			rotations[i][1] = glm::vec4(y, 0.0f);
+			rotations[i][2] = glm::vec4(glm::cross(x, y), 0.0f);
+		}
+	}
+
+	std::vector<glm::mat4> world(BENCHMARK_MATRICES);
+	std::vector<NormalMatrix> normals(BENCHMARK_MATRICES);
+	const char* levelNames[] = { "scalar", "sse2", "avx" };
+	for (int level = SIMD_NONE; level <= SIMD_LEVEL; ++level)
+	{
+		suite.Run(std::string("Transforms/Compose/100k/") + levelNames[level], [&]()
+		{
+			for (size_t i = 0; i < BENCHMARK_MATRICES; ++i)
+				Compose((SimdLevel)level, &parent, translations[i], rotations[i], (i % 2) == 0, scales[i], world[i], normals[i]);
+			MicroBenchmark::DoNotOptimize(world.back());
+		});
+	}
+}
@@ -0,0 +1,87 @@
+///////////////////////////////////////////////////////////////////////////////
+// transforms.h
+// ========
+// the scene's transform hierarchy. Every node has a local translation,
+// rotation and scale relative to its parent, so a grouped prop (the globe,
+// the cup, the Switch dock) is moved by editing its group node alone.
+//
+// Nodes are stored as structure-of-arrays, sorted by depth: parents always
+// come before their children and every depth is one contiguous span. An
+// update walks the spans in order, each split across the job system, and
+// recomputes world matrices only where a node or one of its ancestors was
+// changed since the last update. Each node remembers the update that last
+// moved it, so caches built from its matrix can tell when they are stale.
+//
+// World matrices are composed straight from translation, rotation and
+// scale by SSE or AVX kernels picked at run time, skipping the rotation
+// for nodes that have none, and the normal matrix (inverse transpose of the
+// upper 3x3) is produced in the same pass.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "jobsystem.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+class MicroBenchmark;
+
+class TransformHierarchy
+{
+public:
+	// Stable handle of a node; nodes are moved around internally when sorted by depth
+	typedef unsigned int Node;
+	static const Node NO_PARENT = ~0u;
+
+	// Inverse transpose of a world matrix's upper 3x3, as the three padded columns of a std430 mat3
+	struct NormalMatrix
+	{
+		glm::vec4 columns[3];
+	};
+
+public:
+	size_t gChunkSize = 1024;		// Nodes per job
+
+public:
+	Node AddNode(Node parent, const glm::vec3& translation, const glm::mat4& rotation = glm::mat4(1.0f), const glm::vec3& scale = glm::vec3(1.0f));
+	void Clear();
+
+	void SetTranslation(Node node, const glm::vec3& translation);
+	void SetRotation(Node node, const glm::mat4& rotation);
+	void SetScale(Node node, const glm::vec3& scale);
+	const glm::vec3& Translation(Node node) const { return mTranslations[mSlots[node]]; }
+
+	void Update(JobSystem& jobs);
+
+	// World and normal matrix as of the last Update
+	const glm::mat4& World(Node node) const { return mWorld[mSlots[node]]; }
+	const NormalMatrix& Normal(Node node) const { return mNormals[mSlots[node]]; }
+	unsigned long long ChangedAt(Node node) const { return mChangedAt[mSlots[node]]; }	// Update count that last moved the node, 0 before the first
+	unsigned long long UpdateCount() const { return mUpdateCount; }
+	size_t Size() const { return mSlots.size(); }
+
+	static void BenchmarkCompose(MicroBenchmark& suite);
+
+private:
+	void SortByDepth();
+	void UpdateRange(size_t begin, size_t end);
+
+	// Per slot, in depth order once sorted
+	std::vector<unsigned int> mParents;			// Slot of the parent, or NO_PARENT
+	std::vector<glm::vec3> mTranslations;
+	std::vector<glm::mat4> mRotations;
+	std::vector<glm::vec3> mScales;
+	std::vector<unsigned char> mIdentityRotations;	// Rotation is skipped when composing
+	std::vector<glm::mat4> mWorld;
+	std::vector<NormalMatrix> mNormals;
+	std::vector<unsigned char> mDirty;			// Bytes, not vector<bool>: jobs write neighbouring flags concurrently
+	std::vector<unsigned long long> mChangedAt;	// mUpdateCount when the world matrix was last recomputed
+
+	std::vector<unsigned int> mSlots;			// Slot of every node handle
+	std::vector<size_t> mLevelStarts;			// First slot of every depth, plus the end
+	bool mSorted = true;
+	bool mAnyDirty = false;
+	unsigned long long mUpdateCount = 0;		// Updates that recomputed anything
+};